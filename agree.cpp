@@ -0,0 +1,157 @@
+#include "stdafx.h"
+#include "agree.h"
+
+#include <string.h>
+
+#ifdef INTEL_INTRINSICS
+#include <emmintrin.h>
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Plain C version
+//////////////////////////////////////////////////////////////////////////////
+bool agree_c(const unsigned char* const* rows, unsigned int count, int length)
+{
+    for (unsigned int k = 1; k < count; k++)
+    {
+        if (memcmp(rows[0], rows[k], length) != 0)
+            return false;
+    }
+
+    return true;
+}
+
+template<typename T>
+static bool ValidC(const unsigned char* const* rows, unsigned int count, int length)
+{
+    for (unsigned int k = 0; k < count; k++)
+    {
+        const T* row = (const T*)rows[k];
+
+        for (int i = 0; i < length / (int)sizeof(T); i++)
+        {
+            if (row[i] == 0)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+bool valid_8_c(const unsigned char* const* rows, unsigned int count, int length)
+{
+    return ValidC<uint8_t>(rows, count, length);
+}
+
+bool valid_16_c(const unsigned char* const* rows, unsigned int count, int length)
+{
+    return ValidC<uint16_t>(rows, count, length);
+}
+
+
+#ifdef INTEL_INTRINSICS
+//////////////////////////////////////////////////////////////////////////////
+// SSE2 version, the differences of a row are OR'ed together 16 bytes at a
+// time and looked at once per row
+//////////////////////////////////////////////////////////////////////////////
+bool agree_sse2(const unsigned char* const* rows, unsigned int count, int length)
+{
+    const int vectors = length & ~15;
+
+    for (unsigned int k = 1; k < count; k++)
+    {
+        __m128i differ = _mm_setzero_si128();
+
+        for (int i = 0; i < vectors; i = i + 16)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*)(rows[0] + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(rows[k] + i));
+
+            differ = _mm_or_si128(differ, _mm_xor_si128(a, b));
+        }
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(differ, _mm_setzero_si128())) != 0xffff)
+            return false;
+
+        if (memcmp(rows[0] + vectors, rows[k] + vectors, length - vectors) != 0)
+            return false;
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// SSE2 versions, the zero samples of all rows are OR'ed together 16 bytes at
+// a time and looked at once at the end
+//////////////////////////////////////////////////////////////////////////////
+bool valid_8_sse2(const unsigned char* const* rows, unsigned int count, int length)
+{
+    const int vectors = length & ~15;
+
+    __m128i zeros = _mm_setzero_si128();
+
+    for (unsigned int k = 0; k < count; k++)
+    {
+        for (int i = 0; i < vectors; i = i + 16)
+            zeros = _mm_or_si128(zeros, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(rows[k] + i)), _mm_setzero_si128()));
+
+        const unsigned char* tail = rows[k] + vectors;
+
+        if (!valid_8_c(&tail, 1, length - vectors))
+            return false;
+    }
+
+    return _mm_movemask_epi8(zeros) == 0;
+}
+
+bool valid_16_sse2(const unsigned char* const* rows, unsigned int count, int length)
+{
+    const int vectors = length & ~15;
+
+    __m128i zeros = _mm_setzero_si128();
+
+    for (unsigned int k = 0; k < count; k++)
+    {
+        for (int i = 0; i < vectors; i = i + 16)
+            zeros = _mm_or_si128(zeros, _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(rows[k] + i)), _mm_setzero_si128()));
+
+        const unsigned char* tail = rows[k] + vectors;
+
+        if (!valid_16_c(&tail, 1, length - vectors))
+            return false;
+    }
+
+    return _mm_movemask_epi8(zeros) == 0;
+}
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Pick the fastest version the CPU supports
+//////////////////////////////////////////////////////////////////////////////
+AgreeFunction GetAgreeFunction(int cpuflags)
+{
+#ifdef INTEL_INTRINSICS
+    if (cpuflags & CPUF_AVX2)
+        return agree_avx2;
+
+    if (cpuflags & CPUF_SSE2)
+        return agree_sse2;
+#endif
+
+    return agree_c;
+}
+
+ValidFunction GetValidFunction(int size, int cpuflags)
+{
+#ifdef INTEL_INTRINSICS
+    if (cpuflags & CPUF_AVX2)
+        return size == 1 ? valid_8_avx2 : valid_16_avx2;
+
+    if (cpuflags & CPUF_SSE2)
+        return size == 1 ? valid_8_sse2 : valid_16_sse2;
+#endif
+
+    return size == 1 ? valid_8_c : valid_16_c;
+}
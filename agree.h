@@ -0,0 +1,36 @@
+#ifndef AGREE_H
+#define AGREE_H
+
+//////////////////////////////////////////////////////////////////////////////
+// Whether count rows hold the same length bytes
+//////////////////////////////////////////////////////////////////////////////
+typedef bool (*AgreeFunction)(const unsigned char* const* rows, unsigned int count, int length);
+
+bool agree_c(const unsigned char* const* rows, unsigned int count, int length);
+
+#ifdef INTEL_INTRINSICS
+bool agree_sse2(const unsigned char* const* rows, unsigned int count, int length);
+bool agree_avx2(const unsigned char* const* rows, unsigned int count, int length);
+#endif
+
+AgreeFunction GetAgreeFunction(int cpuflags);
+
+//////////////////////////////////////////////////////////////////////////////
+// Whether no sample of the length bytes of count rows is 0, rows of 8 or
+// 16-bit samples
+//////////////////////////////////////////////////////////////////////////////
+typedef bool (*ValidFunction)(const unsigned char* const* rows, unsigned int count, int length);
+
+bool valid_8_c(const unsigned char* const* rows, unsigned int count, int length);
+bool valid_16_c(const unsigned char* const* rows, unsigned int count, int length);
+
+#ifdef INTEL_INTRINSICS
+bool valid_8_sse2(const unsigned char* const* rows, unsigned int count, int length);
+bool valid_16_sse2(const unsigned char* const* rows, unsigned int count, int length);
+bool valid_8_avx2(const unsigned char* const* rows, unsigned int count, int length);
+bool valid_16_avx2(const unsigned char* const* rows, unsigned int count, int length);
+#endif
+
+ValidFunction GetValidFunction(int size, int cpuflags);
+
+#endif // AGREE_H
@@ -0,0 +1,90 @@
+#include "stdafx.h"
+#include "agree.h"
+
+#include <string.h>
+
+#ifdef INTEL_INTRINSICS
+#include <immintrin.h>
+
+
+//////////////////////////////////////////////////////////////////////////////
+// AVX2 version, 32 bytes at a time
+//////////////////////////////////////////////////////////////////////////////
+bool agree_avx2(const unsigned char* const* rows, unsigned int count, int length)
+{
+    const int vectors = length & ~31;
+
+    bool same = true;
+
+    for (unsigned int k = 1; k < count && same; k++)
+    {
+        __m256i differ = _mm256_setzero_si256();
+
+        for (int i = 0; i < vectors; i = i + 32)
+        {
+            __m256i a = _mm256_loadu_si256((const __m256i*)(rows[0] + i));
+            __m256i b = _mm256_loadu_si256((const __m256i*)(rows[k] + i));
+
+            differ = _mm256_or_si256(differ, _mm256_xor_si256(a, b));
+        }
+
+        same = _mm256_testz_si256(differ, differ) && memcmp(rows[0] + vectors, rows[k] + vectors, length - vectors) == 0;
+    }
+
+    _mm256_zeroupper();
+
+    return same;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// AVX2 versions of the zero check, 32 bytes at a time
+//////////////////////////////////////////////////////////////////////////////
+bool valid_8_avx2(const unsigned char* const* rows, unsigned int count, int length)
+{
+    const int vectors = length & ~31;
+
+    __m256i zeros = _mm256_setzero_si256();
+    bool valid = true;
+
+    for (unsigned int k = 0; k < count && valid; k++)
+    {
+        for (int i = 0; i < vectors; i = i + 32)
+            zeros = _mm256_or_si256(zeros, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(rows[k] + i)), _mm256_setzero_si256()));
+
+        const unsigned char* tail = rows[k] + vectors;
+
+        valid = valid_8_c(&tail, 1, length - vectors);
+    }
+
+    valid = valid && _mm256_testz_si256(zeros, zeros);
+
+    _mm256_zeroupper();
+
+    return valid;
+}
+
+bool valid_16_avx2(const unsigned char* const* rows, unsigned int count, int length)
+{
+    const int vectors = length & ~31;
+
+    __m256i zeros = _mm256_setzero_si256();
+    bool valid = true;
+
+    for (unsigned int k = 0; k < count && valid; k++)
+    {
+        for (int i = 0; i < vectors; i = i + 32)
+            zeros = _mm256_or_si256(zeros, _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)(rows[k] + i)), _mm256_setzero_si256()));
+
+        const unsigned char* tail = rows[k] + vectors;
+
+        valid = valid_16_c(&tail, 1, length - vectors);
+    }
+
+    valid = valid && _mm256_testz_si256(zeros, zeros);
+
+    _mm256_zeroupper();
+
+    return valid;
+}
+
+#endif // INTEL_INTRINSICS
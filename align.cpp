@@ -0,0 +1,326 @@
+#include "stdafx.h"
+
+
+//////////////////////////////////////////////////////////////////////////////
+// One luma sample scaled to 8 bits
+//////////////////////////////////////////////////////////////////////////////
+static inline unsigned int LumaSample(const unsigned char* sample, int size, int shift)
+{
+    if (size == 1)
+        return *sample;
+
+    if (size == 2)
+        return *(const uint16_t*)sample >> shift;
+
+    const float value = *(const float*)sample;
+
+    if (value <= 0.0f)
+        return 0;
+
+    if (value >= 1.0f)
+        return 255;
+
+    return (unsigned int)(value * 255.0f + 0.5f);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Average the luma of a frame down to a small grid of cells
+//
+// Samples are read at their own size and scaled to 8 bits, so clips of any
+// bit depth give comparable signatures. Packed formats use Y for YUY2 and G
+// for RGB, like GetLuma.
+//////////////////////////////////////////////////////////////////////////////
+void ComputeSignature(const VideoInfo& vi, const PVideoFrame& frame, FrameSignature& signature)
+{
+    const unsigned char* ptr = frame->GetReadPtr(PLANAR_Y);
+
+    const int pitch = frame->GetPitch(PLANAR_Y);
+    const int width = vi.width;
+    const int height = frame->GetHeight(PLANAR_Y);
+
+    const int size = vi.ComponentSize();  // Bytes per sample
+    const int shift = vi.BitsPerComponent() - 8;
+    int step = size;                // Bytes between samples
+    int offset = 0;                 // Byte of the sample used
+
+    if (vi.IsYUY2())
+    {
+        step = 2;
+    }
+    else if (vi.IsRGB24() || vi.IsRGB32())
+    {
+        step = vi.IsRGB24() ? 3 : 4;
+        offset = 1;
+    }
+    else if (vi.IsRGB48() || vi.IsRGB64())
+    {
+        step = vi.IsRGB48() ? 6 : 8;
+        offset = 2;
+    }
+
+    for (int cy = 0; cy < SIGNATURE_GRID; cy++)
+    {
+        const int top = cy * height / SIGNATURE_GRID;
+        const int bottom = (cy + 1) * height / SIGNATURE_GRID;
+
+        for (int cx = 0; cx < SIGNATURE_GRID; cx++)
+        {
+            const int left = cx * width / SIGNATURE_GRID;
+            const int right = (cx + 1) * width / SIGNATURE_GRID;
+
+            unsigned long sum = 0;
+            unsigned long count = 0;
+
+            for (int y = top; y < bottom; y++)
+            {
+                const unsigned char* row = ptr + y * pitch + offset;
+
+                for (int x = left; x < right; x++)
+                    sum = sum + LumaSample(row + x * step, size, shift);
+
+                count = count + (right - left);
+            }
+
+            signature.cell[cy * SIGNATURE_GRID + cx] = count > 0 ? (unsigned char)(sum / count) : 0;
+        }
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Sum of absolute cell differences, 0 -> identical
+//////////////////////////////////////////////////////////////////////////////
+unsigned int CompareSignatures(const FrameSignature& a, const FrameSignature& b)
+{
+    unsigned int sum = 0;
+
+    for (unsigned int i = 0; i < SIGNATURE_SIZE; i++)
+        sum = sum + abs((int)a.cell[i] - (int)b.cell[i]);
+
+    return sum;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Compute the signature of every frame of a clip
+//
+// Frames are requested one at a time and released as soon as their signature
+// has been taken, so memory use does not depend on the clip length.
+//////////////////////////////////////////////////////////////////////////////
+void AnalyseClip(PClip clip, vector<FrameSignature>& signatures, IScriptEnvironment* env)
+{
+    const VideoInfo& vi = clip->GetVideoInfo();
+
+    signatures.resize(vi.num_frames);
+
+    for (int n = 0; n < vi.num_frames; n++)
+        ComputeSignature(vi, clip->GetFrame(n, env), signatures[n]);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Perceptual hash of a signature: one bit per cell, set when the cell is
+// brighter than the average of all cells
+//
+// Overall brightness and contrast differences between captures do not
+// change the hash, and noise only flips cells that are close to the average.
+//////////////////////////////////////////////////////////////////////////////
+uint64_t SignatureHash(const FrameSignature& signature)
+{
+    unsigned int sum = 0;
+
+    for (unsigned int i = 0; i < SIGNATURE_SIZE; i++)
+        sum = sum + signature.cell[i];
+
+    uint64_t hash = 0;
+
+    for (unsigned int i = 0; i < SIGNATURE_SIZE; i++)
+    {
+        if (signature.cell[i] * SIGNATURE_SIZE > sum)
+            hash = hash | (1ULL << i);
+    }
+
+    return hash;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Group the frames of a clip by hash, frame numbers are kept in order
+//////////////////////////////////////////////////////////////////////////////
+void BuildFrameIndex(const vector<FrameSignature>& signatures, FrameIndex& index)
+{
+    index.clear();
+
+    for (size_t n = 0; n < signatures.size(); n++)
+        index[SignatureHash(signatures[n])].push_back((int)n);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Find up to count frames whose hash is within one bit of the given hash,
+// closest to the given frame first
+//////////////////////////////////////////////////////////////////////////////
+void LookupFrameIndex(const FrameIndex& index, uint64_t hash, int frame, unsigned int count, vector<int>& candidates)
+{
+    candidates.clear();
+
+    for (int bit = -1; bit < SIGNATURE_SIZE; bit++)
+    {
+        FrameIndex::const_iterator bucket = index.find(bit < 0 ? hash : hash ^ (1ULL << bit));
+
+        if (bucket == index.end())
+            continue;
+
+        const vector<int>& frames = bucket->second;
+
+        // Walk outwards from the requested frame, the bucket is sorted
+        size_t right = std::lower_bound(frames.begin(), frames.end(), frame) - frames.begin();
+        size_t left = right;
+
+        for (unsigned int i = 0; i < count && (left > 0 || right < frames.size()); i++)
+        {
+            if (right < frames.size() && (left == 0 || frames[right] - frame <= frame - frames[left - 1]))
+                candidates.push_back(frames[right++]);
+            else
+                candidates.push_back(frames[--left]);
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [frame](int a, int b) { return abs(a - frame) < abs(b - frame) || (abs(a - frame) == abs(b - frame) && a < b); });
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    if (candidates.size() > count)
+        candidates.resize(count);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Monotonic alignment of a clip against the reference
+//
+// Every reference frame n is matched to source frame n + d, where the offset
+// d stays within +-radius. The source frame number may never decrease, so d
+// may drop by at most one per frame (the clip repeats a frame because it is
+// missing one) and may grow by any amount (the clip has extra frames that
+// are skipped). Each change of offset costs ALIGN_PENALTY, which keeps the
+// alignment from jittering on noisy or static material.
+//
+// Since the penalty does not depend on the size of the change, the best
+// predecessor is either the same offset or the cheapest allowed one, which
+// is found with a running minimum. This keeps the solver at
+// O(frames * radius) time.
+//////////////////////////////////////////////////////////////////////////////
+void AlignSignatures(const vector<FrameSignature>& reference, const vector<FrameSignature>& signatures, unsigned int radius, AlignmentResult& result)
+{
+    const int frames = (int)reference.size();
+    const int available = (int)signatures.size();
+    const int offsets = 2 * radius + 1;
+
+    // Used for offsets that point outside of the clip
+    const unsigned long long outside = 4ULL * 255 * SIGNATURE_SIZE;
+
+    result.frame.assign(frames, 0);
+    result.similarity.assign(frames, 0.0f);
+    result.dropped = 0;
+    result.inserted = 0;
+
+    if (frames == 0 || available == 0)
+        return;
+
+    vector<unsigned long long> previous(offsets);
+    vector<unsigned long long> current(offsets);
+    vector<unsigned long long> lowest(offsets);
+    vector<int> lowest_index(offsets);
+    vector<unsigned short> predecessor((size_t)frames * offsets);
+
+    for (int n = 0; n < frames; n++)
+    {
+        if (n > 0)
+        {
+            // Running minimum over all offsets up to and including k
+            lowest[0] = previous[0];
+            lowest_index[0] = 0;
+
+            for (int k = 1; k < offsets; k++)
+            {
+                if (previous[k] < lowest[k - 1])
+                {
+                    lowest[k] = previous[k];
+                    lowest_index[k] = k;
+                }
+                else
+                {
+                    lowest[k] = lowest[k - 1];
+                    lowest_index[k] = lowest_index[k - 1];
+                }
+            }
+        }
+
+        for (int k = 0; k < offsets; k++)
+        {
+            const int m = n + k - (int)radius;
+
+            unsigned long long cost = outside;
+
+            if (m >= 0 && m < available)
+                cost = CompareSignatures(reference[n], signatures[m]);
+
+            if (n == 0)
+            {
+                current[k] = cost;
+                predecessor[k] = (unsigned short)k;
+                continue;
+            }
+
+            const int limit = min(k + 1, offsets - 1);
+
+            unsigned long long stay = previous[k];
+            unsigned long long jump = lowest[limit] + ALIGN_PENALTY;
+
+            if (stay <= jump)
+            {
+                current[k] = stay + cost;
+                predecessor[(size_t)n * offsets + k] = (unsigned short)k;
+            }
+            else
+            {
+                current[k] = jump + cost;
+                predecessor[(size_t)n * offsets + k] = (unsigned short)lowest_index[limit];
+            }
+        }
+
+        previous.swap(current);
+    }
+
+    // Cheapest path end
+    int k = 0;
+
+    for (int i = 1; i < offsets; i++)
+    {
+        if (previous[i] < previous[k])
+            k = i;
+    }
+
+    // Walk back through the predecessors
+    for (int n = frames - 1; n >= 0; n--)
+    {
+        const int m = n + k - (int)radius;
+
+        result.frame[n] = max(0, min(m, available - 1));
+
+        if (m >= 0 && m < available)
+            result.similarity[n] = 100.0f - (100.0f * CompareSignatures(reference[n], signatures[m])) / (255.0f * SIGNATURE_SIZE);
+
+        k = predecessor[(size_t)n * offsets + k];
+    }
+
+    for (int n = 1; n < frames; n++)
+    {
+        const int step = result.frame[n] - result.frame[n - 1];
+
+        if (step == 0)
+            result.dropped++;
+        else if (step > 1)
+            result.inserted += step - 1;
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef ALIGN_H
+#define ALIGN_H
+
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+#include "avisynth.h"
+
+#define SIGNATURE_GRID 8
+#define SIGNATURE_SIZE (SIGNATURE_GRID * SIGNATURE_GRID)
+
+// Cost of changing the offset between two consecutive frames, in the same
+// units as the signature difference (sum of absolute cell differences)
+#define ALIGN_PENALTY (3 * SIGNATURE_SIZE)
+
+// Largest sync radius for align. The solver keeps one predecessor per offset
+// per frame, 2 * radius + 1 of them, so this bounds it to about 1 KB a frame.
+#define MAX_ALIGN_RADIUS 255
+
+//////////////////////////////////////////////////////////////////////////////
+// Coarse description of a frame: average value of an 8x8 grid of cells
+//////////////////////////////////////////////////////////////////////////////
+struct FrameSignature
+{
+    unsigned char cell[SIGNATURE_SIZE];
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Frame numbers of a clip, grouped by signature hash
+//////////////////////////////////////////////////////////////////////////////
+typedef std::unordered_map<uint64_t, std::vector<int> > FrameIndex;
+
+//////////////////////////////////////////////////////////////////////////////
+// Result of aligning one clip against the reference clip
+//////////////////////////////////////////////////////////////////////////////
+struct AlignmentResult
+{
+    std::vector<int> frame;         // Source frame for every reference frame
+    std::vector<float> similarity;  // 100.0 -> exact match, 0.0 -> completely different
+    unsigned int dropped;           // Reference frames missing from the clip
+    unsigned int inserted;          // Clip frames missing from the reference
+};
+
+void ComputeSignature(const VideoInfo& vi, const PVideoFrame& frame, FrameSignature& signature);
+unsigned int CompareSignatures(const FrameSignature& a, const FrameSignature& b);
+
+void AnalyseClip(PClip clip, std::vector<FrameSignature>& signatures, IScriptEnvironment* env);
+uint64_t SignatureHash(const FrameSignature& signature);
+void BuildFrameIndex(const std::vector<FrameSignature>& signatures, FrameIndex& index);
+void LookupFrameIndex(const FrameIndex& index, uint64_t hash, int frame, unsigned int count, std::vector<int>& candidates);
+
+void AlignSignatures(const std::vector<FrameSignature>& reference, const std::vector<FrameSignature>& signatures, unsigned int radius, AlignmentResult& result);
+
+#endif // ALIGN_H
@@ -0,0 +1,351 @@
+#include "stdafx.h"
+#include <math.h>
+#include <string.h>
+
+#ifdef INTEL_INTRINSICS
+#include <emmintrin.h>
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Convert interleaved samples of any type to floats between -1.0 and 1.0
+//////////////////////////////////////////////////////////////////////////////
+static void ConvertSamples(const unsigned char* buffer, int type, size_t count, vector<float>& samples)
+{
+    samples.resize(count);
+
+    switch (type)
+    {
+    case SAMPLE_INT8:
+        for (size_t i = 0; i < count; i++)
+            samples[i] = (buffer[i] - 128) / 128.0f;
+        break;
+
+    case SAMPLE_INT16:
+        for (size_t i = 0; i < count; i++)
+            samples[i] = ((const int16_t*)buffer)[i] / 32768.0f;
+        break;
+
+    case SAMPLE_INT24:
+        for (size_t i = 0; i < count; i++)
+        {
+            const unsigned char* p = buffer + 3 * i;
+            samples[i] = (int32_t)((p[0] << 8) | (p[1] << 16) | ((uint32_t)p[2] << 24)) / 2147483648.0f;
+        }
+        break;
+
+    case SAMPLE_INT32:
+        for (size_t i = 0; i < count; i++)
+            samples[i] = ((const int32_t*)buffer)[i] / 2147483648.0f;
+        break;
+
+    case SAMPLE_FLOAT:
+        for (size_t i = 0; i < count; i++)
+            samples[i] = ((const float*)buffer)[i];
+        break;
+
+    default:
+        std::fill(samples.begin(), samples.end(), 0.0f);
+        break;
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Loudness envelope of a range of frames: the average magnitude over all
+// channels for ENVELOPE_RESOLUTION equal parts of every frame
+//
+// Frames outside of the clip count as silence.
+//////////////////////////////////////////////////////////////////////////////
+void ComputeEnvelope(PClip clip, int first, int frames, vector<float>& envelope, IScriptEnvironment* env)
+{
+    const VideoInfo& vi = clip->GetVideoInfo();
+    const int channels = vi.AudioChannels();
+
+    vector<unsigned char> buffer;
+    vector<float> samples;
+
+    envelope.assign((size_t)frames * ENVELOPE_RESOLUTION, 0.0f);
+
+    for (int f = 0; f < frames; f++)
+    {
+        const int frame = first + f;
+
+        if (frame < 0 || frame >= vi.num_frames)
+            continue;
+
+        const int64_t start = vi.AudioSamplesFromFrames(frame);
+        const int64_t count = min(vi.AudioSamplesFromFrames(frame + 1), vi.num_audio_samples) - start;
+
+        if (count <= 0)
+            continue;
+
+        buffer.resize((size_t)vi.BytesFromAudioSamples(count));
+        clip->GetAudio(&buffer[0], start, count, env);
+
+        ConvertSamples(&buffer[0], vi.SampleType(), (size_t)count * channels, samples);
+
+        for (int p = 0; p < ENVELOPE_RESOLUTION; p++)
+        {
+            const size_t a = (size_t)(count * p / ENVELOPE_RESOLUTION) * channels;
+            const size_t b = (size_t)(count * (p + 1) / ENVELOPE_RESOLUTION) * channels;
+
+            float sum = 0.0f;
+
+            for (size_t s = a; s < b; s++)
+                sum = sum + fabsf(samples[s]);
+
+            if (b > a)
+                envelope[(size_t)f * ENVELOPE_RESOLUTION + p] = sum / (b - a);
+        }
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Find the frame offsets within +-radius at which envelope lines up with
+// reference best
+//
+// envelope covers radius frames more than reference on both sides. The
+// normalised cross-correlation is taken at every offset, and the strongest
+// local peaks are kept as candidates. Silence or unrelated audio leaves no
+// candidates at all.
+//////////////////////////////////////////////////////////////////////////////
+void CorrelateEnvelopes(const vector<float>& reference, const vector<float>& envelope, int radius, AudioMatch& match)
+{
+    const size_t length = reference.size();
+    const int offsets = 2 * radius + 1;
+
+    match.count = 0;
+    match.reliable = false;
+
+    // Remove the average level of the reference
+    double mean = 0.0;
+
+    for (size_t i = 0; i < length; i++)
+        mean = mean + reference[i];
+
+    mean = length > 0 ? mean / length : 0.0;
+
+    vector<double> centred(length);
+    double energy = 0.0;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        centred[i] = reference[i] - mean;
+        energy = energy + centred[i] * centred[i];
+    }
+
+    if (energy <= 0.0 || envelope.size() < length + 2 * (size_t)radius * ENVELOPE_RESOLUTION)
+        return;
+
+    vector<double> score(offsets, -1.0);
+
+    for (int k = 0; k < offsets; k++)
+    {
+        const float* window = &envelope[(size_t)k * ENVELOPE_RESOLUTION];
+
+        double sum = 0.0;
+        double squares = 0.0;
+        double product = 0.0;
+
+        for (size_t i = 0; i < length; i++)
+        {
+            sum = sum + window[i];
+            squares = squares + (double)window[i] * window[i];
+            product = product + centred[i] * window[i];
+        }
+
+        // Energy of the window around its own average
+        const double variance = squares - sum * sum / length;
+
+        if (variance > 0.0)
+            score[k] = product / sqrt(energy * variance);
+    }
+
+    // Local peaks, strongest first and the smallest offset on ties
+    vector<int> peaks;
+
+    for (int k = 0; k < offsets; k++)
+    {
+        if (score[k] >= AUDIO_MIN_PEAK && (k == 0 || score[k] >= score[k - 1]) && (k == offsets - 1 || score[k] > score[k + 1]))
+            peaks.push_back(k);
+    }
+
+    std::stable_sort(peaks.begin(), peaks.end(), [&](int a, int b) { return score[a] > score[b] || (score[a] == score[b] && abs(a - radius) < abs(b - radius)); });
+
+    match.count = min((unsigned int)peaks.size(), (unsigned int)AUDIO_CANDIDATES);
+
+    for (unsigned int i = 0; i < match.count; i++)
+    {
+        match.offset[i] = peaks[i] - radius;
+        match.score[i] = (float)score[peaks[i]];
+    }
+
+    match.reliable = match.count > 0 && match.score[0] >= AUDIO_MIN_SCORE && (match.count == 1 || match.score[0] - match.score[1] >= AUDIO_MIN_LEAD);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Plain C version of the audio sort
+//
+// Odd-even transposition sort: depth passes of compare and swap between
+// neighbouring rows sort depth rows. It is done a tile at a time so that the
+// rows being sorted stay in cache.
+//////////////////////////////////////////////////////////////////////////////
+template<typename T>
+static void SortRows(void* const* rows, unsigned int depth, int first, int last)
+{
+    for (int x0 = first; x0 < last; x0 = x0 + AUDIO_TILE)
+    {
+        const int x1 = min(x0 + AUDIO_TILE, last);
+
+        for (unsigned int pass = 0; pass < depth; pass++)
+        {
+            for (unsigned int r = pass & 1; r + 1 < depth; r = r + 2)
+            {
+                T* a = (T*)rows[r];
+                T* b = (T*)rows[r + 1];
+
+                for (int x = x0; x < x1; x++)
+                {
+                    const T lower = min(a[x], b[x]);
+
+                    b[x] = max(a[x], b[x]);
+                    a[x] = lower;
+                }
+            }
+        }
+    }
+}
+
+void sort_audio_int16_c(void* const* rows, unsigned int depth, int first, int last)
+{
+    SortRows<int16_t>(rows, depth, first, last);
+}
+
+void sort_audio_int32_c(void* const* rows, unsigned int depth, int first, int last)
+{
+    SortRows<int32_t>(rows, depth, first, last);
+}
+
+void sort_audio_float_c(void* const* rows, unsigned int depth, int first, int last)
+{
+    SortRows<float>(rows, depth, first, last);
+}
+
+
+#ifdef INTEL_INTRINSICS
+//////////////////////////////////////////////////////////////////////////////
+// SSE2 versions, SSE2 has no 32-bit integer min and max
+//////////////////////////////////////////////////////////////////////////////
+struct Int16Sse2
+{
+    typedef int16_t Value;
+    typedef __m128i Vector;
+    enum { width = 8 };
+
+    static Vector Load(const Value* p) { return _mm_loadu_si128((const __m128i*)p); }
+    static void Store(Value* p, Vector v) { _mm_storeu_si128((__m128i*)p, v); }
+    static Vector Min(Vector a, Vector b) { return _mm_min_epi16(a, b); }
+    static Vector Max(Vector a, Vector b) { return _mm_max_epi16(a, b); }
+};
+
+struct FloatSse2
+{
+    typedef float Value;
+    typedef __m128 Vector;
+    enum { width = 4 };
+
+    static Vector Load(const Value* p) { return _mm_loadu_ps(p); }
+    static void Store(Value* p, Vector v) { _mm_storeu_ps(p, v); }
+    static Vector Min(Vector a, Vector b) { return _mm_min_ps(a, b); }
+    static Vector Max(Vector a, Vector b) { return _mm_max_ps(a, b); }
+};
+
+void sort_audio_int16_sse2(void* const* rows, unsigned int depth, int first, int last)
+{
+    sort_audio_int16_c(rows, depth, SortAudioRows<Int16Sse2>(rows, depth, first, last), last);
+}
+
+void sort_audio_float_sse2(void* const* rows, unsigned int depth, int first, int last)
+{
+    sort_audio_float_c(rows, depth, SortAudioRows<FloatSse2>(rows, depth, first, last), last);
+}
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Pick the fastest sort the CPU supports for a sample type, NULL if the
+// sample type is not supported
+//////////////////////////////////////////////////////////////////////////////
+AudioSortFunction GetAudioSortFunction(int sampletype, int cpuflags)
+{
+    switch (sampletype)
+    {
+    case SAMPLE_INT16:
+#ifdef INTEL_INTRINSICS
+        if (cpuflags & CPUF_AVX2)
+            return sort_audio_int16_avx2;
+
+        if (cpuflags & CPUF_SSE2)
+            return sort_audio_int16_sse2;
+#endif
+        return sort_audio_int16_c;
+
+    case SAMPLE_INT32:
+#ifdef INTEL_INTRINSICS
+        if (cpuflags & CPUF_AVX2)
+            return sort_audio_int32_avx2;
+#endif
+        return sort_audio_int32_c;
+
+    case SAMPLE_FLOAT:
+#ifdef INTEL_INTRINSICS
+        if (cpuflags & CPUF_AVX2)
+            return sort_audio_float_avx2;
+
+        if (cpuflags & CPUF_SSE2)
+            return sort_audio_float_sse2;
+#endif
+        return sort_audio_float_c;
+    }
+
+    return NULL;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Average of sorted rows low to low + blend - 1, the median when blend is 1
+//////////////////////////////////////////////////////////////////////////////
+template<typename T, typename S>
+static void BlendRows(void* const* rows, unsigned int low, unsigned int blend, int count, void* output)
+{
+    T* out = (T*)output;
+
+    for (int x = 0; x < count; x++)
+    {
+        S sum = 0;
+
+        for (unsigned int r = low; r < low + blend; r++)
+            sum = sum + ((const T*)rows[r])[x];
+
+        out[x] = (T)(sum / (S)blend);
+    }
+}
+
+void BlendAudio(void* const* rows, unsigned int low, unsigned int blend, int sampletype, int count, void* output)
+{
+    if (blend == 1)
+    {
+        memcpy(output, rows[low], (size_t)count * (sampletype == SAMPLE_INT16 ? 2 : 4));
+        return;
+    }
+
+    switch (sampletype)
+    {
+    case SAMPLE_INT16: BlendRows<int16_t, int32_t>(rows, low, blend, count, output); break;
+    case SAMPLE_INT32: BlendRows<int32_t, int64_t>(rows, low, blend, count, output); break;
+    case SAMPLE_FLOAT: BlendRows<float, float>(rows, low, blend, count, output); break;
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <vector>
+#include "avisynth.h"
+
+#define ENVELOPE_RESOLUTION 8   // Envelope points per video frame
+#define AUDIO_SEGMENT 64        // Frames sharing one audio sync offset
+#define AUDIO_CANDIDATES 3      // Offsets left for the video to decide between
+
+// Peaks below AUDIO_MIN_PEAK are ignored as noise. An offset is trusted
+// without looking at the video when its correlation reaches AUDIO_MIN_SCORE
+// and leads the next peak by AUDIO_MIN_LEAD
+#define AUDIO_MIN_PEAK 0.3f
+#define AUDIO_MIN_SCORE 0.6f
+#define AUDIO_MIN_LEAD 0.1f
+
+#define AUDIO_BLOCK 16384       // Samples mixed per pass
+#define AUDIO_TILE 256          // Values sorted together, small enough to stay in cache
+
+//////////////////////////////////////////////////////////////////////////////
+// Result of correlating the audio of one clip against the reference clip
+//////////////////////////////////////////////////////////////////////////////
+struct AudioMatch
+{
+    int offset[AUDIO_CANDIDATES];   // Strongest offsets in frames, best first
+    float score[AUDIO_CANDIDATES];  // 1.0 -> identical envelope, 0.0 -> unrelated
+    unsigned int count;             // Offsets found, 0 when nothing correlates
+    bool reliable;                  // offset[0] clearly stands out
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Sort the values at every position of depth rows, so that row k holds the
+// k-th smallest value of every position afterwards. Works on values first to
+// last of every row.
+//////////////////////////////////////////////////////////////////////////////
+typedef void (*AudioSortFunction)(void* const* rows, unsigned int depth, int first, int last);
+
+void sort_audio_int16_c(void* const* rows, unsigned int depth, int first, int last);
+void sort_audio_int32_c(void* const* rows, unsigned int depth, int first, int last);
+void sort_audio_float_c(void* const* rows, unsigned int depth, int first, int last);
+
+#ifdef INTEL_INTRINSICS
+void sort_audio_int16_sse2(void* const* rows, unsigned int depth, int first, int last);
+void sort_audio_float_sse2(void* const* rows, unsigned int depth, int first, int last);
+void sort_audio_int16_avx2(void* const* rows, unsigned int depth, int first, int last);
+void sort_audio_int32_avx2(void* const* rows, unsigned int depth, int first, int last);
+void sort_audio_float_avx2(void* const* rows, unsigned int depth, int first, int last);
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// Shared body of the vector versions, Ops wraps the instructions of one
+// sample type and instruction set. Returns the first value left for the
+// plain C version.
+//////////////////////////////////////////////////////////////////////////////
+template<typename Ops>
+int SortAudioRows(void* const* rows, unsigned int depth, int first, int last)
+{
+    typedef typename Ops::Value Value;
+    typedef typename Ops::Vector Vector;
+
+    last = first + (last - first) / Ops::width * Ops::width;
+
+    for (int x0 = first; x0 < last; x0 = x0 + AUDIO_TILE)
+    {
+        const int x1 = x0 + AUDIO_TILE < last ? x0 + AUDIO_TILE : last;
+
+        for (unsigned int pass = 0; pass < depth; pass++)
+        {
+            for (unsigned int r = pass & 1; r + 1 < depth; r = r + 2)
+            {
+                Value* a = (Value*)rows[r];
+                Value* b = (Value*)rows[r + 1];
+
+                for (int x = x0; x < x1; x = x + Ops::width)
+                {
+                    Vector va = Ops::Load(a + x);
+                    Vector vb = Ops::Load(b + x);
+
+                    Ops::Store(a + x, Ops::Min(va, vb));
+                    Ops::Store(b + x, Ops::Max(va, vb));
+                }
+            }
+        }
+    }
+
+    return last;
+}
+
+AudioSortFunction GetAudioSortFunction(int sampletype, int cpuflags);
+void BlendAudio(void* const* rows, unsigned int low, unsigned int blend, int sampletype, int count, void* output);
+
+void ComputeEnvelope(PClip clip, int first, int frames, std::vector<float>& envelope, IScriptEnvironment* env);
+void CorrelateEnvelopes(const std::vector<float>& reference, const std::vector<float>& envelope, int radius, AudioMatch& match);
+
+#endif // AUDIO_H
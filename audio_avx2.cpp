@@ -0,0 +1,67 @@
+#include "stdafx.h"
+
+#ifdef INTEL_INTRINSICS
+#include <immintrin.h>
+
+
+//////////////////////////////////////////////////////////////////////////////
+// AVX2 versions of the audio sort, 32 bytes at a time
+//////////////////////////////////////////////////////////////////////////////
+struct Int16Avx2
+{
+    typedef int16_t Value;
+    typedef __m256i Vector;
+    enum { width = 16 };
+
+    static Vector Load(const Value* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    static void Store(Value* p, Vector v) { _mm256_storeu_si256((__m256i*)p, v); }
+    static Vector Min(Vector a, Vector b) { return _mm256_min_epi16(a, b); }
+    static Vector Max(Vector a, Vector b) { return _mm256_max_epi16(a, b); }
+};
+
+struct Int32Avx2
+{
+    typedef int32_t Value;
+    typedef __m256i Vector;
+    enum { width = 8 };
+
+    static Vector Load(const Value* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    static void Store(Value* p, Vector v) { _mm256_storeu_si256((__m256i*)p, v); }
+    static Vector Min(Vector a, Vector b) { return _mm256_min_epi32(a, b); }
+    static Vector Max(Vector a, Vector b) { return _mm256_max_epi32(a, b); }
+};
+
+struct FloatAvx2
+{
+    typedef float Value;
+    typedef __m256 Vector;
+    enum { width = 8 };
+
+    static Vector Load(const Value* p) { return _mm256_loadu_ps(p); }
+    static void Store(Value* p, Vector v) { _mm256_storeu_ps(p, v); }
+    static Vector Min(Vector a, Vector b) { return _mm256_min_ps(a, b); }
+    static Vector Max(Vector a, Vector b) { return _mm256_max_ps(a, b); }
+};
+
+void sort_audio_int16_avx2(void* const* rows, unsigned int depth, int first, int last)
+{
+    first = SortAudioRows<Int16Avx2>(rows, depth, first, last);
+    _mm256_zeroupper();
+    sort_audio_int16_c(rows, depth, first, last);
+}
+
+void sort_audio_int32_avx2(void* const* rows, unsigned int depth, int first, int last)
+{
+    first = SortAudioRows<Int32Avx2>(rows, depth, first, last);
+    _mm256_zeroupper();
+    sort_audio_int32_c(rows, depth, first, last);
+}
+
+void sort_audio_float_avx2(void* const* rows, unsigned int depth, int first, int last)
+{
+    first = SortAudioRows<FloatAvx2>(rows, depth, first, last);
+    _mm256_zeroupper();
+    sort_audio_float_c(rows, depth, first, last);
+}
+
+#endif // INTEL_INTRINSICS
@@ -0,0 +1,554 @@
+//////////////////////////////////////////////////////////////////////////////
+// Throughput benchmark for the Median filters
+//
+// Loads the plugin into the stand-in core of host.cpp, feeds it synthetic
+// clips and times GetFrame over a sweep of formats, clip counts, low/high
+// limits, sync radii and thread counts. Results are written as JSON so runs
+// before and after a kernel change can be compared.
+//
+// Usage: median_bench [options]
+//        median_bench --verify [--formats LIST] [--quick]
+//
+//   --width N         Frame width (default 1920)
+//   --height N        Frame height (default 1080)
+//   --frames N        Timed frames per run (default 100)
+//   --warmup N        Untimed frames before every run (default 2)
+//   --formats LIST    Formats to run, comma separated (default all)
+//   --depths LIST     Clip counts (default 3,5,9)
+//   --limits LIST     low:high pairs for MedianBlend, "median" for Median
+//                     (default median)
+//   --sync LIST       Sync radii (default 0)
+//   --spatial LIST    SpatialMedian radii, run on one clip instead of the
+//                     medians of clips
+//   --volume LIST     radius:spatial pairs for TemporalMedian over space and
+//                     time, run on one clip instead of the medians of clips
+//   --weight N        Weight of the first clip of Median and MedianBlend,
+//                     the others weigh 1 (default 1, no weights)
+//   --dropout N       Give Median and MedianBlend masks, every clip with a
+//                     band of N percent of the rows masked out, 0 for masks
+//                     with nothing masked out (default no masks)
+//   --threads LIST    Threads calling GetFrame (default 1)
+//   --isa NAME        c, sse2, avx2 or native (default native)
+//   --output FILE     Write the JSON there instead of to stdout
+//
+// --verify checks the output of the filters against a plain reference
+// instead, see verify.cpp.
+//////////////////////////////////////////////////////////////////////////////
+
+#include "avisynth.h"
+#include "host.h"
+#include "bench.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using std::string;
+using std::vector;
+
+extern "C" const char* __stdcall AvisynthPluginInit3(IScriptEnvironment* env, AVS_Linkage* vectors);
+
+//////////////////////////////////////////////////////////////////////////////
+// One point of the sweep
+//////////////////////////////////////////////////////////////////////////////
+struct Run
+{
+    const Format* format;
+    int depth;
+    int low;        // -1 -> Median
+    int high;
+    int sync;
+    int threads;
+    int radius;     // > 0 -> SpatialMedian
+    int spatial;    // > 0 -> TemporalMedian of radius, with this spatial radius
+};
+
+struct Options
+{
+    int width;
+    int height;
+    int frames;
+    int warmup;
+    vector<const Format*> formats;
+    vector<int> depths;
+    vector<std::pair<int, int> > limits;
+    vector<int> sync;
+    vector<int> spatial;
+    vector<std::pair<int, int> > volume;
+    int weight;
+    int dropout;
+    vector<int> threads;
+    string isa;
+    string output;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Command line
+//////////////////////////////////////////////////////////////////////////////
+static vector<string> Split(const char* list)
+{
+    vector<string> items;
+    string item;
+
+    for (const char* p = list; ; p++)
+    {
+        if (*p == ',' || *p == '\0')
+        {
+            if (!item.empty())
+                items.push_back(item);
+
+            item.clear();
+
+            if (*p == '\0')
+                break;
+        }
+        else
+            item += *p;
+    }
+
+    return items;
+}
+
+static vector<int> SplitInts(const char* list)
+{
+    vector<string> items = Split(list);
+    vector<int> values;
+
+    for (size_t i = 0; i < items.size(); i++)
+        values.push_back(atoi(items[i].c_str()));
+
+    return values;
+}
+
+static bool ParseOptions(int argc, char** argv, Options& options)
+{
+    options.width = 1920;
+    options.height = 1080;
+    options.frames = 100;
+    options.warmup = 2;
+    options.depths = SplitInts("3,5,9");
+    options.limits.push_back(std::make_pair(-1, -1));
+    options.sync.push_back(0);
+    options.weight = 1;
+    options.dropout = -1;
+    options.threads.push_back(1);
+    options.isa = "native";
+
+    for (size_t i = 0; i < format_count; i++)
+        options.formats.push_back(&formats[i]);
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* option = argv[i];
+
+        if (i + 1 >= argc)
+        {
+            fprintf(stderr, "Missing value for %s\n", option);
+            return false;
+        }
+
+        const char* value = argv[++i];
+
+        if (!strcmp(option, "--width"))
+            options.width = atoi(value);
+        else if (!strcmp(option, "--height"))
+            options.height = atoi(value);
+        else if (!strcmp(option, "--frames"))
+            options.frames = atoi(value);
+        else if (!strcmp(option, "--warmup"))
+            options.warmup = atoi(value);
+        else if (!strcmp(option, "--depths"))
+            options.depths = SplitInts(value);
+        else if (!strcmp(option, "--sync"))
+            options.sync = SplitInts(value);
+        else if (!strcmp(option, "--spatial"))
+            options.spatial = SplitInts(value);
+        else if (!strcmp(option, "--weight"))
+            options.weight = atoi(value);
+        else if (!strcmp(option, "--dropout"))
+            options.dropout = atoi(value);
+        else if (!strcmp(option, "--threads"))
+            options.threads = SplitInts(value);
+        else if (!strcmp(option, "--isa"))
+            options.isa = value;
+        else if (!strcmp(option, "--output"))
+            options.output = value;
+        else if (!strcmp(option, "--formats"))
+        {
+            vector<string> names = Split(value);
+
+            options.formats.clear();
+
+            for (size_t k = 0; k < names.size(); k++)
+            {
+                const Format* format = FindFormat(names[k]);
+
+                if (format == NULL)
+                {
+                    fprintf(stderr, "Unknown format %s\n", names[k].c_str());
+                    return false;
+                }
+
+                options.formats.push_back(format);
+            }
+        }
+        else if (!strcmp(option, "--limits"))
+        {
+            vector<string> pairs = Split(value);
+
+            options.limits.clear();
+
+            for (size_t k = 0; k < pairs.size(); k++)
+            {
+                int low = -1;
+                int high = -1;
+
+                if (pairs[k] != "median" && sscanf(pairs[k].c_str(), "%d:%d", &low, &high) != 2)
+                {
+                    fprintf(stderr, "Limits need to be low:high or median, not %s\n", pairs[k].c_str());
+                    return false;
+                }
+
+                options.limits.push_back(std::make_pair(low, high));
+            }
+        }
+        else if (!strcmp(option, "--volume"))
+        {
+            vector<string> pairs = Split(value);
+
+            options.volume.clear();
+
+            for (size_t k = 0; k < pairs.size(); k++)
+            {
+                int radius = 0;
+                int spatial = 0;
+
+                if (sscanf(pairs[k].c_str(), "%d:%d", &radius, &spatial) != 2)
+                {
+                    fprintf(stderr, "Volume needs radius:spatial pairs, not %s\n", pairs[k].c_str());
+                    return false;
+                }
+
+                options.volume.push_back(std::make_pair(radius, spatial));
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", option);
+            return false;
+        }
+    }
+
+    if (options.width < 16 || options.height < 16 || options.frames < 1 || options.warmup < 0)
+    {
+        fprintf(stderr, "Frames need to be at least 16x16 and there needs to be at least one frame\n");
+        return false;
+    }
+
+    return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Result of one run
+//////////////////////////////////////////////////////////////////////////////
+struct Result
+{
+    double seconds;
+    string kernel;
+    string isa;
+    string error;
+};
+
+static string FrameString(IScriptEnvironment* env, const PVideoFrame& frame, const char* key)
+{
+    int error = 0;
+    const char* value = env->propGetData(env->getFramePropsRO(frame), key, 0, &error);
+
+    return error || value == NULL ? "" : value;
+}
+
+
+static const char* RunFilter(const Run& run)
+{
+    if (run.spatial > 0)
+        return "TemporalMedian";
+
+    if (run.radius > 0)
+        return "SpatialMedian";
+
+    return run.low >= 0 ? "MedianBlend" : "Median";
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Build the filter for one run and time its frames
+//
+// The timed frames are spread over the threads through a shared counter,
+// the way a multithreaded host requests frames out of order.
+//////////////////////////////////////////////////////////////////////////////
+static Result Measure(IScriptEnvironment* env, const Options& options, const Run& run)
+{
+    Result result;
+    result.seconds = 0.0;
+
+    const int count = options.warmup + options.frames;
+
+    try
+    {
+        vector<AVSValue> args;
+        vector<const char*> names;
+        string weights;
+
+        for (int i = 0; i < run.depth; i++)
+        {
+            args.push_back(AVSValue(new SyntheticClip(run.format, options.width, options.height, count, i + 1, false, env)));
+            names.push_back(NULL);
+        }
+
+        if (run.radius > 0)
+        {
+            args.push_back(run.radius);
+            names.push_back("radius");
+
+            if (run.spatial > 0)
+            {
+                args.push_back(run.spatial);
+                names.push_back("spatial");
+            }
+        }
+        else
+        {
+            if (run.low >= 0)
+            {
+                args.push_back(run.low);
+                names.push_back("low");
+                args.push_back(run.high);
+                names.push_back("high");
+            }
+
+            args.push_back(run.sync);
+            names.push_back("sync");
+
+            if (options.weight > 1)
+            {
+                weights = std::to_string(options.weight);
+
+                for (int i = 1; i < run.depth; i++)
+                    weights = weights + ",1";
+
+                args.push_back(weights.c_str());
+                names.push_back("weights");
+            }
+
+            if (options.dropout >= 0)
+            {
+                args.push_back(AVSValue(new MaskClip(run.format, options.width, options.height, count, run.depth, options.dropout, false, env)));
+                names.push_back("masks");
+            }
+        }
+
+        PClip clip = env->Invoke(RunFilter(run), AVSValue(args.data(), (int)args.size()), names.data()).AsClip();
+
+        for (int n = 0; n < options.warmup; n++)
+        {
+            PVideoFrame frame = clip->GetFrame(n, env);
+
+            result.kernel = FrameString(env, frame, "MedianKernel");
+            result.isa = FrameString(env, frame, "MedianISA");
+        }
+
+        std::atomic<int> next(options.warmup);
+        vector<string> errors(run.threads);
+        vector<std::thread> workers;
+
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        for (int t = 0; t < run.threads; t++)
+        {
+            workers.push_back(std::thread([&, t]()
+            {
+                try
+                {
+                    for (int n = next++; n < count; n = next++)
+                        clip->GetFrame(n, env);
+                }
+                catch (const AvisynthError& e)
+                {
+                    errors[t] = e.msg;
+                }
+            }));
+        }
+
+        for (size_t t = 0; t < workers.size(); t++)
+            workers[t].join();
+
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        for (size_t t = 0; t < errors.size() && result.error.empty(); t++)
+            result.error = errors[t];
+    }
+    catch (const AvisynthError& e)
+    {
+        result.error = e.msg;
+    }
+
+    return result;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// JSON output
+//////////////////////////////////////////////////////////////////////////////
+static string Escape(const string& text)
+{
+    string escaped;
+
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        if (text[i] == '"' || text[i] == '\\')
+            escaped += '\\';
+
+        if ((unsigned char)text[i] >= 0x20)
+            escaped += text[i];
+    }
+
+    return escaped;
+}
+
+static void WriteRun(FILE* out, const Options& options, const Run& run, const Result& result, bool last)
+{
+    fprintf(out, "    { \"filter\": \"%s\", \"format\": \"%s\", \"depth\": %d, ", RunFilter(run), run.format->name, run.depth);
+
+    if (run.spatial > 0)
+        fprintf(out, "\"radius\": %d, \"spatial\": %d, ", run.radius, run.spatial);
+    else if (run.radius > 0)
+        fprintf(out, "\"radius\": %d, ", run.radius);
+    else if (run.low >= 0)
+        fprintf(out, "\"low\": %d, \"high\": %d, ", run.low, run.high);
+    else
+        fprintf(out, "\"low\": %d, \"high\": %d, ", (run.depth + options.weight - 2) / 2, (run.depth + options.weight - 2) / 2);
+
+    if (run.radius == 0 && options.weight > 1)
+        fprintf(out, "\"weight\": %d, ", options.weight);
+
+    if (run.radius == 0 && options.dropout >= 0)
+        fprintf(out, "\"dropout\": %d, ", options.dropout);
+
+    fprintf(out, "\"sync\": %d, \"threads\": %d, ", run.sync, run.threads);
+
+    if (!result.error.empty())
+    {
+        fprintf(out, "\"error\": \"%s\" }%s\n", Escape(result.error).c_str(), last ? "" : ",");
+        return;
+    }
+
+    const double fps = result.seconds > 0.0 ? options.frames / result.seconds : 0.0;
+    const double mpix = fps * options.width * options.height / 1000000.0;
+
+    fprintf(out, "\"kernel\": \"%s\", \"isa\": \"%s\", \"seconds\": %.6f, \"fps\": %.3f, \"mpix_per_second\": %.3f }%s\n",
+        Escape(result.kernel).c_str(), Escape(result.isa).c_str(), result.seconds, fps, mpix, last ? "" : ",");
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Entry point
+//////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+    if (argc > 1 && !strcmp(argv[1], "--verify"))
+        return Verify(argc - 1, argv + 1);
+
+    Options options;
+
+    if (!ParseOptions(argc, argv, options))
+        return 2;
+
+    IScriptEnvironment* env = CreateBenchEnvironment(CpuFlags(options.isa));
+
+    AvisynthPluginInit3(env, (AVS_Linkage*)GetBenchLinkage());
+
+    // Every combination the filters accept
+    vector<Run> runs;
+
+    for (size_t f = 0; f < options.formats.size(); f++)
+    for (size_t r = 0; r < options.spatial.size(); r++)
+    for (size_t t = 0; t < options.threads.size(); t++)
+    {
+        Run run = { options.formats[f], 1, -1, -1, 0, options.threads[t], options.spatial[r], 0 };
+
+        if (run.radius > 0 && run.threads > 0)
+            runs.push_back(run);
+    }
+
+    for (size_t f = 0; f < options.formats.size(); f++)
+    for (size_t v = 0; v < options.volume.size(); v++)
+    for (size_t t = 0; t < options.threads.size(); t++)
+    {
+        Run run = { options.formats[f], 1, -1, -1, 0, options.threads[t], options.volume[v].first, options.volume[v].second };
+
+        if (run.radius > 0 && run.spatial > 0 && run.threads > 0)
+            runs.push_back(run);
+    }
+
+    for (size_t f = 0; f < options.formats.size() && options.spatial.empty() && options.volume.empty(); f++)
+    for (size_t d = 0; d < options.depths.size(); d++)
+    for (size_t l = 0; l < options.limits.size(); l++)
+    for (size_t s = 0; s < options.sync.size(); s++)
+    for (size_t t = 0; t < options.threads.size(); t++)
+    {
+        Run run = { options.formats[f], options.depths[d], options.limits[l].first, options.limits[l].second, options.sync[s], options.threads[t], 0, 0 };
+
+        if (run.depth < 3 || run.depth > 25 || run.threads < 1)
+            continue;
+
+        if (run.low < 0 && run.depth % 2 == 0)
+            continue;
+
+        if (run.low >= 0 && (run.high < 0 || run.low + run.high >= run.depth))
+            continue;
+
+        runs.push_back(run);
+    }
+
+    FILE* out = stdout;
+
+    if (!options.output.empty())
+    {
+        out = fopen(options.output.c_str(), "w");
+
+        if (out == NULL)
+        {
+            fprintf(stderr, "Cannot write %s\n", options.output.c_str());
+            return 2;
+        }
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"width\": %d, \"height\": %d, \"frames\": %d, \"warmup\": %d, \"cpuflags\": %d,\n",
+        options.width, options.height, options.frames, options.warmup, env->GetCPUFlags());
+    fprintf(out, "  \"runs\": [\n");
+
+    for (size_t i = 0; i < runs.size(); i++)
+    {
+        fprintf(stderr, "[%d/%d] %s %s depth %d sync %d threads %d\n", (int)i + 1, (int)runs.size(), RunFilter(runs[i]), runs[i].format->name, runs[i].depth, runs[i].sync, runs[i].threads);
+
+        WriteRun(out, options, runs[i], Measure(env, options, runs[i]), i + 1 == runs.size());
+        fflush(out);
+    }
+
+    fprintf(out, "  ]\n}\n");
+
+    if (out != stdout)
+        fclose(out);
+
+    env->DeleteScriptEnvironment();
+
+    return 0;
+}
@@ -0,0 +1,103 @@
+#ifndef BENCH_BENCH_H
+#define BENCH_BENCH_H
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include "avisynth.h"
+
+//////////////////////////////////////////////////////////////////////////////
+// Formats the filters accept
+//////////////////////////////////////////////////////////////////////////////
+struct Format
+{
+    const char* name;
+    int pixel_type;
+};
+
+extern const Format formats[];
+extern const size_t format_count;
+
+const Format* FindFormat(const std::string& name);
+
+//////////////////////////////////////////////////////////////////////////////
+// Synthetic source clip
+//
+// Every clip renders the same moving pattern with its own noise and a few
+// dropouts, so the median has something to reject and sync has something to
+// match. Frames are rendered once up front and handed out again, which keeps
+// the cost of the source out of the timings. With oddpitch the frames are
+// cut out of wider ones, so that every row starts an odd number of samples
+// after the previous one. With sparse the clips only differ in a band of
+// columns of their own, elsewhere they all have the same noise.
+//////////////////////////////////////////////////////////////////////////////
+const int SOURCE_FRAMES = 8;
+
+class SyntheticClip : public IClip
+{
+public:
+    SyntheticClip(const Format* format, int width, int height, int count, unsigned int seed, bool oddpitch, IScriptEnvironment* env, bool sparse = false);
+
+    // Out of range frames are clamped like the core does for sync offsets
+    PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env)
+    {
+        n = n < 0 ? 0 : n >= vi.num_frames ? vi.num_frames - 1 : n;
+
+        return frames[n % SOURCE_FRAMES];
+    }
+
+    bool __stdcall GetParity(int n) { return false; }
+    void __stdcall GetAudio(void* buf, int64_t start, int64_t count, IScriptEnvironment* env) {}
+    int __stdcall SetCacheHints(int cachehints, int frame_range) { return 0; }
+    const VideoInfo& __stdcall GetVideoInfo() { return vi; }
+
+private:
+    VideoInfo vi;
+    std::vector<PVideoFrame> frames;
+
+    PVideoFrame Allocate(bool oddpitch, IScriptEnvironment* env);
+    PVideoFrame Render(int n, unsigned int seed, bool oddpitch, bool sparse, IScriptEnvironment* env);
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Synthetic validity masks of depth clips, interleaved: frame n * depth + i
+// is the mask of frame n of clip i, the same in every frame
+//
+// Every clip loses a band of rows of its own, dropout percent of the height
+// of every plane. With scatter, one in four samples is masked out as well,
+// and a few columns are masked out in every clip. Valid samples are 0xff,
+// and for 16-bit alternately 0x0001 and 0x0100, so that a check of one byte
+// of a sample is caught.
+//////////////////////////////////////////////////////////////////////////////
+class MaskClip : public IClip
+{
+public:
+    MaskClip(const Format* format, int width, int height, int count, int depth, int dropout, bool scatter, IScriptEnvironment* env);
+
+    PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env)
+    {
+        n = n < 0 ? 0 : n >= vi.num_frames ? vi.num_frames - 1 : n;
+
+        return frames[n % frames.size()];
+    }
+
+    bool __stdcall GetParity(int n) { return false; }
+    void __stdcall GetAudio(void* buf, int64_t start, int64_t count, IScriptEnvironment* env) {}
+    int __stdcall SetCacheHints(int cachehints, int frame_range) { return 0; }
+    const VideoInfo& __stdcall GetVideoInfo() { return vi; }
+
+private:
+    VideoInfo vi;
+    std::vector<PVideoFrame> frames;
+
+    PVideoFrame Render(int clip, int dropout, bool scatter, IScriptEnvironment* env);
+};
+
+// CPU flags for c, sse2, avx2 or native
+int CpuFlags(const std::string& isa);
+
+// Differential test of the filters against a plain reference, bench.cpp
+// hands over to it for --verify
+int Verify(int argc, char** argv);
+
+#endif // BENCH_BENCH_H
@@ -0,0 +1,1322 @@
+// This file plays the part of the AviSynth+ core, so it sees the core side
+// of the API declarations and provides the definitions behind the linkage
+#define BUILDING_AVSCORE 1
+
+#include "avisynth.h"
+#include "host.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Frame properties
+//////////////////////////////////////////////////////////////////////////////
+class AVSMap
+{
+public:
+    struct Property
+    {
+        char type;
+        std::vector<int64_t> ints;
+        std::vector<double> floats;
+        std::vector<std::string> data;
+    };
+
+    std::map<std::string, Property> items;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// VideoInfo
+//////////////////////////////////////////////////////////////////////////////
+bool VideoInfo::HasVideo() const { return width != 0; }
+bool VideoInfo::HasAudio() const { return audio_samples_per_second != 0; }
+bool VideoInfo::IsRGB() const { return !!(pixel_type & CS_BGR); }
+bool VideoInfo::IsRGB24() const { return (pixel_type & CS_BGR24) == CS_BGR24 && (pixel_type & CS_Sample_Bits_Mask) == CS_Sample_Bits_8; }
+bool VideoInfo::IsRGB32() const { return (pixel_type & CS_BGR32) == CS_BGR32 && (pixel_type & CS_Sample_Bits_Mask) == CS_Sample_Bits_8; }
+bool VideoInfo::IsRGB48() const { return (pixel_type & CS_BGR24) == CS_BGR24 && (pixel_type & CS_Sample_Bits_Mask) == CS_Sample_Bits_16; }
+bool VideoInfo::IsRGB64() const { return (pixel_type & CS_BGR32) == CS_BGR32 && (pixel_type & CS_Sample_Bits_Mask) == CS_Sample_Bits_16; }
+bool VideoInfo::IsYUV() const { return !!(pixel_type & CS_YUV); }
+bool VideoInfo::IsYUVA() const { return !!(pixel_type & CS_YUVA); }
+bool VideoInfo::IsYUY2() const { return (pixel_type & CS_YUY2) == CS_YUY2; }
+bool VideoInfo::IsYV24() const { return (pixel_type & CS_PLANAR_MASK) == (CS_YV24 & CS_PLANAR_FILTER); }
+bool VideoInfo::IsYV16() const { return (pixel_type & CS_PLANAR_MASK) == (CS_YV16 & CS_PLANAR_FILTER); }
+bool VideoInfo::IsYV12() const { return (pixel_type & CS_PLANAR_MASK) == (CS_YV12 & CS_PLANAR_FILTER); }
+bool VideoInfo::IsYV411() const { return (pixel_type & CS_PLANAR_MASK) == (CS_YV411 & CS_PLANAR_FILTER); }
+bool VideoInfo::IsY8() const { return (pixel_type & CS_PLANAR_MASK) == (CS_Y8 & CS_PLANAR_FILTER); }
+bool VideoInfo::IsY() const { return (pixel_type & (CS_PLANAR | CS_INTERLEAVED | CS_YUV | CS_BGR | CS_YUVA)) == CS_GENERIC_Y; }
+bool VideoInfo::IsPlanarRGB() const { return IsPlanar() && IsRGB() && (pixel_type & CS_RGB_TYPE); }
+bool VideoInfo::IsPlanarRGBA() const { return IsPlanar() && IsRGB() && (pixel_type & CS_RGBA_TYPE); }
+bool VideoInfo::IsColorSpace(int c_space) const { return IsPlanar() ? (pixel_type & CS_PLANAR_MASK) == (c_space & CS_PLANAR_FILTER) : (pixel_type & c_space) == c_space; }
+bool VideoInfo::Is(int property) const { return (image_type & property) == property; }
+bool VideoInfo::IsPlanar() const { return !!(pixel_type & CS_PLANAR); }
+bool VideoInfo::IsFieldBased() const { return !!(image_type & IT_FIELDBASED); }
+bool VideoInfo::IsParityKnown() const { return IsFieldBased() || (image_type & (IT_BFF | IT_TFF)); }
+bool VideoInfo::IsBFF() const { return !!(image_type & IT_BFF); }
+bool VideoInfo::IsTFF() const { return !!(image_type & IT_TFF); }
+bool VideoInfo::IsVPlaneFirst() const { return !!(pixel_type & CS_VPlaneFirst); }
+void VideoInfo::SetFieldBased(bool isfieldbased) { if (isfieldbased) image_type |= IT_FIELDBASED; else image_type &= ~IT_FIELDBASED; }
+void VideoInfo::Set(int property) { image_type |= property; }
+void VideoInfo::Clear(int property) { image_type &= ~property; }
+
+bool VideoInfo::Is444() const { return IsPlanar() && !IsRGB() && !IsY() && GetPlaneWidthSubsampling(PLANAR_U) == 0 && GetPlaneHeightSubsampling(PLANAR_U) == 0; }
+bool VideoInfo::Is422() const { return IsPlanar() && !IsRGB() && !IsY() && GetPlaneWidthSubsampling(PLANAR_U) == 1 && GetPlaneHeightSubsampling(PLANAR_U) == 0; }
+bool VideoInfo::Is420() const { return IsPlanar() && !IsRGB() && !IsY() && GetPlaneWidthSubsampling(PLANAR_U) == 1 && GetPlaneHeightSubsampling(PLANAR_U) == 1; }
+
+int VideoInfo::BitsPerComponent() const
+{
+    switch (pixel_type & CS_Sample_Bits_Mask)
+    {
+    case CS_Sample_Bits_10: return 10;
+    case CS_Sample_Bits_12: return 12;
+    case CS_Sample_Bits_14: return 14;
+    case CS_Sample_Bits_16: return 16;
+    case CS_Sample_Bits_32: return 32;
+    default: return 8;
+    }
+}
+
+int VideoInfo::ComponentSize() const
+{
+    const int bits = BitsPerComponent();
+
+    return bits == 8 ? 1 : bits == 32 ? 4 : 2;
+}
+
+int VideoInfo::NumComponents() const
+{
+    if (IsY())
+        return 1;
+
+    if (IsRGB24() || IsRGB48() || IsPlanarRGB() || (IsYUV() && !IsYUVA()))
+        return 3;
+
+    return 4;
+}
+
+int VideoInfo::GetPlaneWidthSubsampling(int plane) const
+{
+    if (plane == PLANAR_Y || plane == PLANAR_A || IsRGB())
+        return 0;
+
+    if (!IsPlanar() || IsY())
+        throw AvisynthError("Filter error: GetPlaneWidthSubsampling not available on this pixel type.");
+
+    return ((pixel_type >> CS_Shift_Sub_Width) + 1) & 3;
+}
+
+int VideoInfo::GetPlaneHeightSubsampling(int plane) const
+{
+    if (plane == PLANAR_Y || plane == PLANAR_A || IsRGB())
+        return 0;
+
+    if (!IsPlanar() || IsY())
+        throw AvisynthError("Filter error: GetPlaneHeightSubsampling not available on this pixel type.");
+
+    return ((pixel_type >> CS_Shift_Sub_Height) + 1) & 3;
+}
+
+int VideoInfo::BitsPerPixel() const
+{
+    const int bits = ComponentSize() * 8;
+
+    if (IsYUY2())
+        return 16;
+
+    if (!IsPlanar() || IsY() || IsRGB())
+        return NumComponents() * bits;
+
+    const int chroma = 2 * bits / (1 << (GetPlaneWidthSubsampling(PLANAR_U) + GetPlaneHeightSubsampling(PLANAR_U)));
+
+    return bits + chroma + (IsYUVA() ? bits : 0);
+}
+
+int VideoInfo::BytesFromPixels(int pixels) const
+{
+    if (IsPlanar())
+        return pixels * ComponentSize();
+
+    return pixels * (BitsPerPixel() / 8);
+}
+
+int VideoInfo::RowSize(int plane) const
+{
+    if (IsPlanar() && (plane == PLANAR_U || plane == PLANAR_V) && !IsRGB())
+        return BytesFromPixels(width) >> GetPlaneWidthSubsampling(plane);
+
+    return BytesFromPixels(width);
+}
+
+int VideoInfo::BMPSize() const
+{
+    return height * ((RowSize(0) + 3) & ~3);
+}
+
+int VideoInfo::BytesPerChannelSample() const
+{
+    switch (sample_type)
+    {
+    case SAMPLE_INT8: return 1;
+    case SAMPLE_INT16: return 2;
+    case SAMPLE_INT24: return 3;
+    case SAMPLE_INT32: return 4;
+    case SAMPLE_FLOAT: return 4;
+    default: return 0;
+    }
+}
+
+int VideoInfo::BytesPerAudioSample() const { return nchannels * BytesPerChannelSample(); }
+int VideoInfo::AudioChannels() const { return HasAudio() ? nchannels : 0; }
+int VideoInfo::SampleType() const { return sample_type; }
+bool VideoInfo::IsSampleType(int testtype) const { return !!(sample_type & testtype); }
+int VideoInfo::SamplesPerSecond() const { return audio_samples_per_second; }
+
+int64_t VideoInfo::AudioSamplesFromFrames(int frames) const
+{
+    if (fps_numerator == 0)
+        return 0;
+
+    return ((int64_t)frames * audio_samples_per_second * fps_denominator) / fps_numerator;
+}
+
+int VideoInfo::FramesFromAudioSamples(int64_t samples) const
+{
+    if (fps_denominator == 0 || audio_samples_per_second == 0)
+        return 0;
+
+    return (int)((samples * fps_numerator) / ((int64_t)fps_denominator * audio_samples_per_second));
+}
+
+int64_t VideoInfo::AudioSamplesFromBytes(int64_t bytes) const { return BytesPerAudioSample() ? bytes / BytesPerAudioSample() : 0; }
+int64_t VideoInfo::BytesFromAudioSamples(int64_t samples) const { return samples * BytesPerAudioSample(); }
+
+void VideoInfo::SetFPS(unsigned numerator, unsigned denominator)
+{
+    fps_numerator = numerator;
+    fps_denominator = denominator;
+}
+
+void VideoInfo::MulDivFPS(unsigned multiplier, unsigned divisor)
+{
+    SetFPS(fps_numerator * multiplier, fps_denominator * divisor);
+}
+
+bool VideoInfo::IsSameColorspace(const VideoInfo& vi) const
+{
+    if (vi.pixel_type == pixel_type)
+        return true;
+
+    return IsPlanar() && vi.IsPlanar() && (pixel_type & CS_PLANAR_MASK & CS_PLANAR_FILTER) == (vi.pixel_type & CS_PLANAR_MASK & CS_PLANAR_FILTER);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// VideoFrameBuffer
+//////////////////////////////////////////////////////////////////////////////
+VideoFrameBuffer::VideoFrameBuffer(int size, int margin, Device* device)
+    : data(0), data_size(size), sequence_number(0), refcount(0), device(device)
+{
+    data = (BYTE*)aligned_alloc(margin, ((size + margin - 1) / margin) * margin);
+}
+
+VideoFrameBuffer::VideoFrameBuffer()
+    : data(0), data_size(0), sequence_number(0), refcount(0), device(0)
+{
+}
+
+VideoFrameBuffer::~VideoFrameBuffer()
+{
+    free(data);
+}
+
+const BYTE* VideoFrameBuffer::GetReadPtr() const { return data; }
+BYTE* VideoFrameBuffer::GetWritePtr() { __sync_add_and_fetch(&sequence_number, 1); return data; }
+int VideoFrameBuffer::GetDataSize() const { return data_size; }
+int VideoFrameBuffer::GetSequenceNumber() const { return sequence_number; }
+int VideoFrameBuffer::GetRefcount() const { return refcount; }
+
+
+//////////////////////////////////////////////////////////////////////////////
+// VideoFrame
+//////////////////////////////////////////////////////////////////////////////
+VideoFrame::VideoFrame(VideoFrameBuffer* _vfb, AVSMap* avsmap, int _offset, int _pitch, int _row_size, int _height)
+    : refcount(0), vfb(_vfb), offset(_offset), pitch(_pitch), row_size(_row_size), height(_height),
+      offsetU(_offset), offsetV(_offset), pitchUV(0), row_sizeUV(0), heightUV(0),
+      offsetA(0), pitchA(0), row_sizeA(0), properties(avsmap)
+{
+    __sync_add_and_fetch(&vfb->refcount, 1);
+}
+
+VideoFrame::VideoFrame(VideoFrameBuffer* _vfb, AVSMap* avsmap, int _offset, int _pitch, int _row_size, int _height, int _offsetU, int _offsetV, int _pitchUV, int _row_sizeUV, int _heightUV)
+    : refcount(0), vfb(_vfb), offset(_offset), pitch(_pitch), row_size(_row_size), height(_height),
+      offsetU(_offsetU), offsetV(_offsetV), pitchUV(_pitchUV), row_sizeUV(_row_sizeUV), heightUV(_heightUV),
+      offsetA(0), pitchA(0), row_sizeA(0), properties(avsmap)
+{
+    __sync_add_and_fetch(&vfb->refcount, 1);
+}
+
+VideoFrame::VideoFrame(VideoFrameBuffer* _vfb, AVSMap* avsmap, int _offset, int _pitch, int _row_size, int _height, int _offsetU, int _offsetV, int _pitchUV, int _row_sizeUV, int _heightUV, int _offsetA)
+    : refcount(0), vfb(_vfb), offset(_offset), pitch(_pitch), row_size(_row_size), height(_height),
+      offsetU(_offsetU), offsetV(_offsetV), pitchUV(_pitchUV), row_sizeUV(_row_sizeUV), heightUV(_heightUV),
+      offsetA(_offsetA), pitchA(_pitch), row_sizeA(_row_size), properties(avsmap)
+{
+    __sync_add_and_fetch(&vfb->refcount, 1);
+}
+
+void* VideoFrame::operator new(size_t size)
+{
+    return ::operator new(size);
+}
+
+VideoFrame::~VideoFrame()
+{
+    DESTRUCTOR();
+}
+
+void VideoFrame::DESTRUCTOR()
+{
+    delete properties;
+    properties = 0;
+
+    if (vfb && !__sync_sub_and_fetch(&vfb->refcount, 1))
+        delete vfb;
+
+    vfb = 0;
+}
+
+void VideoFrame::AddRef()
+{
+    __sync_add_and_fetch(&refcount, 1);
+}
+
+void VideoFrame::Release()
+{
+    if (!__sync_sub_and_fetch(&refcount, 1))
+        delete this;
+}
+
+static bool IsChromaPlane(int plane)
+{
+    plane = plane & ~PLANAR_ALIGNED;
+
+    return plane == PLANAR_U || plane == PLANAR_V || plane == PLANAR_B || plane == PLANAR_R;
+}
+
+int VideoFrame::GetPitch(int plane) const
+{
+    if (IsChromaPlane(plane))
+        return pitchUV;
+
+    if ((plane & ~PLANAR_ALIGNED) == PLANAR_A)
+        return pitchA;
+
+    return pitch;
+}
+
+int VideoFrame::GetRowSize(int plane) const
+{
+    if (IsChromaPlane(plane))
+        return pitchUV ? row_sizeUV : 0;
+
+    if ((plane & ~PLANAR_ALIGNED) == PLANAR_A)
+        return row_sizeA;
+
+    return row_size;
+}
+
+int VideoFrame::GetHeight(int plane) const
+{
+    if (IsChromaPlane(plane))
+        return pitchUV ? heightUV : 0;
+
+    if ((plane & ~PLANAR_ALIGNED) == PLANAR_A)
+        return pitchA ? height : 0;
+
+    return height;
+}
+
+int VideoFrame::GetOffset(int plane) const
+{
+    switch (plane & ~PLANAR_ALIGNED)
+    {
+    case PLANAR_U: case PLANAR_B: return offsetU;
+    case PLANAR_V: case PLANAR_R: return offsetV;
+    case PLANAR_A: return offsetA;
+    default: return offset;
+    }
+}
+
+VideoFrameBuffer* VideoFrame::GetFrameBuffer() const { return vfb; }
+const BYTE* VideoFrame::GetReadPtr(int plane) const { return vfb->GetReadPtr() + GetOffset(plane); }
+bool VideoFrame::IsWritable() const { return refcount == 1 && vfb->refcount == 1; }
+
+BYTE* VideoFrame::GetWritePtr(int plane) const
+{
+    // Like the core, hand out the luma write pointer only to the sole owner
+    if (!IsChromaPlane(plane) && (plane & ~PLANAR_ALIGNED) != PLANAR_A && !IsWritable())
+        return 0;
+
+    return vfb->GetWritePtr() + GetOffset(plane);
+}
+
+AVSMap& VideoFrame::getProperties()
+{
+    if (!properties)
+        properties = new AVSMap();
+
+    return *properties;
+}
+
+const AVSMap& VideoFrame::getConstProperties()
+{
+    return getProperties();
+}
+
+void VideoFrame::setProperties(const AVSMap& _properties)
+{
+    getProperties() = _properties;
+}
+
+VideoFrame* VideoFrame::Subframe(int rel_offset, int new_pitch, int new_row_size, int new_height) const
+{
+    return new VideoFrame(vfb, new AVSMap(properties ? *properties : AVSMap()), offset + rel_offset, new_pitch, new_row_size, new_height);
+}
+
+VideoFrame* VideoFrame::Subframe(int rel_offset, int new_pitch, int new_row_size, int new_height, int rel_offsetU, int rel_offsetV, int new_pitchUV) const
+{
+    const int new_row_sizeUV = pitch ? (int)((int64_t)new_row_size * row_sizeUV / row_size) : 0;
+    const int new_heightUV = height ? (int)((int64_t)new_height * heightUV / height) : 0;
+
+    return new VideoFrame(vfb, new AVSMap(properties ? *properties : AVSMap()), offset + rel_offset, new_pitch, new_row_size, new_height,
+        rel_offsetU + offsetU, rel_offsetV + offsetV, new_pitchUV, new_row_sizeUV, new_heightUV);
+}
+
+VideoFrame* VideoFrame::Subframe(int rel_offset, int new_pitch, int new_row_size, int new_height, int rel_offsetU, int rel_offsetV, int new_pitchUV, int rel_offsetA) const
+{
+    VideoFrame* frame = Subframe(rel_offset, new_pitch, new_row_size, new_height, rel_offsetU, rel_offsetV, new_pitchUV);
+
+    frame->offsetA = offsetA + rel_offsetA;
+    frame->pitchA = pitchA ? new_pitch : 0;
+    frame->row_sizeA = pitchA ? new_row_size : 0;
+
+    return frame;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// IClip, PClip and PVideoFrame reference counting
+//////////////////////////////////////////////////////////////////////////////
+void IClip::AddRef()
+{
+    __sync_add_and_fetch(&refcnt, 1);
+}
+
+void IClip::Release()
+{
+    if (!__sync_sub_and_fetch(&refcnt, 1))
+        delete this;
+}
+
+IClip* PClip::GetPointerWithAddRef() const { if (p) p->AddRef(); return p; }
+void PClip::Init(IClip* x) { if (x) x->AddRef(); p = x; }
+void PClip::Set(IClip* x) { if (x) x->AddRef(); if (p) p->Release(); p = x; }
+
+PClip::PClip() { p = 0; }
+PClip::PClip(const PClip& x) { Init(x.p); }
+PClip::PClip(IClip* x) { Init(x); }
+void PClip::operator=(IClip* x) { Set(x); }
+void PClip::operator=(const PClip& x) { Set(x.p); }
+PClip::~PClip() { if (p) p->Release(); }
+
+void PClip::CONSTRUCTOR0() { new(this) PClip(); }
+void PClip::CONSTRUCTOR1(const PClip& x) { new(this) PClip(x); }
+void PClip::CONSTRUCTOR2(IClip* x) { new(this) PClip(x); }
+void PClip::OPERATOR_ASSIGN0(IClip* x) { Set(x); }
+void PClip::OPERATOR_ASSIGN1(const PClip& x) { Set(x.p); }
+void PClip::DESTRUCTOR() { if (p) p->Release(); }
+
+void PVideoFrame::Init(VideoFrame* x) { if (x) x->AddRef(); p = x; }
+void PVideoFrame::Set(VideoFrame* x) { if (x) x->AddRef(); if (p) p->Release(); p = x; }
+
+PVideoFrame::PVideoFrame() { p = 0; }
+PVideoFrame::PVideoFrame(const PVideoFrame& x) { Init(x.p); }
+PVideoFrame::PVideoFrame(VideoFrame* x) { Init(x); }
+void PVideoFrame::operator=(VideoFrame* x) { Set(x); }
+void PVideoFrame::operator=(const PVideoFrame& x) { Set(x.p); }
+PVideoFrame::~PVideoFrame() { if (p) p->Release(); }
+
+void PVideoFrame::CONSTRUCTOR0() { new(this) PVideoFrame(); }
+void PVideoFrame::CONSTRUCTOR1(const PVideoFrame& x) { new(this) PVideoFrame(x); }
+void PVideoFrame::CONSTRUCTOR2(VideoFrame* x) { new(this) PVideoFrame(x); }
+void PVideoFrame::OPERATOR_ASSIGN0(VideoFrame* x) { Set(x); }
+void PVideoFrame::OPERATOR_ASSIGN1(const PVideoFrame& x) { Set(x.p); }
+void PVideoFrame::DESTRUCTOR() { if (p) p->Release(); }
+
+
+//////////////////////////////////////////////////////////////////////////////
+// AVSValue
+//
+// Arrays are deep copied and owned by the value, strings are expected to
+// come from SaveString or to outlive the value.
+//////////////////////////////////////////////////////////////////////////////
+void AVSValue::Assign(const AVSValue* src, bool init)
+{
+    if (src->type == 'c' && src->clip)
+        src->clip->AddRef();
+
+    // Copy first, the source may be an element of the array being replaced
+    AVSValue* copy = 0;
+
+    if (src->type == 'a')
+    {
+        copy = new AVSValue[src->array_size > 0 ? src->array_size : 1];
+
+        for (int i = 0; i < src->array_size; i++)
+            copy[i] = src->array[i];
+    }
+
+    if (!init)
+        DESTRUCTOR();
+
+    type = src->type;
+    array_size = src->array_size;
+
+    switch (type)
+    {
+    case 'c': clip = src->clip; break;
+    case 'b': boolean = src->boolean; break;
+    case 'i': integer = src->integer; break;
+    case 'f': floating_pt = src->floating_pt; break;
+    case 's': string = src->string; break;
+    case 'a': array = copy; break;
+    case 'n': function = src->function; break;
+#ifdef X86_64
+    case 'l': longlong = src->longlong; break;
+    case 'd': double_pt = src->double_pt; break;
+#endif
+    default: clip = 0; break;
+    }
+}
+
+AVSValue::AVSValue() { CONSTRUCTOR0(); }
+AVSValue::AVSValue(IClip* c) { CONSTRUCTOR1(c); }
+AVSValue::AVSValue(const PClip& c) { CONSTRUCTOR2(c); }
+AVSValue::AVSValue(bool b) { CONSTRUCTOR3(b); }
+AVSValue::AVSValue(int i) { CONSTRUCTOR4(i); }
+AVSValue::AVSValue(float f) { CONSTRUCTOR5(f); }
+AVSValue::AVSValue(double f) { CONSTRUCTOR6(f); }
+AVSValue::AVSValue(const char* s) { CONSTRUCTOR7(s); }
+AVSValue::AVSValue(const AVSValue* a, int size) { CONSTRUCTOR8(a, size); }
+AVSValue::AVSValue(const AVSValue& a, int size) { CONSTRUCTOR8(&a, size); }
+AVSValue::AVSValue(const AVSValue& v) { CONSTRUCTOR9(v); }
+AVSValue::~AVSValue() { DESTRUCTOR(); }
+AVSValue& AVSValue::operator=(const AVSValue& v) { return OPERATOR_ASSIGN(v); }
+const AVSValue& AVSValue::operator[](int index) const { return OPERATOR_INDEX(index); }
+
+void AVSValue::CONSTRUCTOR0() { type = 'v'; array_size = 0; clip = 0; }
+void AVSValue::CONSTRUCTOR1(IClip* c) { type = 'c'; array_size = 0; clip = c; if (c) c->AddRef(); }
+void AVSValue::CONSTRUCTOR2(const PClip& c) { CONSTRUCTOR1(c.p); }
+void AVSValue::CONSTRUCTOR3(bool b) { type = 'b'; array_size = 0; clip = 0; boolean = b; }
+void AVSValue::CONSTRUCTOR4(int i) { type = 'i'; array_size = 0; clip = 0; integer = i; }
+void AVSValue::CONSTRUCTOR5(float f) { type = 'f'; array_size = 0; clip = 0; floating_pt = f; }
+void AVSValue::CONSTRUCTOR6(double f) { type = 'f'; array_size = 0; clip = 0; floating_pt = (float)f; }
+void AVSValue::CONSTRUCTOR7(const char* s) { type = 's'; array_size = 0; string = s; }
+
+void AVSValue::CONSTRUCTOR8(const AVSValue* a, int size)
+{
+    AVSValue source;
+
+    source.type = 'a';
+    source.array_size = (short)size;
+    source.array = a;
+
+    Assign(&source, true);
+
+    // Not owned by the temporary
+    source.type = 'v';
+}
+
+void AVSValue::CONSTRUCTOR9(const AVSValue& v) { Assign(&v, true); }
+
+void AVSValue::DESTRUCTOR()
+{
+    if (type == 'c' && clip)
+        clip->Release();
+    else if (type == 'a')
+        delete[] array;
+
+    type = 'v';
+}
+
+AVSValue& AVSValue::OPERATOR_ASSIGN(const AVSValue& v)
+{
+    if (&v != this)
+        Assign(&v, false);
+
+    return *this;
+}
+
+const AVSValue& AVSValue::OPERATOR_INDEX(int index) const
+{
+    if (!IsArray())
+        return *this;
+
+    if (index < 0 || index >= array_size)
+        throw AvisynthError("Array index out of range");
+
+    return array[index];
+}
+
+bool AVSValue::Defined() const { return type != 'v'; }
+bool AVSValue::IsClip() const { return type == 'c'; }
+bool AVSValue::IsBool() const { return type == 'b'; }
+bool AVSValue::IsInt() const { return type == 'i'; }
+bool AVSValue::IsFloat() const { return type == 'f' || type == 'i'; }
+bool AVSValue::IsString() const { return type == 's'; }
+bool AVSValue::IsArray() const { return type == 'a'; }
+bool AVSValue::IsFunction() const { return type == 'n'; }
+int AVSValue::ArraySize() const { return IsArray() ? array_size : 1; }
+
+PClip AVSValue::AsClip() const { return IsClip() ? PClip(clip) : PClip(); }
+bool AVSValue::AsBool1() const { return boolean; }
+int AVSValue::AsInt1() const { return integer; }
+const char* AVSValue::AsString1() const { return IsString() ? string : 0; }
+double AVSValue::AsFloat1() const { return type == 'i' ? integer : floating_pt; }
+bool AVSValue::AsBool2(bool def) const { return IsBool() ? boolean : def; }
+int AVSValue::AsInt2(int def) const { return IsInt() ? integer : def; }
+double AVSValue::AsDblDef(double def) const { return IsFloat() ? AsFloat1() : def; }
+double AVSValue::AsFloat2(float def) const { return IsFloat() ? AsFloat1() : def; }
+const char* AVSValue::AsString2(const char* def) const { return IsString() ? string : def; }
+
+bool AVSValue::AsBool() const { return AsBool1(); }
+int AVSValue::AsInt() const { return AsInt1(); }
+const char* AVSValue::AsString() const { return AsString1(); }
+double AVSValue::AsFloat() const { return AsFloat1(); }
+bool AVSValue::AsBool(bool def) const { return AsBool2(def); }
+int AVSValue::AsInt(int def) const { return AsInt2(def); }
+double AVSValue::AsFloat(float def) const { return AsFloat2(def); }
+const char* AVSValue::AsString(const char* def) const { return AsString2(def); }
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Script environment
+//////////////////////////////////////////////////////////////////////////////
+class ScriptEnvironment : public IScriptEnvironment
+{
+public:
+    ScriptEnvironment(int _cpuflags) : cpuflags(_cpuflags) {}
+
+    ~ScriptEnvironment()
+    {
+        for (size_t i = 0; i < strings.size(); i++)
+            free(strings[i]);
+    }
+
+    int __stdcall GetCPUFlags() { return cpuflags; }
+
+    char* __stdcall SaveString(const char* s, int length)
+    {
+        if (length < 0)
+            length = (int)strlen(s);
+
+        char* copy = (char*)malloc(length + 1);
+
+        memcpy(copy, s, length);
+        copy[length] = 0;
+
+        std::lock_guard<std::mutex> lock(stringlock);
+        strings.push_back(copy);
+
+        return copy;
+    }
+
+    char* Sprintf(const char* fmt, ...)
+    {
+        va_list val;
+        va_start(val, fmt);
+        char* result = VSprintf(fmt, val);
+        va_end(val);
+
+        return result;
+    }
+
+    char* __stdcall VSprintf(const char* fmt, va_list val)
+    {
+        char buffer[4096];
+
+        vsnprintf(buffer, sizeof(buffer), fmt, val);
+
+        return SaveString(buffer, -1);
+    }
+
+    void ThrowError(const char* fmt, ...)
+    {
+        va_list val;
+        va_start(val, fmt);
+        char* message = VSprintf(fmt, val);
+        va_end(val);
+
+        throw AvisynthError(message);
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    // Functions
+    //////////////////////////////////////////////////////////////////////////
+    void __stdcall AddFunction(const char* name, const char* params, ApplyFunc apply, void* user_data)
+    {
+        Function function = { name, params, apply, user_data };
+
+        functions.push_back(function);
+    }
+
+    bool __stdcall FunctionExists(const char* name)
+    {
+        return FindFunction(name) != 0;
+    }
+
+    AVSValue __stdcall Invoke(const char* name, const AVSValue args, const char* const* arg_names)
+    {
+        AVSValue result;
+
+        if (!InvokeTry(&result, name, args, arg_names))
+            throw NotFound();
+
+        return result;
+    }
+
+    bool __stdcall InvokeTry(AVSValue* result, const char* name, const AVSValue& args, const char* const* arg_names)
+    {
+        const Function* function = FindFunction(name);
+
+        if (!function)
+            return false;
+
+        *result = function->apply(BindArguments(*function, args, arg_names), function->user_data, this);
+
+        return true;
+    }
+
+    AVSValue __stdcall Invoke2(const AVSValue& implicit_last, const char* name, const AVSValue args, const char* const* arg_names) { return Invoke(name, args, arg_names); }
+    bool __stdcall Invoke2Try(AVSValue* result, const AVSValue& implicit_last, const char* name, const AVSValue args, const char* const* arg_names) { return InvokeTry(result, name, args, arg_names); }
+    AVSValue __stdcall Invoke3(const AVSValue& implicit_last, const PFunction& func, const AVSValue args, const char* const* arg_names) { throw NotFound(); }
+    bool __stdcall Invoke3Try(AVSValue* result, const AVSValue& implicit_last, const PFunction& func, const AVSValue args, const char* const* arg_names) { return false; }
+
+    //////////////////////////////////////////////////////////////////////////
+    // Variables, none are defined
+    //////////////////////////////////////////////////////////////////////////
+    AVSValue __stdcall GetVar(const char* name) { throw NotFound(); }
+    AVSValue __stdcall GetVarDef(const char* name, const AVSValue& def) { return def; }
+    bool __stdcall GetVarTry(const char* name, AVSValue* val) const { return false; }
+    bool __stdcall GetVarBool(const char* name, bool def) const { return def; }
+    int __stdcall GetVarInt(const char* name, int def) const { return def; }
+    double __stdcall GetVarDouble(const char* name, double def) const { return def; }
+    const char* __stdcall GetVarString(const char* name, const char* def) const { return def; }
+    int64_t __stdcall GetVarLong(const char* name, int64_t def) const { return def; }
+    bool __stdcall SetVar(const char* name, const AVSValue& val) { return false; }
+    bool __stdcall SetGlobalVar(const char* name, const AVSValue& val) { return false; }
+    void __stdcall PushContext(int level) {}
+    void __stdcall PopContext() {}
+
+    //////////////////////////////////////////////////////////////////////////
+    // Frames
+    //////////////////////////////////////////////////////////////////////////
+    PVideoFrame __stdcall NewVideoFrame(const VideoInfo& vi, int align)
+    {
+        const int alignment = 64;
+
+        const int rowsize = vi.BytesFromPixels(vi.width);
+        const int pitch = (rowsize + alignment - 1) & ~(alignment - 1);
+        const int size = pitch * vi.height;
+
+        if (!vi.IsPlanar() || vi.IsY())
+            return new VideoFrame(new VideoFrameBuffer(size, alignment, 0), new AVSMap(), 0, pitch, rowsize, vi.height);
+
+        int rowsizeUV = rowsize;
+        int heightUV = vi.height;
+
+        if (!vi.IsRGB())
+        {
+            rowsizeUV = rowsize >> vi.GetPlaneWidthSubsampling(PLANAR_U);
+            heightUV = vi.height >> vi.GetPlaneHeightSubsampling(PLANAR_U);
+        }
+
+        const int pitchUV = (rowsizeUV + alignment - 1) & ~(alignment - 1);
+        const int sizeUV = pitchUV * heightUV;
+        const bool alpha = vi.IsYUVA() || vi.IsPlanarRGBA();
+
+        VideoFrameBuffer* vfb = new VideoFrameBuffer(size + 2 * sizeUV + (alpha ? size : 0), alignment, 0);
+
+        // Planar YV formats store V before U
+        int offsetU = size;
+        int offsetV = size + sizeUV;
+
+        if (!vi.IsRGB() && vi.IsVPlaneFirst())
+        {
+            offsetV = size;
+            offsetU = size + sizeUV;
+        }
+
+        if (alpha)
+            return new VideoFrame(vfb, new AVSMap(), 0, pitch, rowsize, vi.height, offsetU, offsetV, pitchUV, rowsizeUV, heightUV, size + 2 * sizeUV);
+
+        return new VideoFrame(vfb, new AVSMap(), 0, pitch, rowsize, vi.height, offsetU, offsetV, pitchUV, rowsizeUV, heightUV);
+    }
+
+    PVideoFrame __stdcall NewVideoFrameP(const VideoInfo& vi, PVideoFrame* propSrc, int align)
+    {
+        PVideoFrame frame = NewVideoFrame(vi, align);
+
+        if (propSrc && *propSrc)
+            frame->setProperties((*propSrc)->getConstProperties());
+
+        return frame;
+    }
+
+    bool __stdcall MakeWritable(PVideoFrame* pvf)
+    {
+        if ((*pvf)->IsWritable())
+            return false;
+
+        VideoFrame* src = (VideoFrame*)(void*)(*pvf);
+        VideoFrameBuffer* vfb = new VideoFrameBuffer(src->vfb->data_size, 64, 0);
+
+        memcpy(vfb->data, src->vfb->data, src->vfb->data_size);
+
+        VideoFrame* copy = new VideoFrame(vfb, new AVSMap(src->properties ? *src->properties : AVSMap()), src->offset, src->pitch, src->row_size, src->height,
+            src->offsetU, src->offsetV, src->pitchUV, src->row_sizeUV, src->heightUV);
+
+        copy->offsetA = src->offsetA;
+        copy->pitchA = src->pitchA;
+        copy->row_sizeA = src->row_sizeA;
+
+        *pvf = copy;
+
+        return true;
+    }
+
+    void __stdcall BitBlt(BYTE* dstp, int dst_pitch, const BYTE* srcp, int src_pitch, int row_size, int height)
+    {
+        for (int y = 0; y < height; y++)
+            memcpy(dstp + y * dst_pitch, srcp + y * src_pitch, row_size);
+    }
+
+    PVideoFrame __stdcall Subframe(PVideoFrame src, int rel_offset, int new_pitch, int new_row_size, int new_height)
+    {
+        return src->Subframe(rel_offset, new_pitch, new_row_size, new_height);
+    }
+
+    PVideoFrame __stdcall SubframePlanar(PVideoFrame src, int rel_offset, int new_pitch, int new_row_size, int new_height, int rel_offsetU, int rel_offsetV, int new_pitchUV)
+    {
+        return src->Subframe(rel_offset, new_pitch, new_row_size, new_height, rel_offsetU, rel_offsetV, new_pitchUV);
+    }
+
+    PVideoFrame __stdcall SubframePlanarA(PVideoFrame src, int rel_offset, int new_pitch, int new_row_size, int new_height, int rel_offsetU, int rel_offsetV, int new_pitchUV, int rel_offsetA)
+    {
+        return src->Subframe(rel_offset, new_pitch, new_row_size, new_height, rel_offsetU, rel_offsetV, new_pitchUV, rel_offsetA);
+    }
+
+    void __stdcall ApplyMessage(PVideoFrame* frame, const VideoInfo& vi, const char* message, int size, int textcolor, int halocolor, int bgcolor) {}
+
+    //////////////////////////////////////////////////////////////////////////
+    // Frame properties
+    //////////////////////////////////////////////////////////////////////////
+    void __stdcall copyFrameProps(const PVideoFrame& src, PVideoFrame& dst)
+    {
+        dst->setProperties(src->getConstProperties());
+    }
+
+    const AVSMap* __stdcall getFramePropsRO(const PVideoFrame& frame) { return &frame->getConstProperties(); }
+    AVSMap* __stdcall getFramePropsRW(PVideoFrame& frame) { return &frame->getProperties(); }
+
+    int __stdcall propNumKeys(const AVSMap* map) { return (int)map->items.size(); }
+
+    const char* __stdcall propGetKey(const AVSMap* map, int index)
+    {
+        std::map<std::string, AVSMap::Property>::const_iterator item = map->items.begin();
+
+        std::advance(item, index);
+
+        return item->first.c_str();
+    }
+
+    int __stdcall propNumElements(const AVSMap* map, const char* key)
+    {
+        const AVSMap::Property* property = Find(map, key);
+
+        if (!property)
+            return -1;
+
+        return (int)(property->ints.size() + property->floats.size() + property->data.size());
+    }
+
+    char __stdcall propGetType(const AVSMap* map, const char* key)
+    {
+        const AVSMap::Property* property = Find(map, key);
+
+        return property ? property->type : PROPTYPE_UNSET;
+    }
+
+    int64_t __stdcall propGetInt(const AVSMap* map, const char* key, int index, int* error)
+    {
+        const AVSMap::Property* property = Find(map, key, PROPTYPE_INT, index, (int)(property_size(map, key)), error);
+
+        return property ? property->ints[index] : 0;
+    }
+
+    double __stdcall propGetFloat(const AVSMap* map, const char* key, int index, int* error)
+    {
+        const AVSMap::Property* property = Find(map, key, PROPTYPE_FLOAT, index, (int)(property_size(map, key)), error);
+
+        return property ? property->floats[index] : 0.0;
+    }
+
+    const char* __stdcall propGetData(const AVSMap* map, const char* key, int index, int* error)
+    {
+        const AVSMap::Property* property = Find(map, key, PROPTYPE_DATA, index, (int)(property_size(map, key)), error);
+
+        return property ? property->data[index].c_str() : 0;
+    }
+
+    int __stdcall propGetDataSize(const AVSMap* map, const char* key, int index, int* error)
+    {
+        const AVSMap::Property* property = Find(map, key, PROPTYPE_DATA, index, (int)(property_size(map, key)), error);
+
+        return property ? (int)property->data[index].size() : 0;
+    }
+
+    PClip __stdcall propGetClip(const AVSMap* map, const char* key, int index, int* error) { if (error) *error = GETPROPERROR_TYPE; return PClip(); }
+    const PVideoFrame __stdcall propGetFrame(const AVSMap* map, const char* key, int index, int* error) { if (error) *error = GETPROPERROR_TYPE; return PVideoFrame(); }
+
+    int __stdcall propDeleteKey(AVSMap* map, const char* key)
+    {
+        return (int)map->items.erase(key);
+    }
+
+    int __stdcall propSetInt(AVSMap* map, const char* key, int64_t i, int append)
+    {
+        AVSMap::Property* property = Prepare(map, key, PROPTYPE_INT, append);
+
+        if (!property)
+            return 1;
+
+        if (append != PROPAPPENDMODE_TOUCH)
+            property->ints.push_back(i);
+
+        return 0;
+    }
+
+    int __stdcall propSetFloat(AVSMap* map, const char* key, double d, int append)
+    {
+        AVSMap::Property* property = Prepare(map, key, PROPTYPE_FLOAT, append);
+
+        if (!property)
+            return 1;
+
+        if (append != PROPAPPENDMODE_TOUCH)
+            property->floats.push_back(d);
+
+        return 0;
+    }
+
+    int __stdcall propSetData(AVSMap* map, const char* key, const char* d, int length, int append)
+    {
+        AVSMap::Property* property = Prepare(map, key, PROPTYPE_DATA, append);
+
+        if (!property)
+            return 1;
+
+        if (append != PROPAPPENDMODE_TOUCH)
+            property->data.push_back(length < 0 ? std::string(d) : std::string(d, length));
+
+        return 0;
+    }
+
+    int __stdcall propSetClip(AVSMap* map, const char* key, PClip& clip, int append) { return 1; }
+    int __stdcall propSetFrame(AVSMap* map, const char* key, const PVideoFrame& frame, int append) { return 1; }
+
+    const int64_t* __stdcall propGetIntArray(const AVSMap* map, const char* key, int* error)
+    {
+        const AVSMap::Property* property = Find(map, key, PROPTYPE_INT, 0, 1, error);
+
+        return property ? property->ints.data() : 0;
+    }
+
+    const double* __stdcall propGetFloatArray(const AVSMap* map, const char* key, int* error)
+    {
+        const AVSMap::Property* property = Find(map, key, PROPTYPE_FLOAT, 0, 1, error);
+
+        return property ? property->floats.data() : 0;
+    }
+
+    int __stdcall propSetIntArray(AVSMap* map, const char* key, const int64_t* i, int size)
+    {
+        AVSMap::Property* property = Prepare(map, key, PROPTYPE_INT, PROPAPPENDMODE_REPLACE);
+
+        property->ints.assign(i, i + size);
+
+        return 0;
+    }
+
+    int __stdcall propSetFloatArray(AVSMap* map, const char* key, const double* d, int size)
+    {
+        AVSMap::Property* property = Prepare(map, key, PROPTYPE_FLOAT, PROPAPPENDMODE_REPLACE);
+
+        property->floats.assign(d, d + size);
+
+        return 0;
+    }
+
+    AVSMap* __stdcall createMap() { return new AVSMap(); }
+    void __stdcall freeMap(AVSMap* map) { delete map; }
+    void __stdcall clearMap(AVSMap* map) { map->items.clear(); }
+
+    //////////////////////////////////////////////////////////////////////////
+    // Everything else
+    //////////////////////////////////////////////////////////////////////////
+    void __stdcall AtExit(ShutdownFunc function, void* user_data) {}
+    void __stdcall CheckVersion(int version) { if (version > AVISYNTH_INTERFACE_VERSION) ThrowError("Plugin was designed for a later version of Avisynth (%d)", version); }
+    int __stdcall SetMemoryMax(int mem) { return 0; }
+    int __stdcall SetWorkingDir(const char* newdir) { return -1; }
+    void* __stdcall ManageCache(int key, void* data) { return 0; }
+    bool __stdcall PlanarChromaAlignment(PlanarChromaAlignmentMode key) { return true; }
+    void __stdcall DeleteScriptEnvironment() { delete this; }
+    const AVS_Linkage* __stdcall GetAVSLinkage() { return GetBenchLinkage(); }
+
+    size_t __stdcall GetEnvProperty(AvsEnvProperty prop)
+    {
+        switch (prop)
+        {
+        case AEP_FILTERCHAIN_THREADS: return 1;
+        case AEP_PHYSICAL_CPUS: case AEP_LOGICAL_CPUS: case AEP_THREADPOOL_THREADS: return 1;
+        case AEP_VERSION: return AVISYNTH_INTERFACE_VERSION;
+        default: return 0;
+        }
+    }
+
+    void* __stdcall Allocate(size_t nBytes, size_t alignment, AvsAllocType type)
+    {
+        return aligned_alloc(alignment, ((nBytes + alignment - 1) / alignment) * alignment);
+    }
+
+    void __stdcall Free(void* ptr) { free(ptr); }
+
+private:
+    struct Function
+    {
+        std::string name;
+        std::string params;
+        ApplyFunc apply;
+        void* user_data;
+    };
+
+    struct Parameter
+    {
+        std::string name;
+        char type;
+        bool repeat;
+    };
+
+    int cpuflags;
+    std::vector<Function> functions;
+    std::vector<char*> strings;
+    std::mutex stringlock;
+
+    const Function* FindFunction(const char* name) const
+    {
+        for (size_t i = 0; i < functions.size(); i++)
+        {
+            if (!strcasecmp(functions[i].name.c_str(), name))
+                return &functions[i];
+        }
+
+        return 0;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    // Match positional and named arguments against a parameter string like
+    // "c+[LOW]i[HIGH]i", the result holds one value per parameter
+    //////////////////////////////////////////////////////////////////////////
+    AVSValue BindArguments(const Function& function, const AVSValue& args, const char* const* arg_names)
+    {
+        std::vector<Parameter> params;
+
+        for (const char* p = function.params.c_str(); *p; )
+        {
+            Parameter param = { "", 0, false };
+
+            if (*p == '[')
+            {
+                const char* end = strchr(p, ']');
+
+                param.name.assign(p + 1, end - p - 1);
+                p = end + 1;
+            }
+
+            param.type = *p++;
+
+            if (*p == '+' || *p == '*')
+            {
+                param.repeat = true;
+                p++;
+            }
+
+            params.push_back(param);
+        }
+
+        std::vector<AVSValue> bound(params.size());
+        std::vector<AVSValue> repeated;
+
+        const int count = args.IsArray() ? args.ArraySize() : 1;
+        size_t next = 0;
+
+        for (int i = 0; i < count; i++)
+        {
+            const AVSValue& value = args[i];
+            const char* name = arg_names ? arg_names[i] : 0;
+
+            if (name)
+            {
+                size_t k = 0;
+
+                while (k < params.size() && strcasecmp(params[k].name.c_str(), name))
+                    k++;
+
+                if (k == params.size())
+                    ThrowError("%s does not have a named argument \"%s\"", function.name.c_str(), name);
+
+                bound[k] = value;
+                continue;
+            }
+
+            if (next >= params.size() || !params[next].name.empty())
+                ThrowError("Invalid arguments to function \"%s\"", function.name.c_str());
+
+            if (params[next].repeat)
+            {
+                repeated.push_back(value);
+
+                // The repeated parameter takes all arguments of its type
+                if (i + 1 < count && (arg_names && arg_names[i + 1] ? false : args[i + 1].IsClip() == (params[next].type == 'c')))
+                    continue;
+
+                bound[next++] = AVSValue(repeated.data(), (int)repeated.size());
+                repeated.clear();
+            }
+            else
+                bound[next++] = value;
+        }
+
+        return AVSValue(bound.data(), (int)bound.size());
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    // Property helpers
+    //////////////////////////////////////////////////////////////////////////
+    static size_t property_size(const AVSMap* map, const char* key)
+    {
+        std::map<std::string, AVSMap::Property>::const_iterator item = map->items.find(key);
+
+        if (item == map->items.end())
+            return 0;
+
+        return item->second.ints.size() + item->second.floats.size() + item->second.data.size();
+    }
+
+    static const AVSMap::Property* Find(const AVSMap* map, const char* key)
+    {
+        std::map<std::string, AVSMap::Property>::const_iterator item = map->items.find(key);
+
+        return item == map->items.end() ? 0 : &item->second;
+    }
+
+    static const AVSMap::Property* Find(const AVSMap* map, const char* key, char type, int index, int size, int* error)
+    {
+        const AVSMap::Property* property = Find(map, key);
+        int result = 0;
+
+        if (!property)
+            result = GETPROPERROR_UNSET;
+        else if (property->type != type)
+            result = GETPROPERROR_TYPE;
+        else if (index < 0 || index >= size)
+            result = GETPROPERROR_INDEX;
+
+        if (error)
+            *error = result;
+
+        return result ? 0 : property;
+    }
+
+    static AVSMap::Property* Prepare(AVSMap* map, const char* key, char type, int append)
+    {
+        AVSMap::Property& property = map->items[key];
+
+        if (append == PROPAPPENDMODE_REPLACE || property.type != type)
+        {
+            if (append != PROPAPPENDMODE_REPLACE && property.type && property.type != type)
+                return 0;
+
+            property = AVSMap::Property();
+            property.type = type;
+        }
+
+        return &property;
+    }
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Linkage
+//////////////////////////////////////////////////////////////////////////////
+static AVS_Linkage CreateLinkage()
+{
+    AVS_Linkage linkage;
+
+    memset(&linkage, 0, sizeof(linkage));
+    linkage.Size = sizeof(AVS_Linkage);
+
+    linkage.HasVideo = &VideoInfo::HasVideo;
+    linkage.HasAudio = &VideoInfo::HasAudio;
+    linkage.IsRGB = &VideoInfo::IsRGB;
+    linkage.IsRGB24 = &VideoInfo::IsRGB24;
+    linkage.IsRGB32 = &VideoInfo::IsRGB32;
+    linkage.IsYUV = &VideoInfo::IsYUV;
+    linkage.IsYUY2 = &VideoInfo::IsYUY2;
+    linkage.IsYV24 = &VideoInfo::IsYV24;
+    linkage.IsYV16 = &VideoInfo::IsYV16;
+    linkage.IsYV12 = &VideoInfo::IsYV12;
+    linkage.IsYV411 = &VideoInfo::IsYV411;
+    linkage.IsY8 = &VideoInfo::IsY8;
+    linkage.IsColorSpace = &VideoInfo::IsColorSpace;
+    linkage.Is = &VideoInfo::Is;
+    linkage.IsPlanar = &VideoInfo::IsPlanar;
+    linkage.IsFieldBased = &VideoInfo::IsFieldBased;
+    linkage.IsParityKnown = &VideoInfo::IsParityKnown;
+    linkage.IsBFF = &VideoInfo::IsBFF;
+    linkage.IsTFF = &VideoInfo::IsTFF;
+    linkage.IsVPlaneFirst = &VideoInfo::IsVPlaneFirst;
+    linkage.BytesFromPixels = &VideoInfo::BytesFromPixels;
+    linkage.RowSize = &VideoInfo::RowSize;
+    linkage.BMPSize = &VideoInfo::BMPSize;
+    linkage.AudioSamplesFromFrames = &VideoInfo::AudioSamplesFromFrames;
+    linkage.FramesFromAudioSamples = &VideoInfo::FramesFromAudioSamples;
+    linkage.AudioSamplesFromBytes = &VideoInfo::AudioSamplesFromBytes;
+    linkage.BytesFromAudioSamples = &VideoInfo::BytesFromAudioSamples;
+    linkage.AudioChannels = &VideoInfo::AudioChannels;
+    linkage.SampleType = &VideoInfo::SampleType;
+    linkage.IsSampleType = &VideoInfo::IsSampleType;
+    linkage.SamplesPerSecond = &VideoInfo::SamplesPerSecond;
+    linkage.BytesPerAudioSample = &VideoInfo::BytesPerAudioSample;
+    linkage.SetFieldBased = &VideoInfo::SetFieldBased;
+    linkage.Set = &VideoInfo::Set;
+    linkage.Clear = &VideoInfo::Clear;
+    linkage.GetPlaneWidthSubsampling = &VideoInfo::GetPlaneWidthSubsampling;
+    linkage.GetPlaneHeightSubsampling = &VideoInfo::GetPlaneHeightSubsampling;
+    linkage.BitsPerPixel = &VideoInfo::BitsPerPixel;
+    linkage.BytesPerChannelSample = &VideoInfo::BytesPerChannelSample;
+    linkage.SetFPS = &VideoInfo::SetFPS;
+    linkage.MulDivFPS = &VideoInfo::MulDivFPS;
+    linkage.IsSameColorspace = &VideoInfo::IsSameColorspace;
+
+    linkage.VFBGetReadPtr = &VideoFrameBuffer::GetReadPtr;
+    linkage.VFBGetWritePtr = &VideoFrameBuffer::GetWritePtr;
+    linkage.GetDataSize = &VideoFrameBuffer::GetDataSize;
+    linkage.GetSequenceNumber = &VideoFrameBuffer::GetSequenceNumber;
+    linkage.GetRefcount = &VideoFrameBuffer::GetRefcount;
+
+    linkage.GetPitch = &VideoFrame::GetPitch;
+    linkage.GetRowSize = &VideoFrame::GetRowSize;
+    linkage.GetHeight = &VideoFrame::GetHeight;
+    linkage.GetFrameBuffer = &VideoFrame::GetFrameBuffer;
+    linkage.GetOffset = &VideoFrame::GetOffset;
+    linkage.VFGetReadPtr = &VideoFrame::GetReadPtr;
+    linkage.IsWritable = &VideoFrame::IsWritable;
+    linkage.VFGetWritePtr = &VideoFrame::GetWritePtr;
+    linkage.VideoFrame_DESTRUCTOR = &VideoFrame::DESTRUCTOR;
+
+    linkage.PClip_CONSTRUCTOR0 = &PClip::CONSTRUCTOR0;
+    linkage.PClip_CONSTRUCTOR1 = &PClip::CONSTRUCTOR1;
+    linkage.PClip_CONSTRUCTOR2 = &PClip::CONSTRUCTOR2;
+    linkage.PClip_OPERATOR_ASSIGN0 = &PClip::OPERATOR_ASSIGN0;
+    linkage.PClip_OPERATOR_ASSIGN1 = &PClip::OPERATOR_ASSIGN1;
+    linkage.PClip_DESTRUCTOR = &PClip::DESTRUCTOR;
+
+    linkage.PVideoFrame_CONSTRUCTOR0 = &PVideoFrame::CONSTRUCTOR0;
+    linkage.PVideoFrame_CONSTRUCTOR1 = &PVideoFrame::CONSTRUCTOR1;
+    linkage.PVideoFrame_CONSTRUCTOR2 = &PVideoFrame::CONSTRUCTOR2;
+    linkage.PVideoFrame_OPERATOR_ASSIGN0 = &PVideoFrame::OPERATOR_ASSIGN0;
+    linkage.PVideoFrame_OPERATOR_ASSIGN1 = &PVideoFrame::OPERATOR_ASSIGN1;
+    linkage.PVideoFrame_DESTRUCTOR = &PVideoFrame::DESTRUCTOR;
+
+    linkage.AVSValue_CONSTRUCTOR0 = &AVSValue::CONSTRUCTOR0;
+    linkage.AVSValue_CONSTRUCTOR1 = &AVSValue::CONSTRUCTOR1;
+    linkage.AVSValue_CONSTRUCTOR2 = &AVSValue::CONSTRUCTOR2;
+    linkage.AVSValue_CONSTRUCTOR3 = &AVSValue::CONSTRUCTOR3;
+    linkage.AVSValue_CONSTRUCTOR4 = &AVSValue::CONSTRUCTOR4;
+    linkage.AVSValue_CONSTRUCTOR5 = &AVSValue::CONSTRUCTOR5;
+    linkage.AVSValue_CONSTRUCTOR6 = &AVSValue::CONSTRUCTOR6;
+    linkage.AVSValue_CONSTRUCTOR7 = &AVSValue::CONSTRUCTOR7;
+    linkage.AVSValue_CONSTRUCTOR8 = &AVSValue::CONSTRUCTOR8;
+    linkage.AVSValue_CONSTRUCTOR9 = &AVSValue::CONSTRUCTOR9;
+    linkage.AVSValue_DESTRUCTOR = &AVSValue::DESTRUCTOR;
+    linkage.AVSValue_OPERATOR_ASSIGN = &AVSValue::OPERATOR_ASSIGN;
+    linkage.AVSValue_OPERATOR_INDEX = &AVSValue::OPERATOR_INDEX;
+    linkage.Defined = &AVSValue::Defined;
+    linkage.IsClip = &AVSValue::IsClip;
+    linkage.IsBool = &AVSValue::IsBool;
+    linkage.IsInt = &AVSValue::IsInt;
+    linkage.IsFloat = &AVSValue::IsFloat;
+    linkage.IsString = &AVSValue::IsString;
+    linkage.IsArray = &AVSValue::IsArray;
+    linkage.AsClip = &AVSValue::AsClip;
+    linkage.AsBool1 = &AVSValue::AsBool1;
+    linkage.AsInt1 = &AVSValue::AsInt1;
+    linkage.AsString1 = &AVSValue::AsString1;
+    linkage.AsFloat1 = &AVSValue::AsFloat1;
+    linkage.AsBool2 = &AVSValue::AsBool2;
+    linkage.AsInt2 = &AVSValue::AsInt2;
+    linkage.AsDblDef = &AVSValue::AsDblDef;
+    linkage.AsFloat2 = &AVSValue::AsFloat2;
+    linkage.AsString2 = &AVSValue::AsString2;
+    linkage.ArraySize = &AVSValue::ArraySize;
+
+    linkage.NumComponents = &VideoInfo::NumComponents;
+    linkage.ComponentSize = &VideoInfo::ComponentSize;
+    linkage.BitsPerComponent = &VideoInfo::BitsPerComponent;
+    linkage.Is444 = &VideoInfo::Is444;
+    linkage.Is422 = &VideoInfo::Is422;
+    linkage.Is420 = &VideoInfo::Is420;
+    linkage.IsY = &VideoInfo::IsY;
+    linkage.IsRGB48 = &VideoInfo::IsRGB48;
+    linkage.IsRGB64 = &VideoInfo::IsRGB64;
+    linkage.IsYUVA = &VideoInfo::IsYUVA;
+    linkage.IsPlanarRGB = &VideoInfo::IsPlanarRGB;
+    linkage.IsPlanarRGBA = &VideoInfo::IsPlanarRGBA;
+
+    linkage.getProperties = &VideoFrame::getProperties;
+    linkage.getConstProperties = &VideoFrame::getConstProperties;
+    linkage.setProperties = &VideoFrame::setProperties;
+    linkage.IsFunction = &AVSValue::IsFunction;
+
+    return linkage;
+}
+
+const AVS_Linkage* GetBenchLinkage()
+{
+    static const AVS_Linkage linkage = CreateLinkage();
+
+    return &linkage;
+}
+
+IScriptEnvironment* CreateBenchEnvironment(int cpuflags)
+{
+    return new ScriptEnvironment(cpuflags);
+}
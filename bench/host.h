@@ -0,0 +1,20 @@
+#ifndef BENCH_HOST_H
+#define BENCH_HOST_H
+
+#include "avisynth.h"
+
+//////////////////////////////////////////////////////////////////////////////
+// Minimal in-process stand-in for the AviSynth+ core
+//
+// Implements just enough of IScriptEnvironment, VideoFrame, PClip and
+// AVSValue to load the plugin through AvisynthPluginInit3 and run its
+// filters with env->Invoke, without an AviSynth+ installation.
+//////////////////////////////////////////////////////////////////////////////
+
+// Create an environment that reports the given CPU flags to the plugin
+IScriptEnvironment* CreateBenchEnvironment(int cpuflags);
+
+// Linkage table to hand to AvisynthPluginInit3
+const AVS_Linkage* GetBenchLinkage();
+
+#endif // BENCH_HOST_H
@@ -0,0 +1,469 @@
+//////////////////////////////////////////////////////////////////////////////
+// Microbenchmark of the per pixel median engines
+//
+// Times every way of taking the median of a stack of depth values, for every
+// depth from 3 to 25, 8 and 16-bit values, on input that stays in cache and
+// on input that streams from memory. The result is ns/pixel as JSON, with
+// the fastest engine of every case, to decide which engine the filter should
+// use for which depth.
+//
+//   opt_med      Hand made networks of opt_med.h, 8-bit at depths 3-9 and 25
+//   sort         std::sort and average, the full path of ProcessPixel
+//   nth_element  std::nth_element for the lower middle value
+//   network      Batcher odd-even merge network, pruned to the middle
+//                values, on the values of one pixel
+//   rows_*       The same network run over a tile of pixels at once, with
+//                one pixel per vector lane
+//
+// Usage: median_kernels [--ms N] [--output FILE]
+//
+//   --ms N        Time spent on every case (default 20)
+//   --output FILE Write the JSON there instead of to stdout
+//////////////////////////////////////////////////////////////////////////////
+
+#include "network.h"
+#include "opt_med.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using std::string;
+using std::vector;
+
+const unsigned int MIN_DEPTH = 3;
+const unsigned int MAX_DEPTH = 25;
+const int ROW_TILE = 256;                   // Pixels run through the row network at once
+const int PASS_PIXELS = 2048;               // Pixels taken per pass over the input
+const size_t STREAM_BYTES = 64 << 20;       // Bytes of the input that streams from memory
+
+
+//////////////////////////////////////////////////////////////////////////////
+// One case of the benchmark: depth rows of length values, of which count
+// values at a time are taken, and the values every engine has to produce
+//////////////////////////////////////////////////////////////////////////////
+template<typename T>
+struct Stack
+{
+    unsigned int depth;
+    unsigned int low;
+    unsigned int blend;
+    int count;
+    size_t length;
+    size_t position;
+    vector<Comparator> network;
+    vector<T> data;
+    const T* rows[MAX_DEPTH];
+    vector<T> output;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Point the rows at the next count values, starting over at the end
+//////////////////////////////////////////////////////////////////////////////
+template<typename T>
+static void Advance(Stack<T>& stack)
+{
+    stack.position = stack.position + stack.count;
+
+    if (stack.position + stack.count > stack.length)
+        stack.position = 0;
+
+    for (unsigned int i = 0; i < stack.depth; i++)
+        stack.rows[i] = stack.data.data() + i * stack.length + stack.position;
+}
+
+template<typename T>
+static T Average(const T* values, unsigned int low, unsigned int blend)
+{
+    unsigned int sum = 0;
+
+    for (unsigned int i = low; i < low + blend; i++)
+        sum = sum + values[i];
+
+    return (T)(sum / blend);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Engines working on the values of one pixel at a time, gathered from the
+// rows the way ProcessRow does it
+//////////////////////////////////////////////////////////////////////////////
+template<typename T>
+static void RunOptMed(Stack<T>& stack)
+{
+    pixelvalue (*median)(pixelvalue*) = NULL;
+
+    switch (stack.depth)
+    {
+        case 3: median = opt_med3; break;
+        case 5: median = opt_med5; break;
+        case 7: median = opt_med7; break;
+        case 9: median = opt_med9; break;
+        case 25: median = opt_med25; break;
+    }
+
+    for (int x = 0; x < stack.count; x++)
+    {
+        pixelvalue values[MAX_DEPTH];
+
+        for (unsigned int i = 0; i < stack.depth; i++)
+            values[i] = (pixelvalue)stack.rows[i][x];
+
+        stack.output[x] = median(values);
+    }
+}
+
+template<typename T>
+static void RunSort(Stack<T>& stack)
+{
+    for (int x = 0; x < stack.count; x++)
+    {
+        T values[MAX_DEPTH];
+
+        for (unsigned int i = 0; i < stack.depth; i++)
+            values[i] = stack.rows[i][x];
+
+        std::sort(values, values + stack.depth);
+
+        stack.output[x] = Average(values, stack.low, stack.blend);
+    }
+}
+
+template<typename T>
+static void RunNthElement(Stack<T>& stack)
+{
+    for (int x = 0; x < stack.count; x++)
+    {
+        T values[MAX_DEPTH];
+
+        for (unsigned int i = 0; i < stack.depth; i++)
+            values[i] = stack.rows[i][x];
+
+        std::nth_element(values, values + stack.low, values + stack.depth);
+
+        // Everything above low is at least as large, the next value is the
+        // smallest of them
+        if (stack.blend == 2)
+            values[stack.low + 1] = *std::min_element(values + stack.low + 1, values + stack.depth);
+
+        stack.output[x] = Average(values, stack.low, stack.blend);
+    }
+}
+
+template<typename T>
+static void RunNetwork(Stack<T>& stack)
+{
+    const Comparator* network = stack.network.data();
+    const size_t comparators = stack.network.size();
+
+    for (int x = 0; x < stack.count; x++)
+    {
+        T values[MAX_DEPTH];
+
+        for (unsigned int i = 0; i < stack.depth; i++)
+            values[i] = stack.rows[i][x];
+
+        for (size_t c = 0; c < comparators; c++)
+        {
+            const T lower = std::min(values[network[c].a], values[network[c].b]);
+
+            values[network[c].b] = std::max(values[network[c].a], values[network[c].b]);
+            values[network[c].a] = lower;
+        }
+
+        stack.output[x] = Average(values, stack.low, stack.blend);
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Engine working on a tile of pixels at a time: the tile of every row is
+// copied out, run through the network and the middle rows are averaged
+//////////////////////////////////////////////////////////////////////////////
+template<typename T>
+static void RunRows(Stack<T>& stack, RowNetworkFunction function)
+{
+    T tile[MAX_DEPTH][ROW_TILE];
+    void* rows[MAX_DEPTH];
+
+    for (unsigned int i = 0; i < stack.depth; i++)
+        rows[i] = tile[i];
+
+    for (int x0 = 0; x0 < stack.count; x0 = x0 + ROW_TILE)
+    {
+        const int length = std::min(ROW_TILE, stack.count - x0);
+
+        for (unsigned int i = 0; i < stack.depth; i++)
+            memcpy(tile[i], stack.rows[i] + x0, length * sizeof(T));
+
+        function(rows, stack.network.data(), stack.network.size(), 0, length);
+
+        T* out = stack.output.data() + x0;
+
+        if (stack.blend == 1)
+        {
+            memcpy(out, tile[stack.low], length * sizeof(T));
+            continue;
+        }
+
+        // Row by row, so that the sums vectorize as well
+        unsigned int sum[ROW_TILE] = { 0 };
+
+        for (unsigned int r = stack.low; r < stack.low + stack.blend; r++)
+        {
+            for (int x = 0; x < length; x++)
+                sum[x] = sum[x] + tile[r][x];
+        }
+
+        for (int x = 0; x < length; x++)
+            out[x] = (T)(sum[x] / stack.blend);
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Engines available for a value type, depth and CPU
+//////////////////////////////////////////////////////////////////////////////
+enum EngineKind
+{
+    ENGINE_OPT_MED,
+    ENGINE_SORT,
+    ENGINE_NTH_ELEMENT,
+    ENGINE_NETWORK,
+    ENGINE_ROWS
+};
+
+struct Engine
+{
+    string name;
+    EngineKind kind;
+    RowNetworkFunction rows;
+};
+
+static vector<Engine> Engines(int bits, unsigned int depth)
+{
+    vector<Engine> engines;
+
+    const bool opt_med = depth == 3 || depth == 5 || depth == 7 || depth == 9 || depth == 25;
+
+    if (bits == 8 && opt_med)
+        engines.push_back(Engine { "opt_med", ENGINE_OPT_MED, NULL });
+
+    engines.push_back(Engine { "sort", ENGINE_SORT, NULL });
+    engines.push_back(Engine { "nth_element", ENGINE_NTH_ELEMENT, NULL });
+    engines.push_back(Engine { "network", ENGINE_NETWORK, NULL });
+    engines.push_back(Engine { "rows_c", ENGINE_ROWS, bits == 8 ? network_rows_8_c : network_rows_16_c });
+
+#ifdef INTEL_INTRINSICS
+    engines.push_back(Engine { "rows_sse2", ENGINE_ROWS, bits == 8 ? network_rows_8_sse2 : network_rows_16_sse2 });
+
+#if defined(__GNUC__)
+    if (__builtin_cpu_supports("avx2"))
+#endif
+        engines.push_back(Engine { "rows_avx2", ENGINE_ROWS, bits == 8 ? network_rows_8_avx2 : network_rows_16_avx2 });
+#endif
+
+    return engines;
+}
+
+template<typename T>
+static void Run(Stack<T>& stack, const Engine& engine)
+{
+    switch (engine.kind)
+    {
+        case ENGINE_OPT_MED: RunOptMed(stack); break;
+        case ENGINE_SORT: RunSort(stack); break;
+        case ENGINE_NTH_ELEMENT: RunNthElement(stack); break;
+        case ENGINE_NETWORK: RunNetwork(stack); break;
+        case ENGINE_ROWS: RunRows(stack, engine.rows); break;
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Result of one engine on one case
+//////////////////////////////////////////////////////////////////////////////
+struct Result
+{
+    unsigned int depth;
+    int bits;
+    const char* input;
+    string engine;
+    double ns;
+    bool match;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Time every engine on one case
+//
+// Every engine runs once untimed on the first pixels, its output is checked
+// against std::sort, then it runs until the time budget is used up. Input
+// longer than a pass is walked through a pass at a time, so that it comes
+// from memory rather than from the cache.
+//////////////////////////////////////////////////////////////////////////////
+template<typename T>
+static void Measure(unsigned int depth, const char* input, size_t length, double budget, vector<Result>& results)
+{
+    Stack<T> stack;
+
+    stack.depth = depth;
+    stack.low = (depth - 1) / 2;
+    stack.blend = depth - 2 * stack.low;
+    stack.count = PASS_PIXELS;
+    stack.length = length;
+    stack.data.resize(depth * length);
+    stack.output.resize(PASS_PIXELS);
+
+    SelectionNetwork(depth, stack.low, stack.blend, stack.network);
+
+    // Noise over the full range, the worst case for every engine
+    unsigned int state = depth * 2654435761u + sizeof(T);
+
+    for (size_t i = 0; i < stack.data.size(); i++)
+    {
+        state = state * 1664525u + 1013904223u;
+        stack.data[i] = (T)(state >> 16);
+    }
+
+    stack.position = length;
+    Advance(stack);
+
+    RunSort(stack);
+
+    const vector<T> reference = stack.output;
+    const vector<Engine> engines = Engines(sizeof(T) * 8, depth);
+
+    for (size_t e = 0; e < engines.size(); e++)
+    {
+        stack.position = length;
+        Advance(stack);
+
+        std::fill(stack.output.begin(), stack.output.end(), (T)0);
+        Run(stack, engines[e]);
+
+        Result result = { depth, (int)sizeof(T) * 8, input, engines[e].name, 0.0, stack.output == reference };
+
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        long passes = 0;
+        double elapsed = 0.0;
+
+        // The clock is read every few passes, a pass can be shorter than a
+        // microsecond
+        do
+        {
+            for (int i = 0; i < 16; i++)
+            {
+                Advance(stack);
+                Run(stack, engines[e]);
+            }
+
+            passes = passes + 16;
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        while (elapsed < budget);
+
+        result.ns = elapsed * 1e9 / ((double)passes * PASS_PIXELS);
+        results.push_back(result);
+
+        fprintf(stderr, "%2u %2d-bit %-6s %-12s %8.3f ns/pixel%s\n", depth, result.bits, input, result.engine.c_str(), result.ns, result.match ? "" : "  MISMATCH");
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Entry point
+//////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+    double budget = 0.020;
+    string output;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--ms") && i + 1 < argc)
+            budget = atof(argv[++i]) / 1000.0;
+        else if (!strcmp(argv[i], "--output") && i + 1 < argc)
+            output = argv[++i];
+        else
+        {
+            fprintf(stderr, "Usage: %s [--ms N] [--output FILE]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    vector<Result> results;
+
+    for (unsigned int depth = MIN_DEPTH; depth <= MAX_DEPTH; depth++)
+    {
+        Measure<uint8_t>(depth, "cache", PASS_PIXELS, budget, results);
+        Measure<uint8_t>(depth, "stream", STREAM_BYTES / depth, budget, results);
+        Measure<uint16_t>(depth, "cache", PASS_PIXELS, budget, results);
+        Measure<uint16_t>(depth, "stream", STREAM_BYTES / (2 * depth), budget, results);
+    }
+
+    FILE* out = stdout;
+
+    if (!output.empty())
+    {
+        out = fopen(output.c_str(), "w");
+
+        if (out == NULL)
+        {
+            fprintf(stderr, "Cannot write %s\n", output.c_str());
+            return 2;
+        }
+    }
+
+    bool mismatch = false;
+
+    fprintf(out, "{\n  \"budget_ms\": %.1f,\n  \"results\": [\n", budget * 1000.0);
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result& r = results[i];
+
+        fprintf(out, "    { \"depth\": %u, \"bits\": %d, \"input\": \"%s\", \"engine\": \"%s\", \"ns_per_pixel\": %.4f, \"match\": %s }%s\n",
+            r.depth, r.bits, r.input, r.engine.c_str(), r.ns, r.match ? "true" : "false", i + 1 == results.size() ? "" : ",");
+
+        mismatch = mismatch || !r.match;
+    }
+
+    // Fastest matching engine of every case, results of a case are adjacent
+    fprintf(out, "  ],\n  \"fastest\": [\n");
+
+    bool first = true;
+
+    for (size_t i = 0; i < results.size(); )
+    {
+        size_t best = results.size();
+        size_t j = i;
+
+        for (; j < results.size() && results[j].depth == results[i].depth && results[j].bits == results[i].bits && results[j].input == results[i].input; j++)
+        {
+            if (results[j].match && (best == results.size() || results[j].ns < results[best].ns))
+                best = j;
+        }
+
+        if (best < results.size())
+        {
+            fprintf(out, "%s    { \"depth\": %u, \"bits\": %d, \"input\": \"%s\", \"engine\": \"%s\", \"ns_per_pixel\": %.4f }",
+                first ? "" : ",\n", results[best].depth, results[best].bits, results[best].input, results[best].engine.c_str(), results[best].ns);
+
+            first = false;
+        }
+
+        i = j;
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout)
+        fclose(out);
+
+    return mismatch ? 1 : 0;
+}
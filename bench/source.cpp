@@ -0,0 +1,248 @@
+#include "bench.h"
+
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Formats the filters accept
+//////////////////////////////////////////////////////////////////////////////
+const Format formats[] =
+{
+    { "YV12", VideoInfo::CS_YV12 },
+    { "YV16", VideoInfo::CS_YV16 },
+    { "YV24", VideoInfo::CS_YV24 },
+    { "Y8", VideoInfo::CS_Y8 },
+    { "YUY2", VideoInfo::CS_YUY2 },
+    { "RGB24", VideoInfo::CS_BGR24 },
+    { "RGB32", VideoInfo::CS_BGR32 },
+    { "RGB64", VideoInfo::CS_BGR64 },
+    { "RGBP8", VideoInfo::CS_RGBP8 },
+    { "YUV420P10", VideoInfo::CS_YUV420P10 },
+    { "YUV420P16", VideoInfo::CS_YUV420P16 },
+    { "YUV444P16", VideoInfo::CS_YUV444P16 },
+    { "Y16", VideoInfo::CS_Y16 },
+    { "RGBP16", VideoInfo::CS_RGBP16 },
+    { "YUV420PS", VideoInfo::CS_YUV420PS },
+    { "YUV444PS", VideoInfo::CS_YUV444PS },
+    { "Y32", VideoInfo::CS_Y32 },
+};
+
+const size_t format_count = sizeof(formats) / sizeof(formats[0]);
+
+const Format* FindFormat(const std::string& name)
+{
+    for (size_t f = 0; f < format_count; f++)
+    {
+        if (name == formats[f].name)
+            return &formats[f];
+    }
+
+    return NULL;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Synthetic source clip
+//////////////////////////////////////////////////////////////////////////////
+SyntheticClip::SyntheticClip(const Format* format, int width, int height, int count, unsigned int seed, bool oddpitch, IScriptEnvironment* env, bool sparse)
+{
+    memset(&vi, 0, sizeof(vi));
+
+    vi.width = width;
+    vi.height = height;
+    vi.fps_numerator = 25;
+    vi.fps_denominator = 1;
+    vi.num_frames = count;
+    vi.pixel_type = format->pixel_type;
+
+    for (int n = 0; n < SOURCE_FRAMES; n++)
+        frames.push_back(Render(n, seed, oddpitch, sparse, env));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// New frame, cut out of a wider one with an odd number of samples per row
+// when asked for
+//////////////////////////////////////////////////////////////////////////////
+PVideoFrame SyntheticClip::Allocate(bool oddpitch, IScriptEnvironment* env)
+{
+    if (!oddpitch)
+        return env->NewVideoFrame(vi);
+
+    VideoInfo wide = vi;
+    wide.width = vi.width + 64;
+
+    PVideoFrame frame = env->NewVideoFrame(wide);
+
+    const int size = vi.ComponentSize();
+    const int rowsize = vi.RowSize(PLANAR_Y);
+    const int pitch = (rowsize / size + (rowsize / size % 2 == 0 ? 1 : 2)) * size;
+
+    if (!vi.IsPlanar() || vi.IsY())
+        return env->Subframe(frame, 0, pitch, rowsize, vi.height);
+
+    const int rowsizeUV = vi.RowSize(PLANAR_U);
+    const int pitchUV = (rowsizeUV / size + (rowsizeUV / size % 2 == 0 ? 1 : 2)) * size;
+
+    return env->SubframePlanar(frame, 0, pitch, rowsize, vi.height, 0, 0, pitchUV);
+}
+
+PVideoFrame SyntheticClip::Render(int n, unsigned int seed, bool oddpitch, bool sparse, IScriptEnvironment* env)
+{
+    PVideoFrame frame = Allocate(oddpitch, env);
+
+    const int planes[3] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+    const int count = vi.IsPlanar() && !vi.IsY() ? 3 : 1;
+    const int size = vi.ComponentSize();
+    const int bits = vi.BitsPerComponent();
+
+    unsigned int state = seed * 7919u + n * 104729u + 1;
+    unsigned int shared = n * 104729u + 1;
+
+    for (int p = 0; p < count; p++)
+    {
+        unsigned char* ptr = frame->GetWritePtr(planes[p]);
+
+        const int pitch = frame->GetPitch(planes[p]);
+        const int width = frame->GetRowSize(planes[p]) / size;
+        const int height = frame->GetHeight(planes[p]);
+
+        // Columns where a sparse clip has noise of its own
+        const int band = (int)(seed * 37 % width);
+
+        for (int y = 0; y < height; y++)
+        {
+            unsigned char* row = ptr + y * pitch;
+
+            for (int x = 0; x < width; x++)
+            {
+                state = state * 1664525u + 1013904223u;
+                shared = shared * 1664525u + 1013904223u;
+
+                const unsigned int noise = sparse && (x < band || x >= band + 9) ? shared : state;
+
+                int value = (int)(32768 + 24000 * sin(x * 0.031 + y * 0.017 + n * 0.5 + p) + 6000 * sin(x * 0.17 - n));
+
+                // Noise on every sample, a dropout on one in 64
+                if (((noise >> 8) & 63) == 0)
+                    value = (noise >> 8) & 0xffff;
+                else
+                    value = value + (int)((noise >> 24) & 0x3ff) - 512;
+
+                value = value < 0 ? 0 : value > 0xffff ? 0xffff : value;
+
+                if (size == 1)
+                    row[x] = (unsigned char)(value >> 8);
+                else if (size == 2)
+                    ((uint16_t*)row)[x] = (uint16_t)(value >> (16 - bits));
+                else
+                    ((float*)row)[x] = value / 65535.0f;
+            }
+        }
+    }
+
+    return frame;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Synthetic validity masks
+//////////////////////////////////////////////////////////////////////////////
+MaskClip::MaskClip(const Format* format, int width, int height, int count, int depth, int dropout, bool scatter, IScriptEnvironment* env)
+{
+    memset(&vi, 0, sizeof(vi));
+
+    vi.width = width;
+    vi.height = height;
+    vi.fps_numerator = 25 * depth;
+    vi.fps_denominator = 1;
+    vi.num_frames = count * depth;
+    vi.pixel_type = format->pixel_type;
+
+    for (int i = 0; i < depth; i++)
+        frames.push_back(Render(i, dropout, scatter, env));
+}
+
+PVideoFrame MaskClip::Render(int clip, int dropout, bool scatter, IScriptEnvironment* env)
+{
+    PVideoFrame frame = env->NewVideoFrame(vi);
+
+    const int planes[3] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+    const int count = vi.IsPlanar() && !vi.IsY() ? 3 : 1;
+    const int size = vi.ComponentSize();
+
+    unsigned int state = clip * 7919u + 1;
+
+    for (int p = 0; p < count; p++)
+    {
+        unsigned char* ptr = frame->GetWritePtr(planes[p]);
+
+        const int pitch = frame->GetPitch(planes[p]);
+        const int width = frame->GetRowSize(planes[p]) / size;
+        const int height = frame->GetHeight(planes[p]);
+
+        // Rows the clip loses, at least one when there is a dropout
+        const int band = (height * dropout + 99) / 100;
+        const int start = (int)(clip * 37u % height);
+
+        for (int y = 0; y < height; y++)
+        {
+            unsigned char* row = ptr + y * pitch;
+
+            const bool dropped = (y - start + height) % height < band;
+
+            for (int x = 0; x < width; x++)
+            {
+                state = state * 1664525u + 1013904223u;
+
+                bool valid = !dropped;
+
+                if (scatter && (((state >> 16) & 3) == 0 || (x >= width / 3 && x < width / 3 + 3)))
+                    valid = false;
+
+                if (size == 1)
+                    row[x] = valid ? 0xff : 0;
+                else if (size == 2)
+                    ((uint16_t*)row)[x] = valid ? (x & 1 ? 0x0100 : 0x0001) : 0;
+                else
+                    ((float*)row)[x] = valid ? 1.0f : 0.0f;
+            }
+        }
+    }
+
+    return frame;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// CPU flags reported to the plugin
+//////////////////////////////////////////////////////////////////////////////
+int CpuFlags(const std::string& isa)
+{
+    const int sse2 = CPUF_MMX | CPUF_INTEGER_SSE | CPUF_SSE | CPUF_SSE2;
+    const int avx2 = sse2 | CPUF_SSE3 | CPUF_SSSE3 | CPUF_SSE4_1 | CPUF_SSE4_2 | CPUF_AVX | CPUF_AVX2;
+
+    if (isa == "c")
+        return 0;
+
+    if (isa == "sse2")
+        return sse2;
+
+    if (isa == "avx2")
+        return avx2;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    if (__builtin_cpu_supports("avx2"))
+        return avx2;
+
+    if (__builtin_cpu_supports("sse2"))
+        return sse2;
+
+    return 0;
+#elif defined(_M_X64) || defined(_M_IX86)
+    return sse2;
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,896 @@
+//////////////////////////////////////////////////////////////////////////////
+// Differential test of the Median filters
+//
+// Runs the filters on synthetic clips and compares every output sample bit
+// for bit with a plain reference: the values of all clips are sorted and
+// the ones between low and high averaged, the way ProcessPixel and
+// ProcessPixel_16bit do it. Every format, every depth from 3 to 25, every
+// low/high combination, awkward widths, odd pitches and clips passed more
+// than once are covered, with the plugin seeing every instruction set the
+// CPU supports in turn. SpatialMedian, and TemporalMedian with a spatial
+// radius, are checked against the middle value of the window around every
+// sample, gathered one at a time. Clips with weights are checked as if every
+// clip was passed as many times as its weight, also read in fields and
+// shifted, clips with masks with the values masked out left out of the sort.
+//
+// Usage: median_bench --verify [--formats LIST] [--quick]
+//
+//   --formats LIST    Formats to check, comma separated (default all)
+//   --quick           Only the median and the widest blend of every depth
+//
+// Exits with 1 when any output differs from the reference.
+//////////////////////////////////////////////////////////////////////////////
+
+#include "avisynth.h"
+#include "host.h"
+#include "bench.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+using std::string;
+using std::vector;
+
+extern "C" const char* __stdcall AvisynthPluginInit3(IScriptEnvironment* env, AVS_Linkage* vectors);
+
+const int VERIFY_DEPTH = 25;
+const int VERIFY_HEIGHT = 4;
+const int VERIFY_FRAME = 3;
+const int BLEND_WIDTH = 38;     // Width the low/high sweep runs at
+const int SPARSE_WIDTH = 300;   // Width of the clips that mostly agree
+const int SPATIAL_HEIGHT = 11;  // Height of the SpatialMedian clips
+
+// Widths tried with every depth, those that do not fit the chroma
+// subsampling of a format are left out
+static const int edge_widths[] = { 1, 2, 3, 4, 5, 15, 16, 17, 31, 33, 63, 64, 66 };
+
+// SpatialMedian radii, networks and histograms, windows past the frame
+static const unsigned int spatial_radii[] = { 1, 2, 3, 7, 15 };
+
+// TemporalMedian radius and spatial radius, with sorted columns and
+// without, up to the largest window
+static const unsigned int volume_radii[][2] = { { 1, 1 }, { 1, 2 }, { 4, 2 }, { 12, 1 } };
+
+// Heaviest clip of the weight patterns, the sum of the weights needs to
+// stay within VERIFY_DEPTH
+const unsigned int VERIFY_WEIGHT = 5;
+
+// Shift range of the shift cases
+const int VERIFY_SHIFT = 4;
+
+//////////////////////////////////////////////////////////////////////////////
+// One filter call and what the output is checked against
+//////////////////////////////////////////////////////////////////////////////
+struct Case
+{
+    const char* filter;     // Median, MedianBlend, TemporalMedian or SpatialMedian
+    unsigned int depth;
+    unsigned int low;
+    unsigned int high;
+    bool chroma;
+    unsigned int spatial;   // Spatial radius of TemporalMedian
+    const unsigned int* weights;    // Of every clip, NULL for none
+    IClip* masks;                   // Interleaved masks of the clips, NULL for none
+    const char* mode;               // "fields" or "shift" with a sync radius, NULL for none
+};
+
+struct Totals
+{
+    unsigned long cases;
+    unsigned long failures;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Reference for the values of one sample position. Nothing is sorted when
+// every value is blended, which matters for the order of float sums.
+//////////////////////////////////////////////////////////////////////////////
+template<typename T, typename S>
+static T Reference(T* values, unsigned int depth, unsigned int low, unsigned int blend)
+{
+    if (blend != depth)
+        std::sort(values, values + depth);
+
+    S sum = 0;
+
+    for (unsigned int i = low; i < low + blend; i++)
+        sum = sum + values[i];
+
+    return (T)(sum / blend);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Samples that come from the first clip with chroma=false
+//////////////////////////////////////////////////////////////////////////////
+static bool Passthrough(const VideoInfo& vi, int plane, int sample)
+{
+    if (vi.IsPlanar())
+        return plane != PLANAR_Y;
+
+    if (vi.IsYUY2())
+        return sample % 2 == 1;
+
+    if (vi.IsRGB32() || vi.IsRGB64())
+        return sample % 4 == 3;
+
+    return false;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// First sample of a row that differs from the reference, -1 if none
+//////////////////////////////////////////////////////////////////////////////
+template<typename T, typename S>
+static int CompareSamples(const Case& c, const VideoInfo& vi, int plane, const unsigned char* const* src, const unsigned char* const* masks, const unsigned char* dst, int samples, double& expected, double& got)
+{
+    for (int x = 0; x < samples; x++)
+    {
+        T values[VERIFY_DEPTH];
+        T output;
+
+        unsigned int count = 0;
+
+        // Values masked out are left out, unless all of them are
+        for (unsigned int i = 0; i < c.depth; i++)
+        {
+            T mask = 1;
+
+            if (masks != NULL)
+                memcpy(&mask, masks[i] + x * sizeof(T), sizeof(T));
+
+            if (mask != 0)
+                memcpy(&values[count++], src[i] + x * sizeof(T), sizeof(T));
+        }
+
+        for (unsigned int i = 0; i < c.depth && count == 0; i++)
+            memcpy(&values[i], src[i] + x * sizeof(T), sizeof(T));
+
+        if (count == 0)
+            count = c.depth;
+
+        // low and high in proportion to the values left
+        const unsigned int low = c.low * count / c.depth;
+        const unsigned int high = c.high * count / c.depth;
+
+        memcpy(&output, dst + x * sizeof(T), sizeof(T));
+
+        T reference;
+        memcpy(&reference, src[0] + x * sizeof(T), sizeof(T));
+
+        if (c.chroma || !Passthrough(vi, plane, x))
+            reference = Reference<T, S>(values, count, low, count - low - high);
+
+        if (memcmp(&reference, &output, sizeof(T)) != 0)
+        {
+            expected = reference;
+            got = output;
+
+            return x;
+        }
+    }
+
+    return -1;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Compare the output frame with the reference taken from the source frames,
+// describes the first difference
+//////////////////////////////////////////////////////////////////////////////
+static bool CompareFrame(const Case& c, const VideoInfo& vi, PVideoFrame src[VERIFY_DEPTH], const PVideoFrame& dst, string& detail, const PVideoFrame* mask = NULL)
+{
+    const int planes[3] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+    const char names[3] = { 'Y', 'U', 'V' };
+    const int count = vi.IsPlanar() && !vi.IsY() ? 3 : 1;
+    const int size = vi.ComponentSize();
+
+    for (int p = 0; p < count; p++)
+    {
+        const int height = dst->GetHeight(planes[p]);
+        const int samples = dst->GetRowSize(planes[p]) / size;
+
+        for (int y = 0; y < height; y++)
+        {
+            const unsigned char* rows[VERIFY_DEPTH];
+            const unsigned char* masks[VERIFY_DEPTH];
+
+            for (unsigned int i = 0; i < c.depth; i++)
+                rows[i] = src[i]->GetReadPtr(planes[p]) + y * src[i]->GetPitch(planes[p]);
+
+            for (unsigned int i = 0; i < c.depth && mask != NULL; i++)
+                masks[i] = mask[i]->GetReadPtr(planes[p]) + y * mask[i]->GetPitch(planes[p]);
+
+            const unsigned char* out = dst->GetReadPtr(planes[p]) + y * dst->GetPitch(planes[p]);
+
+            double expected = 0;
+            double got = 0;
+            int x;
+
+            const unsigned char* const* maskrows = mask != NULL ? masks : NULL;
+
+            if (size == 1)
+                x = CompareSamples<uint8_t, unsigned int>(c, vi, planes[p], rows, maskrows, out, samples, expected, got);
+            else if (size == 2)
+                x = CompareSamples<uint16_t, unsigned int>(c, vi, planes[p], rows, maskrows, out, samples, expected, got);
+            else
+                x = CompareSamples<float, float>(c, vi, planes[p], rows, maskrows, out, samples, expected, got);
+
+            if (x >= 0)
+            {
+                char buffer[128];
+                snprintf(buffer, sizeof(buffer), "plane %c, sample %d of row %d is %.9g instead of %.9g", names[p], x, y, got, expected);
+                detail = buffer;
+
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// SpatialMedian of a frame the plain way: the window around every sample
+// gathered one value at a time, from pixels of the same component, and the
+// middle one picked. Samples from outside the frame repeat the edge. With
+// more frames the window of every frame is taken, as TemporalMedian does
+// with a spatial radius, and samples left alone come from the middle one.
+//////////////////////////////////////////////////////////////////////////////
+template<typename T>
+static void SpatialRow(const VideoInfo& vi, int plane, const vector<PVideoFrame>& src, int y, T* dst, int radius, bool chroma)
+{
+    const int height = src[0]->GetHeight(plane);
+    const int samples = src[0]->GetRowSize(plane) / sizeof(T);
+
+    vector<T> values;
+
+    for (int x = 0; x < samples; x++)
+    {
+        const PVideoFrame& middle = src[src.size() / 2];
+        const T* row = (const T*)(middle->GetReadPtr(plane) + y * middle->GetPitch(plane));
+
+        if (!chroma && Passthrough(vi, plane, x))
+        {
+            dst[x] = row[x];
+            continue;
+        }
+
+        int step = 1;
+
+        if (vi.IsYUY2())
+            step = x % 2 == 0 ? 2 : 4;
+        else if (vi.IsRGB24())
+            step = 3;
+        else if (!vi.IsPlanar())
+            step = 4;
+
+        values.clear();
+
+        for (size_t f = 0; f < src.size(); f++)
+        {
+            for (int dy = -radius; dy <= radius; dy++)
+            {
+                const T* window = (const T*)(src[f]->GetReadPtr(plane) + std::min(std::max(y + dy, 0), height - 1) * src[f]->GetPitch(plane));
+
+                for (int dx = -radius; dx <= radius; dx++)
+                {
+                    const int pixel = std::min(std::max(x / step + dx, 0), samples / step - 1);
+
+                    values.push_back(window[pixel * step + x % step]);
+                }
+            }
+        }
+
+        std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+
+        dst[x] = values[values.size() / 2];
+    }
+}
+
+static PVideoFrame SpatialReference(IScriptEnvironment* env, const VideoInfo& vi, const vector<PVideoFrame>& src, int radius, bool chroma)
+{
+    const int planes[3] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+    const int count = vi.IsPlanar() && !vi.IsY() ? 3 : 1;
+    const int size = vi.ComponentSize();
+
+    PVideoFrame dst = env->NewVideoFrame(vi);
+
+    for (int p = 0; p < count; p++)
+    {
+        for (int y = 0; y < src[0]->GetHeight(planes[p]); y++)
+        {
+            unsigned char* out = dst->GetWritePtr(planes[p]) + y * dst->GetPitch(planes[p]);
+
+            if (size == 1)
+                SpatialRow(vi, planes[p], src, y, (uint8_t*)out, radius, chroma);
+            else if (size == 2)
+                SpatialRow(vi, planes[p], src, y, (uint16_t*)out, radius, chroma);
+            else
+                SpatialRow(vi, planes[p], src, y, (float*)out, radius, chroma);
+        }
+    }
+
+    return dst;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Invoke the filter of a case and fetch the frame that is checked, with
+// the weights passed as text
+//////////////////////////////////////////////////////////////////////////////
+static PVideoFrame Invoke(IScriptEnvironment* env, const vector<PClip>& clips, const Case& c, const string& weights)
+{
+    const bool temporal = !strcmp(c.filter, "TemporalMedian");
+    const bool spatial = !strcmp(c.filter, "SpatialMedian");
+
+    vector<AVSValue> args;
+    vector<const char*> names;
+
+    for (unsigned int i = 0; i < (temporal || spatial ? 1 : c.depth); i++)
+    {
+        args.push_back(clips[i]);
+        names.push_back(NULL);
+    }
+
+    if (temporal || spatial)
+    {
+        args.push_back((int)c.low);
+        names.push_back("radius");
+    }
+
+    if (c.spatial > 0)
+    {
+        args.push_back((int)c.spatial);
+        names.push_back("spatial");
+    }
+    else if (!strcmp(c.filter, "MedianBlend"))
+    {
+        args.push_back((int)c.low);
+        names.push_back("low");
+        args.push_back((int)c.high);
+        names.push_back("high");
+    }
+
+    args.push_back(c.chroma);
+    names.push_back("chroma");
+
+    if (c.weights != NULL)
+    {
+        args.push_back(weights.c_str());
+        names.push_back("weights");
+    }
+
+    if (c.masks != NULL)
+    {
+        args.push_back(c.masks);
+        names.push_back("masks");
+    }
+
+    if (c.mode != NULL)
+    {
+        args.push_back(1);
+        names.push_back("sync");
+        args.push_back(!strcmp(c.mode, "fields") ? AVSValue(true) : AVSValue(VERIFY_SHIFT));
+        names.push_back(c.mode);
+    }
+
+    PClip filter = env->Invoke(c.filter, AVSValue(args.data(), (int)args.size()), names.data()).AsClip();
+    return filter->GetFrame(VERIFY_FRAME, env);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Run one case on the first depth clips, or on the first clip alone for
+// TemporalMedian and SpatialMedian
+//////////////////////////////////////////////////////////////////////////////
+static void RunCase(IScriptEnvironment* env, const char* isa, const vector<PClip>& clips, const Case& c, const char* setup, Totals& totals)
+{
+    const bool temporal = !strcmp(c.filter, "TemporalMedian");
+    const bool spatial = !strcmp(c.filter, "SpatialMedian");
+
+    string weights;
+
+    for (unsigned int i = 0; i < c.depth && c.weights != NULL; i++)
+    {
+        char weight[16];
+        snprintf(weight, sizeof(weight), i == 0 ? "%u" : ",%u", c.weights[i]);
+        weights = weights + weight;
+    }
+
+    const VideoInfo& vi = clips[0]->GetVideoInfo();
+
+    string detail;
+
+    try
+    {
+        PVideoFrame dst = Invoke(env, clips, c, weights);
+
+        PVideoFrame src[VERIFY_DEPTH];
+
+        if (spatial || c.spatial > 0)
+        {
+            // Compared as the median of the reference frame alone
+            const Case reference = { c.filter, 1, 0, 0, true };
+
+            vector<PVideoFrame> frames;
+
+            if (spatial)
+                frames.push_back(clips[0]->GetFrame(VERIFY_FRAME, env));
+            else
+            {
+                for (unsigned int i = 0; i < c.depth; i++)
+                    frames.push_back(clips[0]->GetFrame(VERIFY_FRAME - (int)c.low + (int)i, env));
+            }
+
+            src[0] = SpatialReference(env, vi, frames, spatial ? c.low : c.spatial, c.chroma);
+            CompareFrame(reference, vi, src, dst, detail);
+        }
+        else if (c.weights != NULL && c.mode != NULL)
+        {
+            // Sync picks the fields and shifts of every clip, so compared as
+            // the filter run on every clip passed as many times as its weight
+            vector<PClip> repeated;
+
+            for (unsigned int i = 0; i < c.depth; i++)
+            {
+                for (unsigned int k = 0; k < c.weights[i]; k++)
+                    repeated.push_back(clips[i]);
+            }
+
+            Case plain = c;
+            plain.depth = (unsigned int)repeated.size();
+            plain.weights = NULL;
+
+            const Case reference = { c.filter, 1, 0, 0, true };
+            src[0] = Invoke(env, repeated, plain, string());
+            CompareFrame(reference, vi, src, dst, detail);
+        }
+        else if (c.weights != NULL)
+        {
+            // Compared as every clip passed as many times as its weight
+            unsigned int total = 0;
+
+            for (unsigned int i = 0; i < c.depth; i++)
+            {
+                for (unsigned int k = 0; k < c.weights[i]; k++)
+                    src[total++] = clips[i]->GetFrame(VERIFY_FRAME, env);
+            }
+
+            const Case expanded = { c.filter, total, c.low, c.high, c.chroma };
+            CompareFrame(expanded, vi, src, dst, detail);
+        }
+        else if (c.masks != NULL)
+        {
+            PVideoFrame mask[VERIFY_DEPTH];
+
+            for (unsigned int i = 0; i < c.depth; i++)
+            {
+                src[i] = clips[i]->GetFrame(VERIFY_FRAME, env);
+                mask[i] = c.masks->GetFrame(VERIFY_FRAME * c.depth + i, env);
+            }
+
+            CompareFrame(c, vi, src, dst, detail, mask);
+        }
+        else
+        {
+            for (unsigned int i = 0; i < c.depth; i++)
+                src[i] = temporal ? clips[0]->GetFrame(VERIFY_FRAME - (int)c.low + (int)i, env) : clips[i]->GetFrame(VERIFY_FRAME, env);
+
+            CompareFrame(c, vi, src, dst, detail);
+        }
+    }
+    catch (const AvisynthError& e)
+    {
+        detail = e.msg;
+    }
+
+    totals.cases++;
+
+    if (detail.empty())
+        return;
+
+    totals.failures++;
+
+    // Enough to see the pattern without flooding the output
+    if (totals.failures <= 50)
+    {
+        fprintf(stderr, "FAIL %s %s, %d wide, %s depth %u low %u high %u spatial %u%s%s%s%s%s%s: %s\n", isa, setup, vi.width, c.filter, c.depth, c.low, c.high,
+            c.spatial, c.chroma ? "" : " chroma=false", c.weights != NULL ? " weights=" : "", weights.c_str(), c.masks != NULL ? " masks" : "",
+            c.mode != NULL ? " " : "", c.mode != NULL ? c.mode : "", detail.c_str());
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Clips of one format, width and pitch
+//////////////////////////////////////////////////////////////////////////////
+static vector<PClip> MakeClips(const Format* format, int width, bool oddpitch, IScriptEnvironment* env, bool sparse = false)
+{
+    vector<PClip> clips;
+
+    for (int i = 0; i < VERIFY_DEPTH; i++)
+        clips.push_back(new SyntheticClip(format, width, VERIFY_HEIGHT, 2 * SOURCE_FRAMES, i + 1, oddpitch, env, sparse));
+
+    return clips;
+}
+
+static int ComponentSize(const Format* format)
+{
+    VideoInfo vi;
+
+    memset(&vi, 0, sizeof(vi));
+    vi.pixel_type = format->pixel_type;
+
+    return vi.ComponentSize();
+}
+
+static int WidthMultiple(const Format* format)
+{
+    VideoInfo vi;
+
+    memset(&vi, 0, sizeof(vi));
+    vi.pixel_type = format->pixel_type;
+
+    if (vi.IsYUY2())
+        return 2;
+
+    if (vi.IsPlanar() && vi.IsYUV() && !vi.IsY())
+        return 1 << vi.GetPlaneWidthSubsampling(PLANAR_U);
+
+    return 1;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Every case of one format, with the plugin seeing one instruction set
+//////////////////////////////////////////////////////////////////////////////
+static void VerifyFormat(IScriptEnvironment* env, const char* isa, const Format* format, bool quick, Totals& totals)
+{
+    char setup[64];
+
+    // Every depth and low/high combination, odd pitch
+    {
+        const vector<PClip> clips = MakeClips(format, BLEND_WIDTH, true, env);
+
+        snprintf(setup, sizeof(setup), "%s odd pitch", format->name);
+
+        for (unsigned int depth = 3; depth <= (unsigned int)VERIFY_DEPTH; depth++)
+        {
+            for (unsigned int low = 0; low < depth; low++)
+            {
+                for (unsigned int high = 0; low + high < depth; high++)
+                {
+                    if (quick && !(low == high && (low == (depth - 1) / 2 || low == 0)))
+                        continue;
+
+                    const Case c = { "MedianBlend", depth, low, high, true };
+                    RunCase(env, isa, clips, c, setup, totals);
+                }
+            }
+
+            if (depth % 2 == 1)
+            {
+                const Case median = { "Median", depth, (depth - 1) / 2, (depth - 1) / 2, true };
+                const Case temporal = { "TemporalMedian", depth, (depth - 1) / 2, (depth - 1) / 2, true };
+                const Case luma = { "Median", depth, (depth - 1) / 2, (depth - 1) / 2, false };
+
+                RunCase(env, isa, clips, median, setup, totals);
+                RunCase(env, isa, clips, temporal, setup, totals);
+                RunCase(env, isa, clips, luma, setup, totals);
+            }
+        }
+    }
+
+    // Clips passed more than once: in pairs, which merges them into a
+    // weighted stack, and the first one over half the time, which makes
+    // it the output
+    {
+        const vector<PClip> clips = MakeClips(format, BLEND_WIDTH, false, env);
+
+        for (int pattern = 0; pattern < 2; pattern++)
+        {
+            snprintf(setup, sizeof(setup), "%s %s", format->name, pattern == 0 ? "pairs" : "majority");
+
+            for (unsigned int depth = 3; depth <= (unsigned int)VERIFY_DEPTH; depth++)
+            {
+                vector<PClip> repeated;
+
+                for (unsigned int i = 0; i < depth; i++)
+                    repeated.push_back(clips[pattern == 0 ? i / 2 : i <= depth / 2 ? 0 : i]);
+
+                for (unsigned int low = 0; low < depth; low++)
+                {
+                    for (unsigned int high = 0; low + high < depth; high++)
+                    {
+                        if (quick && !(low == high && (low == (depth - 1) / 2 || low == 0)))
+                            continue;
+
+                        const Case c = { "MedianBlend", depth, low, high, true };
+                        RunCase(env, isa, repeated, c, setup, totals);
+                    }
+                }
+
+                if (depth % 2 == 1)
+                {
+                    const Case luma = { "Median", depth, (depth - 1) / 2, (depth - 1) / 2, false };
+                    RunCase(env, isa, repeated, luma, setup, totals);
+                }
+            }
+        }
+    }
+
+    // Clips with weights: a single heavy clip, and weights that cycle, on
+    // distinct clips and on clips passed in pairs, which adds up the weights
+    // of a merged stack. Floats do not take weights.
+    if (ComponentSize(format) != 4)
+    {
+        const vector<PClip> clips = MakeClips(format, BLEND_WIDTH, true, env);
+
+        for (int pattern = 0; pattern < 4; pattern++)
+        {
+            snprintf(setup, sizeof(setup), "%s %s weights%s", format->name, pattern % 2 == 0 ? "heavy" : "cycling", pattern < 2 ? "" : " pairs");
+
+            for (unsigned int depth = 3; depth <= (unsigned int)VERIFY_DEPTH; depth++)
+            {
+                unsigned int weights[VERIFY_DEPTH];
+                unsigned int total = 0;
+                vector<PClip> repeated;
+
+                for (unsigned int i = 0; i < depth; i++)
+                {
+                    weights[i] = pattern % 2 == 0 ? (i == 1 ? VERIFY_WEIGHT : 1) : 1 + i % 3;
+                    total = total + weights[i];
+                    repeated.push_back(clips[pattern < 2 ? i : i / 2]);
+                }
+
+                if (total > (unsigned int)VERIFY_DEPTH)
+                    break;
+
+                for (unsigned int low = 0; low < total; low++)
+                {
+                    for (unsigned int high = 0; low + high < total; high++)
+                    {
+                        if ((quick || (high != low && high != 0)) && !(low == high && (low == (total - 1) / 2 || low == 0)))
+                            continue;
+
+                        const Case c = { "MedianBlend", depth, low, high, true, 0, weights };
+                        RunCase(env, isa, repeated, c, setup, totals);
+                    }
+                }
+
+                if (depth % 2 == 1)
+                {
+                    for (int chroma = 0; chroma < 2; chroma++)
+                    {
+                        const Case c = { "Median", depth, (total - 1) / 2, (total - 1) / 2, chroma == 1, 0, weights };
+                        RunCase(env, isa, repeated, c, setup, totals);
+                    }
+                }
+
+                // A heavy clip read in fields or shifted is not the output
+                // on its own, even when it outweighs the others
+                for (int mode = 0; mode < 2 && pattern == 0 && depth == 3; mode++)
+                {
+                    const Case c = { "Median", depth, (total - 1) / 2, (total - 1) / 2, true, 0, weights, NULL, mode == 0 ? "fields" : "shift" };
+                    RunCase(env, isa, repeated, c, setup, totals);
+                }
+            }
+        }
+    }
+
+    // Clips with masks: scattered samples, rows and a few columns masked out
+    // in every clip, and wide clips with a band of rows masked out in every
+    // clip, so that tiles with nothing masked out sit next to masked ones.
+    // Floats do not take masks.
+    for (int pattern = 0; pattern < 2 && ComponentSize(format) != 4; pattern++)
+    {
+        const bool scatter = pattern == 0;
+        const int width = scatter ? BLEND_WIDTH : SPARSE_WIDTH;
+        const vector<PClip> clips = MakeClips(format, width, true, env);
+
+        snprintf(setup, sizeof(setup), "%s %s masks", format->name, scatter ? "scattered" : "band");
+
+        for (unsigned int depth = 3; depth <= (unsigned int)VERIFY_DEPTH; depth++)
+        {
+            IClip* masks = new MaskClip(format, width, VERIFY_HEIGHT, 2 * SOURCE_FRAMES, depth, 25, scatter, env);
+            const PClip owner = masks;
+
+            for (unsigned int low = 0; low < depth; low++)
+            {
+                for (unsigned int high = 0; low + high < depth; high++)
+                {
+                    if ((quick || !scatter || (high != low && high != 0)) && !(low == high && (low == (depth - 1) / 2 || low == 0)))
+                        continue;
+
+                    const Case c = { "MedianBlend", depth, low, high, true, 0, NULL, masks };
+                    RunCase(env, isa, clips, c, setup, totals);
+                }
+            }
+
+            if (depth % 2 == 1)
+            {
+                for (int chroma = 0; chroma < 2; chroma++)
+                {
+                    const Case c = { "Median", depth, (depth - 1) / 2, (depth - 1) / 2, chroma == 1, 0, NULL, masks };
+                    RunCase(env, isa, clips, c, setup, totals);
+                }
+            }
+        }
+    }
+
+    // Clips that agree outside a few columns, wide enough for several
+    // tiles a row, so that agreeing tiles are copied next to processed ones
+    {
+        const vector<PClip> clips = MakeClips(format, SPARSE_WIDTH, true, env, true);
+
+        snprintf(setup, sizeof(setup), "%s sparse", format->name);
+
+        for (unsigned int depth = 3; depth <= (unsigned int)VERIFY_DEPTH; depth++)
+        {
+            for (unsigned int low = 0; low + low < depth; low++)
+            {
+                if (quick && low != 0 && low != (depth - 1) / 2)
+                    continue;
+
+                const Case c = { "MedianBlend", depth, low, low, true };
+                RunCase(env, isa, clips, c, setup, totals);
+            }
+
+            if (depth % 2 == 1)
+            {
+                const Case luma = { "Median", depth, (depth - 1) / 2, (depth - 1) / 2, false };
+                RunCase(env, isa, clips, luma, setup, totals);
+            }
+        }
+    }
+
+    // Every width and both pitches with the median of every depth
+    for (size_t w = 0; w < sizeof(edge_widths) / sizeof(edge_widths[0]); w++)
+    {
+        if (edge_widths[w] % WidthMultiple(format) != 0)
+            continue;
+
+        for (int odd = 0; odd < 2; odd++)
+        {
+            const vector<PClip> clips = MakeClips(format, edge_widths[w], odd == 1, env);
+
+            snprintf(setup, sizeof(setup), "%s%s", format->name, odd ? " odd pitch" : "");
+
+            for (unsigned int depth = 3; depth <= (unsigned int)VERIFY_DEPTH; depth = depth + 2)
+            {
+                const Case median = { "Median", depth, (depth - 1) / 2, (depth - 1) / 2, true };
+                RunCase(env, isa, clips, median, setup, totals);
+            }
+        }
+    }
+
+    // SpatialMedian and TemporalMedian over space and time at every width,
+    // wider than a tile, both pitches
+    vector<int> widths(edge_widths, edge_widths + sizeof(edge_widths) / sizeof(edge_widths[0]));
+    widths.push_back(SPARSE_WIDTH);
+
+    for (size_t w = 0; w < widths.size(); w++)
+    {
+        if (widths[w] % WidthMultiple(format) != 0)
+            continue;
+
+        for (int odd = 0; odd < 2; odd++)
+        {
+            vector<PClip> clips;
+            clips.push_back(new SyntheticClip(format, widths[w], SPATIAL_HEIGHT, 2 * SOURCE_FRAMES, 1, odd == 1, env));
+
+            snprintf(setup, sizeof(setup), "%s%s", format->name, odd ? " odd pitch" : "");
+
+            for (size_t r = 0; r < sizeof(spatial_radii) / sizeof(spatial_radii[0]); r++)
+            {
+                const unsigned int radius = spatial_radii[r];
+                const unsigned int window = (2 * radius + 1) * (2 * radius + 1);
+
+                // Floats only go up to the networks
+                if (radius > 2 && ComponentSize(format) == 4)
+                    continue;
+
+                for (int chroma = 0; chroma < 2; chroma++)
+                {
+                    const Case c = { "SpatialMedian", window, radius, radius, chroma == 1 };
+                    RunCase(env, isa, clips, c, setup, totals);
+                }
+            }
+
+            for (size_t r = 0; r < sizeof(volume_radii) / sizeof(volume_radii[0]); r++)
+            {
+                const unsigned int radius = volume_radii[r][0];
+
+                for (int chroma = 0; chroma < 2; chroma++)
+                {
+                    const Case c = { "TemporalMedian", 2 * radius + 1, radius, radius, chroma == 1, volume_radii[r][1] };
+                    RunCase(env, isa, clips, c, setup, totals);
+                }
+            }
+        }
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Entry point for --verify
+//////////////////////////////////////////////////////////////////////////////
+int Verify(int argc, char** argv)
+{
+    vector<const Format*> selected;
+    bool quick = false;
+
+    for (size_t f = 0; f < format_count; f++)
+        selected.push_back(&formats[f]);
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--quick"))
+            quick = true;
+        else if (!strcmp(argv[i], "--formats") && i + 1 < argc)
+        {
+            selected.clear();
+
+            for (const char* p = argv[++i]; *p; )
+            {
+                const char* end = strchr(p, ',');
+                const string name = end ? string(p, end - p) : string(p);
+                const Format* format = FindFormat(name);
+
+                if (format == NULL)
+                {
+                    fprintf(stderr, "Unknown format %s\n", name.c_str());
+                    return 2;
+                }
+
+                selected.push_back(format);
+                p = end ? end + 1 : p + name.size();
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Usage: median_bench --verify [--formats LIST] [--quick]\n");
+            return 2;
+        }
+    }
+
+    // Plain C first, then every instruction set the CPU has
+    const int native = CpuFlags("native");
+
+    vector<const char*> isas;
+    isas.push_back("c");
+
+    if (native & CPUF_SSE2)
+        isas.push_back("sse2");
+
+    if (native & CPUF_AVX2)
+        isas.push_back("avx2");
+
+    Totals totals = { 0, 0 };
+
+    for (size_t k = 0; k < isas.size(); k++)
+    {
+        IScriptEnvironment* env = CreateBenchEnvironment(CpuFlags(isas[k]));
+
+        AvisynthPluginInit3(env, (AVS_Linkage*)GetBenchLinkage());
+
+        for (size_t f = 0; f < selected.size(); f++)
+        {
+            const unsigned long failures = totals.failures;
+
+            VerifyFormat(env, isas[k], selected[f], quick, totals);
+
+            fprintf(stderr, "%-5s %-10s %s\n", isas[k], selected[f]->name, totals.failures == failures ? "ok" : "FAILED");
+        }
+
+        env->DeleteScriptEnvironment();
+    }
+
+    printf("%lu cases, %lu failed\n", totals.cases, totals.failures);
+
+    return totals.failures == 0 ? 0 : 1;
+}
@@ -30,6 +30,55 @@
 
 const AVS_Linkage* AVS_linkage;
 
+//////////////////////////////////////////////////////////////////////////////
+// Weights of the clips from a list like "3,1,1", empty if none are given
+//////////////////////////////////////////////////////////////////////////////
+static vector<unsigned int> ParseWeights(const char* text, int n, IScriptEnvironment* env)
+{
+    vector<unsigned int> weights;
+
+    if (*text == 0)
+        return weights;
+
+    while (true)
+    {
+        char* end;
+        const long weight = strtol(text, &end, 10);
+
+        if (end == text || weight < 1 || weight > (long)MAX_WEIGHT)
+            env->ThrowError(ERROR_PREFIX "Weights need to be between 1 and %d.", MAX_WEIGHT);
+
+        weights.push_back((unsigned int)weight);
+
+        while (*end == ' ')
+            end++;
+
+        if (*end == 0)
+            break;
+
+        if (*end != ',')
+            env->ThrowError(ERROR_PREFIX "Weights need to be a comma separated list.");
+
+        text = end + 1;
+    }
+
+    if ((int)weights.size() != n)
+        env->ThrowError(ERROR_PREFIX "Weights need one value for every clip.");
+
+    return weights;
+}
+
+static unsigned int TotalWeight(const vector<unsigned int>& weights, int n)
+{
+    unsigned int total = 0;
+
+    for (size_t i = 0; i < weights.size(); i++)
+        total = total + weights[i];
+
+    return weights.empty() ? n : total;
+}
+
+
 //////////////////////////////////////////////////////////////////////////////
 // Create Median filter
 //////////////////////////////////////////////////////////////////////////////
@@ -51,6 +100,20 @@ AVSValue __cdecl Create_Median(AVSValue args, void* user_data, IScriptEnvironmen
     int sync = args[2].AsInt(0);
     int samples = args[3].AsInt(4096U);
     bool debug = args[4].AsBool(false);
+    bool align = args[5].AsBool(false);
+    bool index = args[6].AsBool(false);
+    bool fields = args[7].AsBool(false);
+    int shift = args[8].AsInt(0);
+    int jitter = args[9].AsInt(0);
+    bool audio = args[10].AsBool(false);
+    const char* stats = args[11].AsString("");
+    const char* statsfile = args[12].AsString("");
+    const char* trace = args[13].AsString("");
+    bool perf = args[14].AsBool(false);
+    int map = args[15].AsInt(0);
+    bool showmap = args[16].AsBool(false);
+    vector<unsigned int> weights = ParseWeights(args[17].AsString(""), n, env);
+    PClip masks = args[18].Defined() ? args[18].AsClip() : PClip();
 
     // Validation
     if (sync < 0)
@@ -59,10 +122,42 @@ AVSValue __cdecl Create_Median(AVSValue args, void* user_data, IScriptEnvironmen
     if (samples < 0)
         env->ThrowError(ERROR_PREFIX "Samples needs to be a positive value.");
 
-    // Set low and high so that a regular median function is achieved
-    unsigned int limit = (n - 1) / 2;
+    if (align && (sync < 1 || sync > MAX_ALIGN_RADIUS))
+        env->ThrowError(ERROR_PREFIX "Align needs a sync radius between 1 and %d.", MAX_ALIGN_RADIUS);
+
+    if (index && (sync < 1 || align))
+        env->ThrowError(ERROR_PREFIX "Index needs a sync radius and cannot be combined with align.");
+
+    if (fields && (sync < 1 || align || index))
+        env->ThrowError(ERROR_PREFIX "Fields needs a sync radius and cannot be combined with align or index.");
+
+    if (shift < 0 || shift > 64)
+        env->ThrowError(ERROR_PREFIX "Shift needs to be between 0 and 64.");
+
+    if (jitter < 0 || jitter > (int)MAX_JITTER)
+        env->ThrowError(ERROR_PREFIX "Jitter needs to be between 0 and %d.", MAX_JITTER);
+
+    if (audio && (sync < 1 || align || index || fields))
+        env->ThrowError(ERROR_PREFIX "Audio needs a sync radius and cannot be combined with align, index or fields.");
+
+    if (map < 0 || map > 255)
+        env->ThrowError(ERROR_PREFIX "Map needs to be between 0 and 255.");
 
-	return new Median(clips[0], clips, limit, limit, false, chroma, sync, samples, debug, env);
+    if (showmap && map == 0)
+        env->ThrowError(ERROR_PREFIX "Showmap needs a map threshold.");
+
+    if (!weights.empty() && map > 0)
+        env->ThrowError(ERROR_PREFIX "Weights cannot be combined with map.");
+
+    if (masks && (!weights.empty() || map > 0 || fields || shift > 0 || jitter > 0))
+        env->ThrowError(ERROR_PREFIX "Masks cannot be combined with weights, map, fields, shift or jitter.");
+
+    // Set low and high so that a regular median function is achieved, over
+    // the sum of the weights. An even sum blends the middle two.
+    unsigned int total = TotalWeight(weights, n);
+    unsigned int limit = (total - 1) / 2;
+
+	return new Median(clips[0], clips, weights, masks, limit, limit, false, 0, chroma, sync, samples, align, index, fields, shift, jitter, audio, map, showmap, debug, stats, statsfile, trace, perf, env);
 }
 
 
@@ -78,12 +173,24 @@ AVSValue __cdecl Create_TemporalMedian(AVSValue args, void* user_data, IScriptEn
     int radius = args[1].AsInt(1);
     bool chroma = args[2].AsBool(true);
     bool debug = args[3].AsBool(false);
+    const char* stats = args[4].AsString("");
+    const char* statsfile = args[5].AsString("");
+    const char* trace = args[6].AsString("");
+    bool perf = args[7].AsBool(false);
+    int spatial = args[8].AsInt(0);
 
     // Validation
     if (radius < 1 || radius > 12)
         env->ThrowError(ERROR_PREFIX "Radius needs to be between 1 and 12.");
 
-    return new Median(clips[0], clips, radius, radius, true, chroma, 0, 0, debug, env);
+    if (spatial < 0 || spatial > (int)NETWORK_RADIUS)
+        env->ThrowError(ERROR_PREFIX "Spatial needs to be between 0 and %d.", NETWORK_RADIUS);
+
+    // Comparators index the values of the window in a byte
+    if ((2 * spatial + 1) * (2 * spatial + 1) * (2 * radius + 1) > (int)MAX_WINDOW)
+        env->ThrowError(ERROR_PREFIX "Spatial window over the radius needs to be at most %d values.", MAX_WINDOW);
+
+    return new Median(clips[0], clips, vector<unsigned int>(), PClip(), radius, radius, true, spatial, chroma, 0, 0, false, false, false, 0, 0, false, 0, false, debug, stats, statsfile, trace, perf, env);
 }
 
 
@@ -110,18 +217,115 @@ AVSValue __cdecl Create_MedianBlend(AVSValue args, void* user_data, IScriptEnvir
     int sync = args[4].AsInt(0);
     int samples = args[5].AsInt(4096U);
     bool debug = args[6].AsBool(false);
+    bool align = args[7].AsBool(false);
+    bool index = args[8].AsBool(false);
+    bool fields = args[9].AsBool(false);
+    int shift = args[10].AsInt(0);
+    int jitter = args[11].AsInt(0);
+    bool audio = args[12].AsBool(false);
+    const char* stats = args[13].AsString("");
+    const char* statsfile = args[14].AsString("");
+    const char* trace = args[15].AsString("");
+    bool perf = args[16].AsBool(false);
+    int map = args[17].AsInt(0);
+    bool showmap = args[18].AsBool(false);
+    vector<unsigned int> weights = ParseWeights(args[19].AsString(""), n, env);
+    PClip masks = args[20].Defined() ? args[20].AsClip() : PClip();
 
-    // Validation
-	if (low < 0 || high < 0 || low >= n || high >= n || low + high >= n)
+    // Validation, low and high count in the weights of the clips
+    const int total = (int)TotalWeight(weights, n);
+
+	if (low < 0 || high < 0 || low >= total || high >= total || low + high >= total)
 		env->ThrowError(ERROR_PREFIX "Invalid values supplied for low and/or high limits.");
 
+    if (!weights.empty() && map > 0)
+        env->ThrowError(ERROR_PREFIX "Weights cannot be combined with map.");
+
+    if (masks && (!weights.empty() || map > 0 || fields || shift > 0 || jitter > 0))
+        env->ThrowError(ERROR_PREFIX "Masks cannot be combined with weights, map, fields, shift or jitter.");
+
     if (sync < 0)
         env->ThrowError(ERROR_PREFIX "Sync needs to be a positive value.");
 
     if (samples < 0)
         env->ThrowError(ERROR_PREFIX "Samples needs to be a positive value.");
 
-	return new Median(clips[0], clips, low, high, false, chroma, sync, samples, debug, env);
+    if (align && (sync < 1 || sync > MAX_ALIGN_RADIUS))
+        env->ThrowError(ERROR_PREFIX "Align needs a sync radius between 1 and %d.", MAX_ALIGN_RADIUS);
+
+    if (index && (sync < 1 || align))
+        env->ThrowError(ERROR_PREFIX "Index needs a sync radius and cannot be combined with align.");
+
+    if (fields && (sync < 1 || align || index))
+        env->ThrowError(ERROR_PREFIX "Fields needs a sync radius and cannot be combined with align or index.");
+
+    if (shift < 0 || shift > 64)
+        env->ThrowError(ERROR_PREFIX "Shift needs to be between 0 and 64.");
+
+    if (jitter < 0 || jitter > (int)MAX_JITTER)
+        env->ThrowError(ERROR_PREFIX "Jitter needs to be between 0 and %d.", MAX_JITTER);
+
+    if (audio && (sync < 1 || align || index || fields))
+        env->ThrowError(ERROR_PREFIX "Audio needs a sync radius and cannot be combined with align, index or fields.");
+
+    if (map < 0 || map > 255)
+        env->ThrowError(ERROR_PREFIX "Map needs to be between 0 and 255.");
+
+    if (showmap && map == 0)
+        env->ThrowError(ERROR_PREFIX "Showmap needs a map threshold.");
+
+	return new Median(clips[0], clips, weights, masks, low, high, false, 0, chroma, sync, samples, align, index, fields, shift, jitter, audio, map, showmap, debug, stats, statsfile, trace, perf, env);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Create SpatialMedian filter
+//////////////////////////////////////////////////////////////////////////////
+AVSValue __cdecl Create_SpatialMedian(AVSValue args, void* user_data, IScriptEnvironment* env)
+{
+    // Parameters
+    int radius = args[1].AsInt(1);
+    bool chroma = args[2].AsBool(true);
+    int threads = args[3].AsInt(0);
+
+    // Validation
+    if (radius < 1 || radius > (int)MAX_RADIUS)
+        env->ThrowError(ERROR_PREFIX "Radius needs to be between 1 and %d.", MAX_RADIUS);
+
+    if (threads < 0)
+        env->ThrowError(ERROR_PREFIX "Threads needs to be a positive value.");
+
+    return new SpatialMedian(args[0].AsClip(), radius, chroma, threads, env);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Read the stage counters of the instance created with stats="name"
+//
+// Without a stage the whole report is returned as a string, otherwise one
+// value of one stage as a number.
+//////////////////////////////////////////////////////////////////////////////
+AVSValue __cdecl Create_MedianStats(AVSValue args, void* user_data, IScriptEnvironment* env)
+{
+    const char* name = args[0].AsString();
+    const char* stage = args[1].AsString(NULL);
+    const char* value = args[2].AsString("mean");
+
+    std::unique_lock<std::mutex> lock;
+    FrameStats* stats = LookupStats(name, lock);
+
+    if (stats == NULL)
+        env->ThrowError(ERROR_PREFIX "No statistics named \"%s\".", name);
+
+    if (stage == NULL)
+        return env->SaveString(FormatStats(*stats).c_str());
+
+    double result = 0.0;
+
+    if (!QueryStats(*stats, stage, value, result))
+        env->ThrowError(ERROR_PREFIX "Unknown statistic \"%s\" of stage \"%s\".", value, stage);
+
+    return (float)result;
 }
 
 
@@ -132,9 +336,11 @@ extern "C" __declspec(dllexport) const char* __stdcall AvisynthPluginInit3(IScri
 {
 	AVS_linkage = AVS_linkage_arg;
 
-	env->AddFunction("Median", "c+[CHROMA]b[SYNC]i[SAMPLES]i[DEBUG]b", Create_Median, 0);
-    env->AddFunction("TemporalMedian", "c[RADIUS]i[CHROMA]b[DEBUG]b", Create_TemporalMedian, 0);
-	env->AddFunction("MedianBlend", "c+[LOW]i[HIGH]i[CHROMA]b[SYNC]i[SAMPLES]i[DEBUG]b", Create_MedianBlend, 0);
+	env->AddFunction("Median", "c+[CHROMA]b[SYNC]i[SAMPLES]i[DEBUG]b[ALIGN]b[INDEX]b[FIELDS]b[SHIFT]i[JITTER]i[AUDIO]b[STATS]s[STATSFILE]s[TRACE]s[PERF]b[MAP]i[SHOWMAP]b[WEIGHTS]s[MASKS]c", Create_Median, 0);
+    env->AddFunction("TemporalMedian", "c[RADIUS]i[CHROMA]b[DEBUG]b[STATS]s[STATSFILE]s[TRACE]s[PERF]b[SPATIAL]i", Create_TemporalMedian, 0);
+	env->AddFunction("MedianBlend", "c+[LOW]i[HIGH]i[CHROMA]b[SYNC]i[SAMPLES]i[DEBUG]b[ALIGN]b[INDEX]b[FIELDS]b[SHIFT]i[JITTER]i[AUDIO]b[STATS]s[STATSFILE]s[TRACE]s[PERF]b[MAP]i[SHOWMAP]b[WEIGHTS]s[MASKS]c", Create_MedianBlend, 0);
+    env->AddFunction("SpatialMedian", "c[RADIUS]i[CHROMA]b[THREADS]i", Create_SpatialMedian, 0);
+    env->AddFunction("MedianStats", "s[STAGE]s[VALUE]s", Create_MedianStats, 0);
 
 	return "Median of clips filter";
 }
@@ -0,0 +1,393 @@
+#include "stdafx.h"
+
+#include <string.h>
+
+// 8-bit
+const int COARSE_BINS = 16;
+const int FINE_BINS = 256;
+const int SEGMENT = FINE_BINS / COARSE_BINS;    // Fine bins of a coarse one
+
+
+static inline int Clamp(int value, int low, int high)
+{
+    return min(max(value, low), high);
+}
+
+template<typename T>
+static inline int Sample(const unsigned char* row, const SpatialChannel& channel, int x)
+{
+    return ((const T*)row)[channel.offset + x * channel.step];
+}
+
+template<typename T>
+static inline void SetSample(unsigned char* row, const SpatialChannel& channel, int x, int value)
+{
+    ((T*)row)[channel.offset + x * channel.step] = (T)value;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Counts of one histogram added to or taken from another, count bins long
+//////////////////////////////////////////////////////////////////////////////
+static inline void AddBins(uint16_t* dst, const uint16_t* src, int count)
+{
+    for (int i = 0; i < count; i++)
+        dst[i] = dst[i] + src[i];
+}
+
+static inline void SubtractBins(uint16_t* dst, const uint16_t* src, int count)
+{
+    for (int i = 0; i < count; i++)
+        dst[i] = dst[i] - src[i];
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// 8-bit, after Perreault and Hebert, "Median Filtering in Constant Time"
+//
+// Every column keeps a coarse and a fine histogram of the 2 * radius + 1
+// values around the current row, moved down one row by taking out one value
+// and putting in one. The histogram of the window is the sum of the column
+// histograms, moved right one pixel by adding one column and subtracting
+// another. Only the coarse bins are moved at every pixel; a segment of the
+// fine bins is brought up to date when the median falls in it, from the
+// columns that passed since it was last used. Either way the work per pixel
+// does not depend on the radius.
+//////////////////////////////////////////////////////////////////////////////
+void HistogramMedian8(const SpatialChannel& channel, const unsigned char* srcp, int src_pitch, unsigned char* dstp, int dst_pitch, int radius, int x0, int x1, HistogramScratch& scratch)
+{
+    const int width = channel.width;
+    const int height = channel.height;
+    const int diameter = 2 * radius + 1;
+    const int target = diameter * diameter / 2;
+
+    // Columns the windows of the stripe reach
+    const int lo = max(x0 - radius, 0);
+    const int hi = min(x1 + radius, width);
+
+    scratch.coarse.assign((hi - lo) * COARSE_BINS, 0);
+    scratch.fine.assign((hi - lo) * FINE_BINS, 0);
+
+    uint16_t* coarse = &scratch.coarse[0];
+    uint16_t* fine = &scratch.fine[0];
+
+    for (int x = lo; x < hi; x++)
+    {
+        for (int dy = -radius; dy <= radius; dy++)
+        {
+            const int value = Sample<uint8_t>(srcp + Clamp(dy, 0, height - 1) * src_pitch, channel, x);
+
+            coarse[(x - lo) * COARSE_BINS + value / SEGMENT]++;
+            fine[(x - lo) * FINE_BINS + value]++;
+        }
+    }
+
+    uint16_t window_coarse[COARSE_BINS];
+    uint16_t window_fine[FINE_BINS];
+    int synced[COARSE_BINS];
+
+    for (int y = 0; y < height; y++)
+    {
+        // Columns down one row
+        if (y > 0)
+        {
+            const unsigned char* out = srcp + Clamp(y - radius - 1, 0, height - 1) * src_pitch;
+            const unsigned char* in = srcp + Clamp(y + radius, 0, height - 1) * src_pitch;
+
+            for (int x = lo; x < hi; x++)
+            {
+                const int a = Sample<uint8_t>(out, channel, x);
+                const int b = Sample<uint8_t>(in, channel, x);
+
+                coarse[(x - lo) * COARSE_BINS + a / SEGMENT]--;
+                fine[(x - lo) * FINE_BINS + a]--;
+                coarse[(x - lo) * COARSE_BINS + b / SEGMENT]++;
+                fine[(x - lo) * FINE_BINS + b]++;
+            }
+        }
+
+        // Window of the first pixel, the fine segments are filled when used
+        memset(window_coarse, 0, sizeof(window_coarse));
+
+        for (int dx = -radius; dx <= radius; dx++)
+            AddBins(window_coarse, &coarse[(Clamp(x0 + dx, 0, width - 1) - lo) * COARSE_BINS], COARSE_BINS);
+
+        for (int c = 0; c < COARSE_BINS; c++)
+            synced[c] = INT_MIN;
+
+        unsigned char* dstrow = dstp + y * dst_pitch;
+
+        for (int x = x0; x < x1; x++)
+        {
+            if (x > x0)
+            {
+                AddBins(window_coarse, &coarse[(Clamp(x + radius, 0, width - 1) - lo) * COARSE_BINS], COARSE_BINS);
+                SubtractBins(window_coarse, &coarse[(Clamp(x - radius - 1, 0, width - 1) - lo) * COARSE_BINS], COARSE_BINS);
+            }
+
+            // Coarse bin of the median
+            int below = 0;
+            int c = 0;
+
+            while (below + window_coarse[c] <= target)
+                below = below + window_coarse[c++];
+
+            // Its fine segment, moved along or summed again, whichever is
+            // less work
+            uint16_t* segment = window_fine + c * SEGMENT;
+
+            if (synced[c] != INT_MIN && (x - synced[c]) * 2 <= diameter)
+            {
+                for (int s = synced[c] + 1; s <= x; s++)
+                {
+                    AddBins(segment, &fine[(Clamp(s + radius, 0, width - 1) - lo) * FINE_BINS + c * SEGMENT], SEGMENT);
+                    SubtractBins(segment, &fine[(Clamp(s - radius - 1, 0, width - 1) - lo) * FINE_BINS + c * SEGMENT], SEGMENT);
+                }
+            }
+            else
+            {
+                memset(segment, 0, SEGMENT * sizeof(uint16_t));
+
+                for (int dx = -radius; dx <= radius; dx++)
+                    AddBins(segment, &fine[(Clamp(x + dx, 0, width - 1) - lo) * FINE_BINS + c * SEGMENT], SEGMENT);
+            }
+
+            synced[c] = x;
+
+            int value = c * SEGMENT;
+
+            while (below + window_fine[value] <= target)
+                below = below + window_fine[value++];
+
+            SetSample<uint8_t>(dstrow, channel, x, value);
+        }
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// 16-bit, histograms of the window at three levels, after Huang
+//
+// Per column histograms of every 16-bit value would not fit any cache, so
+// only the window has histograms: 65536 fine bins, 4096 middle bins of 16
+// values and 256 coarse bins of 256. The window snakes through the stripe,
+// right along one row, down, left along the next, so it is never built
+// again; a move changes 2 * radius + 1 values. The median is followed from
+// where it was, with the count of values below it in the window and in its
+// own coarse and middle bins, so it leaves a bin in one step and crosses the
+// ones in between whole.
+//////////////////////////////////////////////////////////////////////////////
+struct Window16
+{
+    uint16_t* fine;
+    uint16_t* middle;
+    uint16_t coarse[256];
+    int median;
+    int below;          // Values under the median
+    int coarse_below;   // Those of them in the coarse bin of the median
+    int middle_below;   // And in its middle bin
+
+    void Add(int value)
+    {
+        fine[value]++;
+        middle[value >> 4]++;
+        coarse[value >> 8]++;
+
+        if (value < median)
+        {
+            below++;
+            coarse_below = coarse_below + ((value >> 8) == (median >> 8) ? 1 : 0);
+            middle_below = middle_below + ((value >> 4) == (median >> 4) ? 1 : 0);
+        }
+    }
+
+    void Remove(int value)
+    {
+        fine[value]--;
+        middle[value >> 4]--;
+        coarse[value >> 8]--;
+
+        if (value < median)
+        {
+            below--;
+            coarse_below = coarse_below - ((value >> 8) == (median >> 8) ? 1 : 0);
+            middle_below = middle_below - ((value >> 4) == (median >> 4) ? 1 : 0);
+        }
+    }
+
+    // Move the median until target values are below it and the rest at or
+    // above it
+    void Seek(int target)
+    {
+        while (below > target)
+        {
+            const int c = median >> 8;
+            const int m = median >> 4;
+
+            if (coarse_below == 0)
+            {
+                // Into the previous coarse bin, whole if it is all above
+                // the target, else to its last value
+                if (below - coarse[c - 1] > target)
+                {
+                    below = below - coarse[c - 1];
+                    median = (c - 1) << 8;
+                }
+                else
+                {
+                    median = (c << 8) - 1;
+                    below = below - fine[median];
+                    coarse_below = coarse[c - 1] - fine[median];
+                    middle_below = middle[median >> 4] - fine[median];
+                }
+            }
+            else if (below - coarse_below > target)
+            {
+                below = below - coarse_below;
+                median = c << 8;
+                coarse_below = 0;
+                middle_below = 0;
+            }
+            else if (middle_below == 0)
+            {
+                // Same for the previous middle bin, in this coarse bin
+                if (below - middle[m - 1] > target)
+                {
+                    below = below - middle[m - 1];
+                    coarse_below = coarse_below - middle[m - 1];
+                    median = (m - 1) << 4;
+                }
+                else
+                {
+                    median = (m << 4) - 1;
+                    below = below - fine[median];
+                    coarse_below = coarse_below - fine[median];
+                    middle_below = middle[m - 1] - fine[median];
+                }
+            }
+            else if (below - middle_below > target)
+            {
+                below = below - middle_below;
+                coarse_below = coarse_below - middle_below;
+                median = m << 4;
+                middle_below = 0;
+            }
+            else
+            {
+                median--;
+                below = below - fine[median];
+                coarse_below = coarse_below - fine[median];
+                middle_below = middle_below - fine[median];
+            }
+        }
+
+        while (below + fine[median] <= target)
+        {
+            const int c = median >> 8;
+            const int m = median >> 4;
+
+            // Values at or above the median in its coarse and middle bins
+            const int coarse_rest = coarse[c] - coarse_below;
+            const int middle_rest = middle[m] - middle_below;
+
+            if (below + coarse_rest <= target)
+            {
+                below = below + coarse_rest;
+                median = (c + 1) << 8;
+                coarse_below = 0;
+                middle_below = 0;
+            }
+            else if (below + middle_rest <= target)
+            {
+                below = below + middle_rest;
+                coarse_below = coarse_below + middle_rest;
+                median = (m + 1) << 4;
+                middle_below = 0;
+            }
+            else
+            {
+                below = below + fine[median];
+                coarse_below = coarse_below + fine[median];
+                middle_below = middle_below + fine[median];
+                median++;
+            }
+        }
+    }
+};
+
+void HistogramMedian16(const SpatialChannel& channel, const unsigned char* srcp, int src_pitch, unsigned char* dstp, int dst_pitch, int radius, int x0, int x1, HistogramScratch& scratch)
+{
+    const int width = channel.width;
+    const int height = channel.height;
+    const int diameter = 2 * radius + 1;
+    const int target = diameter * diameter / 2;
+
+    scratch.fine.assign(65536, 0);
+    scratch.middle.assign(4096, 0);
+
+    Window16 window;
+    window.fine = &scratch.fine[0];
+    window.middle = &scratch.middle[0];
+    memset(window.coarse, 0, sizeof(window.coarse));
+    window.median = 0;
+    window.below = 0;
+    window.coarse_below = 0;
+    window.middle_below = 0;
+
+    for (int dy = -radius; dy <= radius; dy++)
+    {
+        const unsigned char* row = srcp + Clamp(dy, 0, height - 1) * src_pitch;
+
+        for (int dx = -radius; dx <= radius; dx++)
+            window.Add(Sample<uint16_t>(row, channel, Clamp(x0 + dx, 0, width - 1)));
+    }
+
+    int x = x0;
+
+    for (int y = 0; y < height; y++)
+    {
+        const int direction = y % 2 == 0 ? 1 : -1;
+
+        unsigned char* dstrow = dstp + y * dst_pitch;
+
+        for (;;)
+        {
+            window.Seek(target);
+            SetSample<uint16_t>(dstrow, channel, x, window.median);
+
+            const int next = x + direction;
+
+            if (next < x0 || next >= x1)
+                break;
+
+            // Sideways: the column falling out of the window for the one
+            // coming in
+            const int out = Clamp(direction > 0 ? x - radius : x + radius, 0, width - 1);
+            const int in = Clamp(direction > 0 ? next + radius : next - radius, 0, width - 1);
+
+            for (int dy = -radius; dy <= radius; dy++)
+            {
+                const unsigned char* row = srcp + Clamp(y + dy, 0, height - 1) * src_pitch;
+
+                window.Remove(Sample<uint16_t>(row, channel, out));
+                window.Add(Sample<uint16_t>(row, channel, in));
+            }
+
+            x = next;
+        }
+
+        // Down: the top row for the one below the window
+        if (y + 1 < height)
+        {
+            const unsigned char* out = srcp + Clamp(y - radius, 0, height - 1) * src_pitch;
+            const unsigned char* in = srcp + Clamp(y + radius + 1, 0, height - 1) * src_pitch;
+
+            for (int dx = -radius; dx <= radius; dx++)
+            {
+                const int column = Clamp(x + dx, 0, width - 1);
+
+                window.Remove(Sample<uint16_t>(out, channel, column));
+                window.Add(Sample<uint16_t>(in, channel, column));
+            }
+        }
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <vector>
+#include <stdint.h>
+
+const int HISTOGRAM_STRIPE = 256; // Columns of a stripe, a job of its own
+
+struct SpatialChannel;
+
+//////////////////////////////////////////////////////////////////////////////
+// Histograms of a stripe, kept by a worker from one stripe to the next so
+// that they are only allocated once
+//////////////////////////////////////////////////////////////////////////////
+struct HistogramScratch
+{
+    std::vector<uint16_t> coarse;   // 8-bit: coarse bins of every column
+    std::vector<uint16_t> fine;     // 8-bit: fine bins of every column, 16-bit: of the window
+    std::vector<uint16_t> middle;   // 16-bit: middle bins of the window
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Median of the window of radius around every pixel of columns x0 to x1 of
+// a channel, counted in histograms instead of sorted, for 8 and 16-bit
+// values. Pixels outside the channel repeat the edge.
+//////////////////////////////////////////////////////////////////////////////
+void HistogramMedian8(const SpatialChannel& channel, const unsigned char* srcp, int src_pitch, unsigned char* dstp, int dst_pitch, int radius, int x0, int x1, HistogramScratch& scratch);
+void HistogramMedian16(const SpatialChannel& channel, const unsigned char* srcp, int src_pitch, unsigned char* dstp, int dst_pitch, int radius, int x0, int x1, HistogramScratch& scratch);
+
+#endif // HISTOGRAM_H
@@ -9,23 +9,38 @@
 //////////////////////////////////////////////////////////////////////////////
 // Constructor
 //////////////////////////////////////////////////////////////////////////////
-Median::Median(PClip _child, vector<PClip> _clips, unsigned int _low, unsigned int _high, bool _temporal, bool _processchroma, unsigned int _sync, unsigned int _samples, bool _debug, IScriptEnvironment *env) :
-GenericVideoFilter(_child), clips(_clips), low(_low), high(_high), temporal(_temporal), processchroma(_processchroma), sync(_sync), samples(_samples), debug(_debug)
+Median::Median(PClip _child, vector<PClip> _clips, vector<unsigned int> _weights, PClip _masks, unsigned int _low, unsigned int _high, bool _temporal, unsigned int _spatial, bool _processchroma, unsigned int _sync, unsigned int _samples, bool _align, bool _index, bool _fields, unsigned int _shift, unsigned int _jitter, bool _audio, unsigned int _map, bool _showmap, bool _debug, const char* _stats, const char* _statsfile, const char* _trace, bool _perf, IScriptEnvironment *env) :
+GenericVideoFilter(_child), clips(_clips), low(_low), high(_high), temporal(_temporal), spatial(_spatial), processchroma(_processchroma), sync(_sync), samples(_samples), align(_align), hashindex(_index), fields(_fields), shiftrange(_shift), jitterrange(_jitter), audiosync(_audio), mapthreshold(_map), showmap(_showmap), debug(_debug), perfcounters(_perf), indexed(false), masks(_masks)
 {
     if (temporal)
         depth = 2 * low + 1; // In this case low == high == radius and we only have one source clip
     else
         depth = clips.size();
 
-    blend = depth - low - high;
+    // Every clip counts as many times as its weight
+    weightsum = 0;
 
-    if (blend == 1 && low == high && depth <= MAX_OPT)
+    for (unsigned int i = 0; i < depth; i++)
+    {
+        weight[i] = _weights.empty() ? 1 : _weights[i];
+        weightsum = weightsum + weight[i];
+    }
+
+    blend = weightsum - low - high;
+
+    if (blend == 1 && low == high && depth <= MAX_OPT && weightsum == depth)
         fastprocess = true;
     else
         fastprocess = false;
 
-    debugf("depth: %d, blend: %d, low: %d, high: %d, fast: %d, temporal: %d, sync: %d, samples: %d", 
-       depth, blend, low, high, (int)fastprocess, (int)temporal, (int)sync, (int)samples);
+    // Sources can only be merged when every clip is read the same way, and
+    // not when every clip has a mask of its own. The map measures every clip
+    // at every sample with the per-pixel kernel, so it keeps them apart too,
+    // which also leaves the majority shortcut and weighted stacks unused.
+    stacking = !fields && shiftrange == 0 && jitterrange == 0 && mapthreshold == 0 && !masks;
+
+    debugf("depth: %d, weight: %d, blend: %d, low: %d, high: %d, fast: %d, temporal: %d, sync: %d, samples: %d", 
+       depth, weightsum, blend, low, high, (int)fastprocess, (int)temporal, (int)sync, (int)samples);
 
     switch (depth)
     {
@@ -56,6 +71,222 @@ GenericVideoFilter(_child), clips(_clips), low(_low), high(_high), temporal(_tem
                 env->ThrowError(ERROR_PREFIX "Dimensions of all clips must match.");
         }
     }
+
+    // Every plane needs to split evenly into two fields
+    if (fields)
+    {
+        int multiple = 2;
+
+        if (info[0].IsPlanar() && !info[0].IsY())
+            multiple = 2 << info[0].GetPlaneHeightSubsampling(PLANAR_U);
+
+        if (info[0].height % multiple != 0)
+            env->ThrowError(ERROR_PREFIX "Fields needs a frame height that is a multiple of %d.", multiple);
+    }
+
+    // Every value of a window over space and time goes through one network
+    if (spatial > 0)
+    {
+        if (!vi.IsPlanar() && !vi.IsYUY2() && !vi.IsRGB24() && !vi.IsRGB32() && vi.pixel_type != VideoInfo::CS_BGR64)
+            env->ThrowError(ERROR_PREFIX "Unsupported color format.");
+
+        SpatialChannels(vi, processchroma, volumechannels, volumecopied);
+        BuildWindowNetwork(volume, spatial, depth, vi.ComponentSize(), env->GetCPUFlags());
+
+        debugf("spatial: %d, sorted columns: %d, comparators: %d", spatial, (int)!volume.columnsort.empty(), (int)volume.network.size());
+    }
+
+    // Weighted stacks are sorted as integer keys, one network for every
+    // number of distinct sources. Every key covers at least one position,
+    // so the first low + blend keys are all that can be reached.
+    if (weightsum != depth && info[0].ComponentSize() == 4)
+        env->ThrowError(ERROR_PREFIX "Weights need 8 to 16-bit samples.");
+
+    weightedrow = GetWeightedRowFunction(info[0].ComponentSize(), env->GetCPUFlags());
+
+    for (unsigned int count = 1; count <= depth && info[0].ComponentSize() != 4; count++)
+    {
+        if (blend != weightsum)
+            SelectionNetwork(count, 0, min(low + blend, count), weightnetwork[count]);
+    }
+
+    // Masks are read like the clips, a mask frame for every frame of every
+    // clip. Masked values go through one network as the largest key.
+    if (masks)
+    {
+        const VideoInfo& maskinfo = masks->GetVideoInfo();
+
+        if (!maskinfo.IsSameColorspace(info[0]) || maskinfo.width != info[0].width || maskinfo.height != info[0].height)
+            env->ThrowError(ERROR_PREFIX "Masks need the format and dimensions of the clips.");
+
+        // One mask for every frame of every clip, interleaved. Synced clips
+        // are read past the length of the first one, up to their own.
+        int longest = 0;
+
+        for (unsigned int i = 0; i < depth; i++)
+            longest = max(longest, info[i].num_frames);
+
+        const long long needed = (long long)longest * depth;
+
+        if ((long long)maskinfo.num_frames < needed)
+            env->ThrowError(ERROR_PREFIX "Masks need %lld frames, one for every frame of every clip.", needed);
+
+        if (info[0].ComponentSize() == 4)
+            env->ThrowError(ERROR_PREFIX "Masks need 8 to 16-bit samples.");
+
+        valid = GetValidFunction(info[0].ComponentSize(), env->GetCPUFlags());
+        maskedrow = GetMaskedRowFunction(info[0].ComponentSize(), env->GetCPUFlags());
+
+        SelectionNetwork(depth, 0, depth - high, masknetwork);
+    }
+
+    // The disagreement map is taken over 8-bit luma
+    if (mapthreshold > 0 && !(info[0].IsPlanar() && info[0].ComponentSize() == 1 && (info[0].IsYUV() || info[0].IsY())))
+        env->ThrowError(ERROR_PREFIX "Map needs 8-bit planar YUV or Y.");
+
+    // Audio sync works on the envelope of every clip, one segment at a time
+    if (audiosync)
+    {
+        for (unsigned int i = 0; i < depth; i++)
+        {
+            if (!info[i].HasAudio())
+                env->ThrowError(ERROR_PREFIX "Audio sync needs audio in every clip.");
+        }
+
+        const int segments = (vi.num_frames + AUDIO_SEGMENT - 1) / AUDIO_SEGMENT;
+
+        audiomatch.resize((size_t)segments * depth);
+        audiodone.assign(segments, false);
+    }
+
+    // The audio is mixed from all clips when they carry the same kind of
+    // audio, otherwise it comes from the first clip as before
+    mixaudio = !temporal && vi.HasAudio() && weightsum == depth;
+    audiosort = GetAudioSortFunction(vi.SampleType(), env->GetCPUFlags());
+
+    for (unsigned int i = 1; i < depth && mixaudio; i++)
+    {
+        if (!info[i].HasAudio() || info[i].SampleType() != vi.SampleType() || info[i].AudioChannels() != vi.AudioChannels() || info[i].audio_samples_per_second != vi.audio_samples_per_second)
+            mixaudio = false;
+    }
+
+    if (audiosort == NULL)
+        mixaudio = false;
+
+    // Sync offsets are remembered per frame for the audio to follow
+    if (mixaudio && sync > 0 && !align)
+        frameoffset.assign((size_t)vi.num_frames * depth, NO_OFFSET);
+
+    debugf("audio: %s", mixaudio ? "mixed" : "first clip");
+
+    sad = GetSadFunction(env->GetCPUFlags());
+
+    // Tiles where every source agrees are copied instead of processed. A
+    // blend of equal floats does not always give the same value back.
+    agree = GetAgreeFunction(env->GetCPUFlags());
+    agreetiles = !(info[0].ComponentSize() == 4 && blend > 1);
+
+    // Font in the layout of the output, rendered once
+    if (debug)
+        BuildGlyphAtlas(atlas, info[0], env->GetCPUFlags());
+
+    // Instruction set of the vector kernels, reported in the frame properties.
+    // Every Get*Function above picks its version by the same rule.
+    isa = "C";
+
+#ifdef INTEL_INTRINSICS
+    if (env->GetCPUFlags() & CPUF_AVX2)
+        isa = "AVX2";
+    else if (env->GetCPUFlags() & CPUF_SSE2)
+        isa = "SSE2";
+#endif
+
+    // Frame properties need interface version 8
+    frameprops = true;
+
+    try { env->CheckVersion(8); } catch (const AvisynthError&) { frameprops = false; }
+
+
+    if (shiftrange > 0)
+    {
+        const int segments = (vi.num_frames + SHIFT_SEGMENT - 1) / SHIFT_SEGMENT;
+
+        shiftcache.resize((size_t)segments * depth);
+    }
+
+    // Align all clips against the first one in a single pass before rendering
+    if (align)
+    {
+        vector<FrameSignature> reference;
+        vector<FrameSignature> signatures;
+
+        AnalyseClip(clips[0], reference, env);
+
+        alignment.resize(depth);
+
+        for (unsigned int i = 1; i < depth; i++)
+        {
+            AnalyseClip(clips[i], signatures, env);
+            AlignSignatures(reference, signatures, sync, alignment[i]);
+
+            debugf("clip %d: %d dropped, %d inserted", i + 1, alignment[i].dropped, alignment[i].inserted);
+        }
+    }
+
+    // Bytes the median kernel reads and writes per frame, for the hardware
+    // counters
+    framebytes = 0;
+
+    if (vi.IsPlanar() && !vi.IsY())
+    {
+        const int planes[3] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+
+        // Planes left alone are only copied from the first clip
+        for (int p = 0; p < 3; p++)
+        {
+            const uint64_t bytes = (uint64_t)vi.RowSize(planes[p]) * (vi.height >> vi.GetPlaneHeightSubsampling(planes[p]));
+
+            framebytes = framebytes + bytes * (p == 0 || processchroma || showmap ? depth + 1 : 2);
+        }
+    }
+    else
+    {
+        framebytes = (uint64_t)vi.RowSize() * vi.height * (depth + 1);
+    }
+
+    ClearPerf(perftotal);
+    perfframes = 0;
+
+    if (perfcounters)
+    {
+        PerfSample sample;
+        ReadPerfCounters(sample);
+
+        if (sample.valid == 0)
+            debugf("perf counters unavailable");
+    }
+
+    // Calibrate the timestamps now rather than in the first frame
+    TimestampFrequency();
+
+    // Stage counters, only kept when asked for. Nothing may throw after
+    // this, the destructor would not run to unregister them
+    stats = NULL;
+
+    if (_stats != NULL && _stats[0] != '\0')
+    {
+        stats = new FrameStats();
+        stats->name = _stats;
+        stats->file = _statsfile != NULL ? _statsfile : "";
+
+        RegisterStats(stats);
+    }
+
+    // Timeline of every GetFrame, written out in the destructor
+    tracer = NULL;
+
+    if (_trace != NULL && _trace[0] != '\0')
+        tracer = CreateTracer(_trace);
 }
 
 
@@ -64,6 +295,35 @@ GenericVideoFilter(_child), clips(_clips), low(_low), high(_high), temporal(_tem
 //////////////////////////////////////////////////////////////////////////////
 Median::~Median()
 {
+    if (stats != NULL)
+    {
+        UnregisterStats(stats);
+
+        const std::string report = FormatStats(*stats);
+
+        FILE* file = stats->file.empty() ? NULL : fopen(stats->file.c_str(), "a");
+
+        fputs(report.c_str(), file != NULL ? file : stderr);
+
+        if (file != NULL)
+            fclose(file);
+
+        delete stats;
+    }
+
+    if (tracer != NULL)
+    {
+        WriteTrace(tracer);
+        DestroyTracer(tracer);
+    }
+
+    if (perfcounters && perfframes > 0)
+    {
+        char text[256];
+        FormatPerf(perftotal, framebytes * perfframes, text, sizeof(text));
+
+        fprintf(stderr, "median perf: %llu frames, %s\n", (unsigned long long)perfframes, text);
+    }
 }
 
 
@@ -72,180 +332,1323 @@ Median::~Median()
 //////////////////////////////////////////////////////////////////////////////
 PVideoFrame __stdcall Median::GetFrame(int n, IScriptEnvironment* env)
 {
+    TraceScope scope(tracer, "GetFrame", "frame", n);
+
+    // Time spent in every stage, in timestamp ticks
+    uint64_t ticks[STAGE_COUNT] = { 0 };
+    uint64_t mark = ReadTimestamp();
+
+    auto lap = [&](Stage stage)
+    {
+        const uint64_t now = ReadTimestamp();
+        ticks[stage] = ticks[stage] + (now - mark);
+        mark = now;
+    };
+
+    // Hardware counters of the median kernel
+    PerfSample perf;
+    PerfSample perfstart;
+
+    ClearPerf(perf);
+
+    auto perfbegin = [&]()
+    {
+        if (perfcounters)
+            ReadPerfCounters(perfstart);
+    };
+
+    auto perfend = [&]()
+    {
+        if (perfcounters)
+        {
+            PerfSample now;
+            ReadPerfCounters(now);
+            AccumulatePerf(perf, perfstart, now);
+        }
+    };
+
     // Sync statistics for this frame
     double best[MAX_DEPTH] = { 0.0 };
     int match[MAX_DEPTH] = { 0 };
 
-    // Source
-    PVideoFrame src[MAX_DEPTH];
+    // Source, and the field of it to use: -1 -> whole frame, 0 -> top, 1 -> bottom
+    PVideoFrame src[MAX_DEPTH];
+    int field[MAX_DEPTH];
+
+    // Source for the second output field when processing fields
+    PVideoFrame second[MAX_DEPTH];
+    int secondfield[MAX_DEPTH];
+
+    std::fill(field, field + MAX_DEPTH, -1);
+
+    if (temporal)
+    {
+        unsigned int radius = low; // low == high == radius
+
+        // Frames before the first and after the last are clamped when fetched
+        for (unsigned int i = 0; i < depth; i++)
+            src[i] = FetchFrame(0, n - radius + i, env); // Grab an equal number of preceding and following frames
+    }
+    else if (align)
+    {
+        src[0] = FetchFrame(0, n, env);
+
+        // Offsets were resolved for the whole clip in the constructor
+        const int frame = max(0, min(n, vi.num_frames - 1));
+
+        for (unsigned int i = 1; i < depth; i++)
+        {
+            match[i] = alignment[i].frame[frame] - frame;
+            best[i] = alignment[i].similarity[frame];
+
+            src[i] = FetchFrame(i, alignment[i].frame[frame], env);
+        }
+    }
+    else if (fields)
+    {
+        // Offsets are counted in fields, field 2n is the first field of frame
+        // n in time and field 2n + 1 the second one
+        const int first = info[0].IsBFF() ? 1 : 0;
+
+        src[0] = FetchFrame(0, n, env);
+        second[0] = src[0];
+        field[0] = first;
+        secondfield[0] = first ^ 1;
+
+        SyncOffsets(n, src[0], match, best, env);
+
+        for (unsigned int i = 1; i < depth; i++)
+        {
+            // Both output fields use the same offset
+            src[i] = FetchFrame(i, (2 * n + match[i]) >> 1, env);
+            field[i] = ((2 * n + match[i]) & 1) ^ first;
+
+            second[i] = FetchFrame(i, (2 * n + 1 + match[i]) >> 1, env);
+            secondfield[i] = ((2 * n + 1 + match[i]) & 1) ^ first;
+        }
+    }
+    else if (sync > 0)
+    {
+        src[0] = FetchFrame(0, n, env);
+
+        SyncOffsets(n, src[0], match, best, env);
+
+        for (unsigned int i = 1; i < depth; i++)
+            src[i] = FetchFrame(i, n + match[i], env);
+    }
+    else
+    {
+        for (unsigned int i = 0; i < depth; i++)
+            src[i] = FetchFrame(i, n, env);
+    }
+
+    // Remember the offsets for the audio
+    if (!frameoffset.empty() && n >= 0 && n < vi.num_frames)
+    {
+        std::lock_guard<std::mutex> lock(offsetlock);
+
+        std::copy(match, match + depth, frameoffset.begin() + (size_t)n * depth);
+    }
+
+    lap(STAGE_SYNC);
+
+    // Sources that are the same frame, and one that settles the output
+    FrameStack stack;
+    StackFrames(src, stack);
+
+    const int majority = MajorityFrame(stack);
+
+	// Output, with the properties of the reference frame
+    PVideoFrame output;
+
+    if (majority >= 0)
+    {
+        output = ShareFrame(src[majority], env);
+
+        if (frameprops)
+            env->copyFrameProps(src[temporal ? low : 0], output);
+    }
+    else if (frameprops)
+        output = env->NewVideoFrameP(vi, &src[temporal ? low : 0]);
+    else
+        output = env->NewVideoFrame(vi);
+
+    // Global shift of every clip against the first one
+    SourceShift shift = {};
+
+    if (shiftrange > 0)
+        EstimateShifts(n, match, shift, env);
+
+    if (jitterrange > 0)
+        EstimateJitter(src, field, shift);
+
+    lap(STAGE_SHIFT);
+
+    // Mask of every source frame
+    PVideoFrame mask[MAX_DEPTH];
+
+    for (unsigned int i = 0; i < depth && masks; i++)
+        mask[i] = FetchMask(i, n + match[i], env);
+
+    // Disagreement of every clip with the output
+    MapStats map = {};
+
+    if (majority < 0)
+    {
+        perfbegin();
+        ProcessFrame(src, field, shift, stack, masks ? mask : NULL, output, field[0], mapthreshold > 0 ? &map : NULL, env);
+        perfend();
+    }
+
+    lap(STAGE_PROCESS);
+
+    // The second field of a shared frame is already in place
+    if (fields && majority < 0)
+    {
+        if (jitterrange > 0)
+            EstimateJitter(second, secondfield, shift);
+
+        lap(STAGE_SHIFT);
+
+        perfbegin();
+        ProcessFrame(second, secondfield, shift, stack, NULL, output, secondfield[0], mapthreshold > 0 ? &map : NULL, env);
+        perfend();
+
+        lap(STAGE_PROCESS);
+    }
+
+    // Average size of the row shifts, of the last field in fields mode
+    double jitter[MAX_DEPTH] = { 0.0 };
+
+    for (unsigned int i = 1; i < depth && jitterrange > 0; i++)
+    {
+        for (size_t y = 0; y < shift.row[i].size(); y++)
+            jitter[i] = jitter[i] + abs(shift.row[i][y]);
+
+        if (!shift.row[i].empty())
+            jitter[i] = jitter[i] / shift.row[i].size();
+    }
+
+    // Running totals of the hardware counters
+    PerfSample total;
+    uint64_t frames = 0;
+
+    if (perfcounters)
+    {
+        std::lock_guard<std::mutex> lock(perflock);
+
+        AddPerf(perftotal, perf);
+        perfframes++;
+
+        total = perftotal;
+        frames = perfframes;
+    }
+
+    // Print debug information on output image
+    if (debug)
+    {
+        TraceScope scope(tracer, "debug");
+
+        // A shared source frame is copied before it is written on
+        if (majority >= 0)
+            env->MakeWritable(&output);
+
+        line = 0;
+        textf(output, "FRAME: %d", n);
+        textf(output, "CLIPS: %d", depth);
+
+        if (weightsum != depth)
+            textf(output, "TOTAL WEIGHT: %d", weightsum);
+
+        if (spatial > 0)
+            textf(output, "SPATIAL RADIUS: %d", spatial);
+
+        if (stack.count < depth)
+            textf(output, majority >= 0 ? "DISTINCT: %d, CLIP %d WINS" : "DISTINCT: %d", stack.count, majority + 1);
+
+        if (sync > 0)
+        {
+            textf(output, align ? "ALIGN RADIUS: %d" : "SYNC RADIUS: %d", sync);
+
+            if (hashindex)
+                textf(output, "SYNC INDEX: %d CANDIDATES", INDEX_CANDIDATES);
+
+            if (audiosync)
+                textf(output, "SYNC AUDIO: %d FRAME SEGMENTS", AUDIO_SEGMENT);
+
+            textf(output, "SYNC METRICS:");
+
+            for (unsigned int i = 1; i < depth; i++)
+            {
+                if (fields) // Offsets in frames, half a frame is one field
+                    textf(output, "%-2d %+-5.1f %-f", i + 1, match[i] / 2.0, best[i]);
+                else
+                    textf(output, "%-2d %+-3d %-f", i + 1, match[i], best[i]);
+            }
+        }
+
+        if (shiftrange > 0)
+        {
+            textf(output, "SHIFT RANGE: %d", shiftrange);
+
+            for (unsigned int i = 1; i < depth; i++)
+                textf(output, "%-2d %+-3d %+-3d", i + 1, shift.x[i], shift.y[i]);
+        }
+
+        if (jitterrange > 0)
+        {
+            textf(output, "JITTER RANGE: %d", jitterrange);
+
+            for (unsigned int i = 1; i < depth; i++)
+                textf(output, "%-2d %-5.2f", i + 1, jitter[i]);
+        }
+
+        if (mapthreshold > 0)
+        {
+            textf(output, "MAP THRESHOLD: %d", mapthreshold);
+
+            for (unsigned int i = 0; i < depth && map.samples > 0; i++)
+                textf(output, "%-2d %5.2f%% %-5.2f", i + 1, 100.0 * map.outliers[i] / map.samples, (double)map.deviation[i] / map.samples);
+        }
+
+        if (perfcounters)
+        {
+            char text[256];
+
+            FormatPerf(perf, framebytes, text, sizeof(text));
+            textf(output, "PERF: %s", text);
+
+            FormatPerf(total, framebytes * frames, text, sizeof(text));
+            textf(output, "PERF %llu FRAMES: %s", (unsigned long long)frames, text);
+        }
+    }
+
+    lap(STAGE_DEBUG);
+
+    if (stats != NULL)
+        RecordFrame(*stats, ticks, (uint64_t)vi.width * vi.height);
+
+    if (frameprops)
+        SetProperties(output, match, best, shift, jitter, ticks, perf, map, stack, majority, env);
+
+    return output;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Attach the statistics of a frame to it as frame properties
+//
+// Offsets and similarities are listed for every clip, the first clip being
+// the reference. Offsets are counted in fields when processing fields.
+//////////////////////////////////////////////////////////////////////////////
+void Median::SetProperties(PVideoFrame& dst, const int match[MAX_DEPTH], const double best[MAX_DEPTH], const SourceShift& shift, const double jitter[MAX_DEPTH], const uint64_t ticks[STAGE_COUNT], const PerfSample& perf, const MapStats& map, const FrameStack& stack, int majority, IScriptEnvironment* env)
+{
+    AVSMap* props = env->getFramePropsRW(dst);
+
+    int64_t values[MAX_DEPTH];
+
+    if (sync > 0)
+    {
+        std::copy(match, match + depth, values);
+
+        env->propSetIntArray(props, "MedianSyncOffset", values, depth);
+        env->propSetFloatArray(props, "MedianSimilarity", best, depth);
+    }
+
+    if (shiftrange > 0)
+    {
+        std::copy(shift.x, shift.x + depth, values);
+        env->propSetIntArray(props, "MedianShiftX", values, depth);
+
+        std::copy(shift.y, shift.y + depth, values);
+        env->propSetIntArray(props, "MedianShiftY", values, depth);
+    }
+
+    if (jitterrange > 0)
+        env->propSetFloatArray(props, "MedianJitter", jitter, depth);
+
+    char kernel[16];
+
+    // Only 8-bit samples go through the selection networks, or every
+    // format with a spatial radius
+    if (spatial > 0)
+        snprintf(kernel, sizeof(kernel), "network%ux%ux%u", 2 * spatial + 1, 2 * spatial + 1, depth);
+    else if (majority >= 0)
+        snprintf(kernel, sizeof(kernel), "shared");
+    else if (masks)
+        snprintf(kernel, sizeof(kernel), "masked");
+    else if (Weighted(stack))
+        snprintf(kernel, sizeof(kernel), "weighted");
+    else if (fastprocess && info[0].ComponentSize() == 1)
+        snprintf(kernel, sizeof(kernel), "opt_med%d", depth);
+    else
+        snprintf(kernel, sizeof(kernel), blend == weightsum ? "average" : "sort");
+
+    env->propSetData(props, "MedianKernel", kernel, -1, PROPAPPENDMODE_REPLACE);
+    env->propSetInt(props, "MedianDistinct", stack.count, PROPAPPENDMODE_REPLACE);
+
+    // Only the row networks have vector versions, the instruction set is
+    // left out for the plain C kernels
+    if (spatial > 0 || (majority < 0 && (masks || Weighted(stack))))
+        env->propSetData(props, "MedianISA", isa, -1, PROPAPPENDMODE_REPLACE);
+
+    const double milliseconds = 1000.0 / TimestampFrequency();
+
+    env->propSetFloat(props, "MedianTimeSync", ticks[STAGE_SYNC] * milliseconds, PROPAPPENDMODE_REPLACE);
+    env->propSetFloat(props, "MedianTimeShift", ticks[STAGE_SHIFT] * milliseconds, PROPAPPENDMODE_REPLACE);
+    env->propSetFloat(props, "MedianTimeProcess", ticks[STAGE_PROCESS] * milliseconds, PROPAPPENDMODE_REPLACE);
+    env->propSetFloat(props, "MedianTimeDebug", ticks[STAGE_DEBUG] * milliseconds, PROPAPPENDMODE_REPLACE);
+
+    // Share of luma samples where each clip is an outlier, in percent, and
+    // the average distance of every clip from the output
+    if (mapthreshold > 0 && map.samples > 0)
+    {
+        double outliers[MAX_DEPTH];
+        double deviation[MAX_DEPTH];
+
+        for (unsigned int i = 0; i < depth; i++)
+        {
+            outliers[i] = 100.0 * map.outliers[i] / map.samples;
+            deviation[i] = (double)map.deviation[i] / map.samples;
+        }
+
+        env->propSetFloatArray(props, "MedianOutliers", outliers, depth);
+        env->propSetFloatArray(props, "MedianDeviation", deviation, depth);
+        env->propSetFloat(props, "MedianDisagreement", 100.0 * map.disagreeing / map.samples, PROPAPPENDMODE_REPLACE);
+    }
+
+    // Hardware counters of the kernel, only the events that could be counted
+    if (perfcounters)
+    {
+        static const char* names[PERF_EVENTS] = { "MedianPerfCycles", "MedianPerfInstructions", "MedianPerfCacheMisses", "MedianPerfStalledCycles" };
+
+        for (int i = 0; i < PERF_EVENTS; i++)
+        {
+            if (perf.valid & (1 << i))
+                env->propSetInt(props, names[i], (int64_t)perf.value[i], PROPAPPENDMODE_REPLACE);
+        }
+
+        env->propSetInt(props, "MedianPerfBytes", (int64_t)framebytes, PROPAPPENDMODE_REPLACE);
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Frame n of one of the source clips
+//////////////////////////////////////////////////////////////////////////////
+PVideoFrame Median::FetchFrame(unsigned int clip, int n, IScriptEnvironment* env)
+{
+    // Frames past the ends are the first or last one, which makes them the
+    // same frame as far as stacking is concerned
+    n = max(0, min(n, info[clip].num_frames - 1));
+
+    TraceScope scope(tracer, "fetch", "clip", clip, "frame", n);
+
+    return clips[clip]->GetFrame(n, env);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Mask of frame n of a clip, the masks of all clips are interleaved
+//////////////////////////////////////////////////////////////////////////////
+PVideoFrame Median::FetchMask(unsigned int clip, int n, IScriptEnvironment* env)
+{
+    n = max(0, min(n, info[clip].num_frames - 1));
+
+    TraceScope scope(tracer, "fetch", "mask", clip, "frame", n);
+
+    return masks->GetFrame(n * depth + clip, env);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Audio, a sample by sample median or blend of all clips
+//
+// Every clip is read at the sync offset of the frame the samples belong to.
+// Samples are mixed in blocks of up to AUDIO_BLOCK samples, a block is cut
+// short where the offset of any clip changes.
+//////////////////////////////////////////////////////////////////////////////
+void __stdcall Median::GetAudio(void* buf, int64_t start, int64_t count, IScriptEnvironment* env)
+{
+    if (!mixaudio)
+    {
+        child->GetAudio(buf, start, count, env);
+        return;
+    }
+
+    const int channels = vi.AudioChannels();
+    const int bytes = vi.BytesPerAudioSample();
+    const int64_t block = min(count, (int64_t)AUDIO_BLOCK);
+
+    vector<unsigned char> buffer((size_t)(block * bytes * depth));
+    void* rows[MAX_DEPTH];
+
+    for (unsigned int i = 0; i < depth; i++)
+        rows[i] = &buffer[(size_t)(i * block * bytes)];
+
+    unsigned char* output = (unsigned char*)buf;
+
+    while (count > 0)
+    {
+        const int frame = vi.FramesFromAudioSamples(max(start, (int64_t)0));
+
+        int offset[MAX_DEPTH];
+        FrameOffsets(frame, offset, env);
+
+        int64_t length = min(count, block);
+
+        for (int next = frame + 1; next < vi.num_frames; next++)
+        {
+            const int64_t boundary = vi.AudioSamplesFromFrames(next);
+
+            if (boundary >= start + length)
+                break;
+
+            if (boundary <= start)
+                continue;
+
+            int following[MAX_DEPTH];
+            FrameOffsets(next, following, env);
+
+            if (!std::equal(offset, offset + depth, following))
+            {
+                length = boundary - start;
+                break;
+            }
+        }
+
+        for (unsigned int i = 0; i < depth; i++)
+        {
+            // Offsets are counted in fields when processing fields
+            int64_t skew = vi.AudioSamplesFromFrames(offset[i]);
+
+            if (fields)
+                skew = skew / 2;
+
+            clips[i]->GetAudio(rows[i], start + skew, length, env);
+        }
+
+        audiosort(rows, depth, 0, (int)length * channels);
+        BlendAudio(rows, low, blend, vi.SampleType(), (int)length * channels, output);
+
+        output = output + length * bytes;
+        start = start + length;
+        count = count - length;
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Sync offset of every clip at frame n, for the audio
+//
+// Frames that have not been rendered yet run the same search GetFrame does,
+// and keep the result for when they are, so the audio of a frame never
+// depends on which frames were rendered before it.
+//////////////////////////////////////////////////////////////////////////////
+void Median::FrameOffsets(int n, int offset[MAX_DEPTH], IScriptEnvironment* env)
+{
+    std::fill(offset, offset + depth, 0);
+
+    if (sync == 0 || vi.num_frames <= 0)
+        return;
+
+    const int frame = max(0, min(n, vi.num_frames - 1));
+
+    if (align)
+    {
+        for (unsigned int i = 1; i < depth; i++)
+            offset[i] = alignment[i].frame[frame] - frame;
+
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(offsetlock);
+
+        const int* known = &frameoffset[(size_t)frame * depth];
+
+        if (known[0] != NO_OFFSET)
+        {
+            std::copy(known, known + depth, offset);
+            return;
+        }
+    }
+
+    double best[MAX_DEPTH] = { 0.0 };
+
+    SyncOffsets(frame, FetchFrame(0, frame, env), offset, best, env);
+
+    std::lock_guard<std::mutex> lock(offsetlock);
+
+    std::copy(offset, offset + depth, frameoffset.begin() + (size_t)frame * depth);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Audio sync offsets of every clip for the segment frame n belongs to
+//
+// All clips of a segment are correlated together on first use and kept, so
+// the audio is only read once per segment.
+//////////////////////////////////////////////////////////////////////////////
+void Median::SyncAudio(int n, AudioMatch match[MAX_DEPTH], IScriptEnvironment* env)
+{
+    const int segment = max(0, min(n, vi.num_frames - 1)) / AUDIO_SEGMENT;
+    const size_t base = (size_t)segment * depth;
+
+    {
+        std::lock_guard<std::mutex> lock(audiolock);
+
+        if (audiodone[segment])
+        {
+            std::copy(audiomatch.begin() + base, audiomatch.begin() + base + depth, match);
+            return;
+        }
+    }
+
+    vector<float> reference;
+    vector<float> envelope;
+
+    const int first = segment * AUDIO_SEGMENT;
+
+    ComputeEnvelope(clips[0], first, AUDIO_SEGMENT, reference, env);
+
+    match[0].count = 0;
+    match[0].reliable = false;
+
+    for (unsigned int i = 1; i < depth; i++)
+    {
+        ComputeEnvelope(clips[i], first - sync, AUDIO_SEGMENT + 2 * sync, envelope, env);
+        CorrelateEnvelopes(reference, envelope, sync, match[i]);
+    }
+
+    std::lock_guard<std::mutex> lock(audiolock);
+
+    std::copy(match, match + depth, audiomatch.begin() + base);
+    audiodone[segment] = true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Sync offset of every clip against the first one at frame n, and how similar
+// the frame it picks is. Offsets are counted in fields when processing fields.
+//
+// The offsets only depend on the frame number, so the video and the audio
+// agree on them whatever order frames are requested in.
+//////////////////////////////////////////////////////////////////////////////
+void Median::SyncOffsets(int n, const PVideoFrame& reference, int match[MAX_DEPTH], double best[MAX_DEPTH], IScriptEnvironment* env)
+{
+    if (fields)
+    {
+        const int first = info[0].IsBFF() ? 1 : 0;
+
+        for (unsigned int i = 1; i < depth; i++)
+        {
+            int radius = 2 * sync;
+
+            for (int k = 0; k <= 2 * radius; k++)
+            {
+                // Most likely offsets first: 0, -1, +1, -2, +2, ...
+                int j = (k & 1) ? -(k + 1) / 2 : k / 2;
+                int unit = 2 * n + j;
+
+                double similarity = CompareFrames(PLANAR_Y, reference, first, FetchFrame(i, unit >> 1, env), (unit & 1) ^ first, samples, best[i]);
+
+                if (similarity > best[i])
+                {
+                    best[i] = similarity;
+                    match[i] = j;
+                }
+            }
+        }
+
+        return;
+    }
+
+    // Frames anywhere in the clips that look like the reference
+    uint64_t hash = 0;
+    vector<int> candidates;
+
+    // Offsets suggested by the audio
+    AudioMatch audio[MAX_DEPTH];
+
+    if (audiosync)
+        SyncAudio(n, audio, env);
+
+    if (hashindex)
+    {
+        if (!indexed)
+            BuildIndex(env);
+
+        FrameSignature signature;
+        ComputeSignature(vi, reference, signature);
+        hash = SignatureHash(signature);
+    }
+
+    for (unsigned int i = 1; i < depth; i++)
+    {
+        int radius = sync;
+
+        if (hashindex)
+        {
+            LookupFrameIndex(frameindex[i], hash, n, INDEX_CANDIDATES, candidates);
+
+            // Offset 0 is still the most likely match
+            candidates.erase(std::remove(candidates.begin(), candidates.end(), n), candidates.end());
+            candidates.insert(candidates.begin(), n);
+
+            for (size_t k = 0; k < candidates.size(); k++)
+            {
+                double similarity = CompareFrames(PLANAR_Y, reference, -1, FetchFrame(i, candidates[k], env), -1, samples, best[i]);
+
+                if (similarity > best[i])
+                {
+                    best[i] = similarity;
+                    match[i] = candidates[k] - n;
+                }
+            }
+
+            // Only fall back to scanning the radius if the index had
+            // nothing similar enough
+            if (best[i] >= INDEX_SIMILARITY)
+                radius = -1;
+        }
+
+        if (audiosync && audio[i].reliable)
+        {
+            // The audio is clear enough on its own. The similarity is
+            // still measured on the video, so that it means the same as
+            // for every other kind of sync.
+            match[i] = audio[i].offset[0];
+            best[i] = CompareFrames(PLANAR_Y, reference, -1, FetchFrame(i, n + match[i], env), -1, samples);
+            radius = -1;
+        }
+        else if (audiosync && audio[i].count > 0)
+        {
+            // Let the video decide between the strongest audio offsets
+            for (unsigned int k = 0; k < audio[i].count; k++)
+            {
+                double similarity = CompareFrames(PLANAR_Y, reference, -1, FetchFrame(i, n + audio[i].offset[k], env), -1, samples, best[i]);
+
+                if (similarity > best[i])
+                {
+                    best[i] = similarity;
+                    match[i] = audio[i].offset[k];
+                }
+            }
+
+            radius = -1;
+        }
+
+        for (int k = 0; k <= 2 * radius; k++)
+        {
+            // Most likely offsets first: 0, -1, +1, -2, +2, ...
+            int j = (k & 1) ? -(k + 1) / 2 : k / 2;
+
+            double similarity = CompareFrames(PLANAR_Y, reference, -1, FetchFrame(i, n + j, env), -1, samples, best[i]);
+
+            if (similarity > best[i])
+            {
+                best[i] = similarity;
+                match[i] = j;
+            }
+        }
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Build the hash index of every clip, done once on first use
+//
+// This decodes every frame of every clip but the first, so the first frame
+// takes as long as a full pass over the sources. Other threads asking for
+// frames wait on indexlock until it is done.
+//////////////////////////////////////////////////////////////////////////////
+void Median::BuildIndex(IScriptEnvironment* env)
+{
+    std::lock_guard<std::mutex> lock(indexlock);
+
+    if (indexed)
+        return;
+
+    vector<FrameSignature> signatures;
+
+    frameindex.resize(depth);
+
+    for (unsigned int i = 1; i < depth; i++)
+    {
+        AnalyseClip(clips[i], signatures, env);
+        BuildFrameIndex(signatures, frameindex[i]);
+
+        debugf("clip %d: %d frames in %d hash buckets", i + 1, (int)signatures.size(), (int)frameindex[i].size());
+    }
+
+    indexed = true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Offset of the first row of a field within a plane
+//
+// Field -1 is the whole frame. Packed RGB is stored bottom up, so which
+// field the first row in memory belongs to depends on the frame height.
+//////////////////////////////////////////////////////////////////////////////
+int Median::FieldOffset(int pitch, int height, int field) const
+{
+    if (field < 0)
+        return 0;
+
+    if (!info[0].IsPlanar() && info[0].IsRGB())
+        return ((field + height - 1) & 1) * pitch;
+
+    return field * pitch;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Compare two frames, or two fields of them
+// 
+// returns 100.0 -> exact match, 0.0 -> completely different
+//
+// The difference is accumulated in chunks, and the comparison gives up as
+// soon as the similarity can no longer get above threshold. In that case
+// the returned value is an upper bound that is at or below threshold.
+//////////////////////////////////////////////////////////////////////////////
+double Median::CompareFrames(int plane, PVideoFrame a, int afield, PVideoFrame b, int bfield, unsigned int points, double threshold)
+{
+    TraceScope scope(tracer, "compare", "points", points);
+   
+    const int height = a->GetHeight(plane);
+
+    const unsigned char* aptr = a->GetReadPtr(plane) + FieldOffset(a->GetPitch(plane), height, afield);
+    const unsigned char* bptr = b->GetReadPtr(plane) + FieldOffset(b->GetPitch(plane), height, bfield);
+
+    const int apitch = a->GetPitch(plane) * (afield < 0 ? 1 : 2);
+    const int bpitch = b->GetPitch(plane) * (bfield < 0 ? 1 : 2);
+
+    const unsigned int width = a->GetRowSize(plane);
+    const unsigned int length = width * (afield < 0 ? height : height / 2);
+
+    if (points < 1 || points > length)
+        points = length;
+
+    const unsigned int step = length / points;
+
+    // Any larger sum means the similarity is at or below threshold
+    const double limit = ((100.0 - threshold) * 255.0 * points) / 100.0;
+
+    unsigned long sum = 0;
+    unsigned int i = 0;
+
+    // Sample i is at row y, column x
+    unsigned int x = 0;
+    unsigned int y = 0;
+
+    while (i < length)
+    {
+        const unsigned int end = (unsigned int)min<unsigned long long>(length, i + (unsigned long long)COMPARE_CHUNK * step);
+
+        for (; i < end; i = i + step)
+        {
+            sum = sum + abs((int)aptr[y * apitch + x] - (int)bptr[y * bpitch + x]);
+
+            x = x + step % width;
+            y = y + step / width;
+
+            if (x >= width)
+            {
+                x = x - width;
+                y++;
+            }
+        }
+
+        if (sum > limit)
+            break;
+    }
+
+    double difference = (100.0 * sum) / (255.0 * points);
+
+    return 100.0 - difference;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Keep every source frame once, counting the clips that show it
+//
+// Sources are the same frame when all their planes are the same memory,
+// as with TemporalMedian at the ends of the clip, a clip passed more than
+// once, or sync picking the same frame twice. Frame contents are not
+// compared, that would take a read of every frame.
+//////////////////////////////////////////////////////////////////////////////
+void Median::StackFrames(PVideoFrame src[MAX_DEPTH], FrameStack& stack) const
+{
+    const bool planar = info[0].IsPlanar() && !info[0].IsY();
+
+    stack.count = 0;
+
+    for (unsigned int i = 0; i < depth; i++)
+    {
+        unsigned int k = 0;
+
+        for (; k < stack.count && stacking; k++)
+        {
+            const PVideoFrame& other = src[stack.source[k]];
+
+            if (src[i]->GetReadPtr() == other->GetReadPtr() && src[i]->GetPitch() == other->GetPitch() &&
+                (!planar || (src[i]->GetReadPtr(PLANAR_U) == other->GetReadPtr(PLANAR_U) && src[i]->GetReadPtr(PLANAR_V) == other->GetReadPtr(PLANAR_V))))
+                break;
+        }
+
+        if (k == stack.count || !stacking)
+        {
+            k = stack.count++;
+            stack.source[k] = i;
+            stack.weight[k] = 0;
+        }
+
+        stack.weight[k] = stack.weight[k] + weight[i];
+        stack.entry[i] = k;
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Source that is the output, -1 if none
+//
+// A frame shown by clips of weightsum - min(low, high) covers every
+// position that is blended, wherever its values fall among the others. For
+// the median that is a strict majority. Float averages of equal values can
+// round, so for those only a single position counts. Components left alone
+// come from the first clip, so without chroma only its frame is shared.
+//
+// Only with stacking, where every clip is read the same way. Otherwise a
+// clip is shifted, read in fields, masked or measured for the map, and its
+// frame as it is is not the output, however much it weighs.
+//////////////////////////////////////////////////////////////////////////////
+int Median::MajorityFrame(const FrameStack& stack) const
+{
+    if (info[0].ComponentSize() == 4 && blend > 1)
+        return -1;
+
+    // Windows over space change the frame even where every source agrees
+    if (!stacking || spatial > 0)
+        return -1;
+
+    for (unsigned int k = 0; k < stack.count && (processchroma || k == 0); k++)
+    {
+        if (stack.weight[k] >= weightsum - min(low, high))
+            return (int)stack.source[k];
+    }
+
+    return -1;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Whether sources are processed with their weights, for clips given weights
+// or where merged sources save work over the selection networks. Float sums
+// would round differently.
+//////////////////////////////////////////////////////////////////////////////
+bool Median::Weighted(const FrameStack& stack) const
+{
+    return (stack.count < depth || weightsum != depth) && info[0].ComponentSize() != 4 && !(fastprocess && info[0].ComponentSize() == 1);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// New reference to the pixels of a frame, with properties of its own
+//////////////////////////////////////////////////////////////////////////////
+PVideoFrame Median::ShareFrame(const PVideoFrame& frame, IScriptEnvironment* env) const
+{
+    if (!info[0].IsPlanar() || info[0].IsY())
+        return env->Subframe(frame, 0, frame->GetPitch(), frame->GetRowSize(), frame->GetHeight());
+
+    if (info[0].IsYUVA() || info[0].IsPlanarRGBA())
+        return env->SubframePlanarA(frame, 0, frame->GetPitch(), frame->GetRowSize(), frame->GetHeight(), 0, 0, frame->GetPitch(PLANAR_U), 0);
+
+    return env->SubframePlanar(frame, 0, frame->GetPitch(), frame->GetRowSize(), frame->GetHeight(), 0, 0, frame->GetPitch(PLANAR_U));
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Image processing for a whole frame, or one field of it
+//////////////////////////////////////////////////////////////////////////////
+void Median::ProcessFrame(PVideoFrame src[MAX_DEPTH], const int field[MAX_DEPTH], const SourceShift& shift, const FrameStack& stack, const PVideoFrame* mask, PVideoFrame& dst, int dstfield, MapStats* map, IScriptEnvironment* env)
+{
+    if (spatial > 0)
+    {
+        ProcessVolume(src, dst, env);
+        return;
+    }
+
+    ProcessPlane(PLANAR_Y, src, field, shift, stack, mask, dst, dstfield, map);
+
+    // Interleaved formats carry all components in the first plane
+    if (info[0].IsPlanar() && !info[0].IsY())
+    {
+        if (processchroma || showmap)
+        {
+            ProcessPlane(PLANAR_U, src, field, shift, stack, mask, dst, dstfield, map);
+            ProcessPlane(PLANAR_V, src, field, shift, stack, mask, dst, dstfield, map);
+        }
+        else
+        {
+            CopyPlane(PLANAR_U, src[0], field[0], dst, dstfield, env);
+            CopyPlane(PLANAR_V, src[0], field[0], dst, dstfield, env);
+        }
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Median of the window of spatial radius around every pixel, over all the
+// frames of the temporal window at once, in a single pass of the window
+// networks. Planes left alone come from the frame in the middle.
+//////////////////////////////////////////////////////////////////////////////
+void Median::ProcessVolume(PVideoFrame src[MAX_DEPTH], PVideoFrame& dst, IScriptEnvironment* env)
+{
+    TraceScope scope(tracer, "volume");
+
+    const PVideoFrame& middle = src[low];
+
+    for (size_t p = 0; p < volumecopied.size(); p++)
+    {
+        const int plane = volumecopied[p];
+
+        env->BitBlt(dst->GetWritePtr(plane), dst->GetPitch(plane), middle->GetReadPtr(plane), middle->GetPitch(plane), middle->GetRowSize(plane), middle->GetHeight(plane));
+    }
+
+    vector<unsigned char> scratch;
+
+    for (size_t c = 0; c < volumechannels.size(); c++)
+        WindowMedians(volume, volumechannels[c], src, dst, scratch);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Copy of a plane, or one field of it, that is not processed
+//
+// The first clip is never shifted, so its plane is taken as it is. Frames
+// can not be put together from planes of other frames, so this is a blit
+// rather than a reference.
+//////////////////////////////////////////////////////////////////////////////
+void Median::CopyPlane(int plane, const PVideoFrame& src, int field, PVideoFrame& dst, int dstfield, IScriptEnvironment* env) const
+{
+    const unsigned char* srcp = src->GetReadPtr(plane) + FieldOffset(src->GetPitch(plane), src->GetHeight(plane), field);
+    const int src_pitch = src->GetPitch(plane) * (field < 0 ? 1 : 2);
+
+    unsigned char* dstp = dst->GetWritePtr(plane) + FieldOffset(dst->GetPitch(plane), dst->GetHeight(plane), dstfield);
+    const int dst_pitch = dst->GetPitch(plane) * (dstfield < 0 ? 1 : 2);
+
+    const int height = dstfield < 0 ? src->GetHeight(plane) : src->GetHeight(plane) / 2;
+
+    env->BitBlt(dstp, dst_pitch, srcp, src_pitch, src->GetRowSize(plane), height);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Processing of a single plane
+//
+// Every source is read at its own shift from the output position, by
+// offsetting its read pointers. Where a shifted read would fall outside of
+// the frame, that source is read at the unshifted position instead. Row
+// shifts are taken from the luma row the plane row belongs to. Masks come
+// with whole frames of unshifted sources only.
+//////////////////////////////////////////////////////////////////////////////
+void Median::ProcessPlane(int plane, PVideoFrame src[MAX_DEPTH], const int field[MAX_DEPTH], const SourceShift& shift, const FrameStack& stack, const PVideoFrame* mask, PVideoFrame& dst, int dstfield, MapStats* map)
+{
+    TraceScope scope(tracer, "process", "plane", plane, "field", dstfield);
+
+    const bool planar = info[0].IsPlanar();
+
+    // Dimensions, in the units processed at a time: samples of a planar
+    // plane, or pixels of an interleaved frame
+    const int unit = planar ? info[0].ComponentSize() : info[0].BytesFromPixels(1);
+    const int width = planar ? src[0]->GetRowSize(plane) / unit : info[0].width;
+    const int height = dstfield < 0 ? src[0]->GetHeight(plane) : src[0]->GetHeight(plane) / 2;
+
+    // Source of every stack entry, fields are addressed in place by
+    // skipping every other row
+    const unsigned char* srcp[MAX_DEPTH];
+    int src_pitch[MAX_DEPTH];
+
+    for (unsigned int r = 0; r < stack.count; r++)
+    {
+        const unsigned int i = stack.source[r];
+
+        srcp[r] = src[i]->GetReadPtr(plane) + FieldOffset(src[i]->GetPitch(plane), src[i]->GetHeight(plane), field[i]);
+        src_pitch[r] = src[i]->GetPitch(plane) * (field[i] < 0 ? 1 : 2);
+    }
+
+    // Destination
+    unsigned char* dstp = dst->GetWritePtr(plane) + FieldOffset(dst->GetPitch(plane), dst->GetHeight(plane), dstfield);
+    const int dst_pitch = dst->GetPitch(plane) * (dstfield < 0 ? 1 : 2);
 
-    if (temporal)
+    // Shift of every source in units and rows of this plane
+    int ssx = 0;
+    int ssy = 0;
+
+    if (planar && plane != PLANAR_Y && info[0].IsYUV())
     {
-        unsigned int radius = low; // low == high == radius
+        ssx = info[0].GetPlaneWidthSubsampling(plane);
+        ssy = info[0].GetPlaneHeightSubsampling(plane);
+    }
 
-        // TODO: Do I need to worry about negative frames or frames after the last? Looks like no
-        for (unsigned int i = 0; i < depth; i++)
-            src[i] = clips[0]->GetFrame(n - radius + i, env); // Grab an equal number of preceding and following frames
+    int ux[MAX_DEPTH];
+    int uy[MAX_DEPTH];
+
+    for (unsigned int r = 0; r < stack.count; r++)
+    {
+        const unsigned int i = stack.source[r];
+
+        uy[r] = (dstfield < 0 ? shift.y[i] : shift.y[i] / 2) >> ssy;
     }
-    else if (sync > 0)
+
+    // Process, a band of rows at a time so that the trace shows how the
+    // time is spread over the plane
+    for (int band = 0; band < height; band = band + TRACE_ROWS)
     {
-        src[0] = clips[0]->GetFrame(n, env);
+        TraceScope rows(tracer, "rows", "first", band, "count", min(TRACE_ROWS, height - band));
 
-        for (unsigned int i = 1; i < depth; i++)
+        for (int y = band; y < min(band + TRACE_ROWS, height); ++y)
         {
-            int radius = sync;
+            // Columns where every shifted read stays inside the row
+            int left = 0;
+            int right = width;
 
-            for (int j = -radius; j <= radius; j++)
+            for (unsigned int r = 0; r < stack.count; r++)
             {
-                double similarity = CompareFrames(PLANAR_Y, src[0], clips[i]->GetFrame(n + j, env), samples);
+                const unsigned int i = stack.source[r];
 
-                if (similarity > best[i])
-                {
-                    best[i] = similarity;
-                    match[i] = j;
-                }
-            }
+                int sx = shift.x[i];
 
-            src[i] = clips[i]->GetFrame(n + match[i], env);
-        }
-    }
-    else
-    {
-        for (unsigned int i = 0; i < depth; i++)
-            src[i] = clips[i]->GetFrame(n, env);
-    }
+                if (!shift.row[i].empty())
+                    sx = sx + shift.row[i][min(y << ssy, (int)shift.row[i].size() - 1)];
 
-	// Output
-    PVideoFrame output = env->NewVideoFrame(vi);
+                ux[r] = sx >> ssx;
 
-    // Select between planar and interleaved processing
-    if (info[0].IsPlanar())
-        ProcessPlanarFrame(src, output);
-    else
-        ProcessInterleavedFrame(src, output);
+                if (info[0].IsYUY2())
+                    ux[r] = ux[r] & ~1; // Keep U and V in place
 
-    // Print debug information on output image
-    if (debug)
-    {
-        line = 0;
-        textf(output, "FRAME: %d", n);
-        textf(output, "CLIPS: %d", depth);
+                left = max(left, -ux[r]);
+                right = min(right, width - ux[r]);
+            }
 
-        if (sync > 0)
-        {
-            textf(output, "SYNC RADIUS: %d", sync);
-            textf(output, "SYNC METRICS:");
+            left = min(left, width);
+            right = max(right, left);
 
-            for (unsigned int i = 1; i < depth; i++)
-                textf(output, "%-2d %+-3d %-f", i + 1, match[i], best[i]);
-        }
-    }
+            const unsigned char* rowp[MAX_DEPTH];
 
-    return output;
-}
+            for (unsigned int r = 0; r < stack.count; r++)
+            {
+                int row = y + uy[r];
 
+                if (row < 0 || row >= height)
+                    row = y;
 
-//////////////////////////////////////////////////////////////////////////////
-// Compare two frames
-// 
-// returns 100.0 -> exact match, 0.0 -> completely different
-//////////////////////////////////////////////////////////////////////////////
-double Median::CompareFrames(int plane, PVideoFrame a, PVideoFrame b, unsigned int points)
-{   
-    const unsigned char* aptr = a->GetReadPtr(plane);
-    const unsigned char* bptr = b->GetReadPtr(plane);
+                rowp[r] = srcp[r] + row * src_pitch[r] + ux[r] * unit;
+            }
 
-    const unsigned int length = a->GetRowSize(plane) * a->GetHeight(plane);
+            const unsigned char* maskp[MAX_DEPTH];
 
-    if (points < 1 || points > length)
-        points = length;
+            for (unsigned int r = 0; r < stack.count && mask != NULL; r++)
+                maskp[r] = mask[r]->GetReadPtr(plane) + y * mask[r]->GetPitch(plane);
 
-    const unsigned int step = length / points;
+            unsigned char* dstrow = dstp + y * dst_pitch;
 
-    unsigned long sum = 0;
+            ProcessSpan(plane, rowp, mask != NULL ? maskp : NULL, stack, dstrow, left, right, unit, map);
 
-    for (unsigned int i = 0; i < length; i = i + step)
-        sum = sum + abs((int)aptr[i] - (int)bptr[i]);
+            // Columns near the edges, one at a time
+            for (int x = 0; x < width; x++)
+            {
+                if (x == left)
+                    x = right;
 
-    double difference = (100.0 * sum) / (255.0 * points);
+                if (x >= width)
+                    break;
 
-    return 100.0 - difference;
+                const unsigned char* edgep[MAX_DEPTH];
+
+                for (unsigned int r = 0; r < stack.count; r++)
+                {
+                    if (x + ux[r] >= 0 && x + ux[r] < width)
+                        edgep[r] = rowp[r];
+                    else
+                        edgep[r] = rowp[r] - ux[r] * unit;
+                }
+
+                ProcessRow(plane, edgep, stack, dstrow, x, x + 1, map);
+            }
+        }
+    }
 }
 
 
 //////////////////////////////////////////////////////////////////////////////
-// Image processing for planar images
+// Processing of columns x0 to x1 of a row a tile at a time. Tiles where all
+// sources hold the same bytes are copied from the first one. With masks,
+// tiles where no value is masked out are processed as they are. In the luma
+// of the map, every clip is at distance 0 in such a tile.
 //////////////////////////////////////////////////////////////////////////////
-void Median::ProcessPlanarFrame(PVideoFrame src[MAX_DEPTH], PVideoFrame& dst)
+void Median::ProcessSpan(int plane, const unsigned char* srcp[MAX_DEPTH], const unsigned char* const* maskp, const FrameStack& stack, unsigned char* dstp, int x0, int x1, int unit, MapStats* map)
 {
-    ProcessPlane(PLANAR_Y, src, dst);
-    ProcessPlane(PLANAR_U, src, dst);
-    ProcessPlane(PLANAR_V, src, dst);
+    const bool mapped = map != NULL && plane == PLANAR_Y;
+
+    // The chroma of the map is grey throughout
+    if (!agreetiles || (map != NULL && showmap && !mapped))
+    {
+        ProcessRow(plane, srcp, stack, dstp, x0, x1, map);
+        return;
+    }
+
+    const int step = max(AGREE_TILE / unit, 1);
+
+    for (int x = x0; x < x1; x = x + step)
+    {
+        const int end = min(x + step, x1);
+
+        const unsigned char* tile[MAX_DEPTH];
+        const unsigned char* masktile[MAX_DEPTH];
+
+        for (unsigned int r = 0; r < stack.count; r++)
+            tile[r] = srcp[r] + x * unit;
+
+        for (unsigned int r = 0; r < stack.count && maskp != NULL; r++)
+            masktile[r] = maskp[r] + x * unit;
+
+        if (agree(tile, stack.count, (end - x) * unit))
+        {
+            if (mapped)
+                map->samples = map->samples + (end - x);
+
+            if (mapped && showmap)
+                memset(dstp + x * unit, 0, (end - x) * unit);
+            else
+                memcpy(dstp + x * unit, tile[0], (end - x) * unit);
+        }
+        else if (maskp == NULL || valid(masktile, stack.count, (end - x) * unit))
+            ProcessRow(plane, srcp, stack, dstp, x, end, map);
+        else
+            ProcessRowMasked(srcp, maskp, dstp, x, end);
+    }
 }
 
 
 //////////////////////////////////////////////////////////////////////////////
-// Processing of a single plane
+// Processing of columns x0 to x1 of a row
 //////////////////////////////////////////////////////////////////////////////
-void Median::ProcessPlane(int plane, PVideoFrame src[MAX_DEPTH], PVideoFrame& dst)
+void Median::ProcessRow(int plane, const unsigned char* srcp[MAX_DEPTH], const FrameStack& stack, unsigned char* dstp, int x0, int x1, MapStats* map)
 {
-    // Source
-    const unsigned char* srcp[MAX_DEPTH];
+    if (Weighted(stack))
+    {
+        ProcessRowWeighted(srcp, stack, dstp, x0, x1);
+        return;
+    }
 
-    for (unsigned int i = 0; i < depth; i++)
-        srcp[i] = src[i]->GetReadPtr(plane);
-    
-    // Destination
-    unsigned char* dstp = dst->GetWritePtr(plane);
+    // Otherwise every clip reads its entry again
+    const unsigned char* rows[MAX_DEPTH];
+
+    if (stack.count < depth)
+    {
+        for (unsigned int i = 0; i < depth; i++)
+            rows[i] = srcp[stack.entry[i]];
 
-    // Dimensions
-    const int width = src[0]->GetRowSize(plane);
-    const int height = src[0]->GetHeight(plane);
+        srcp = rows;
+    }
 
-    // Process
-    for (int y = 0; y < height; ++y)
+    if (info[0].IsPlanar() && map != NULL && plane == PLANAR_Y)
     {
-        for (int x = 0; x < width; ++x)
+        //////////////////////////////////////////////////////////////////////
+        // Planar luma, with the distance of every clip from the output
+        //////////////////////////////////////////////////////////////////////
+        for (int x = x0; x < x1; ++x)
         {
             unsigned char values[MAX_DEPTH];
 
             for (unsigned int i = 0; i < depth; i++)
                 values[i] = srcp[i][x];
 
-            if (plane == PLANAR_Y || processchroma == true)
-                dstp[x] = ProcessPixel(values);
-            else
-                dstp[x] = values[0]; // Use values from first clip
-        }
+            const int output = ProcessPixel(values);
 
-        for (unsigned int i = 0; i < depth; i++)
-            srcp[i] = srcp[i] + src[i]->GetPitch(plane);
+            int largest = 0;
+            bool outlier = false;
+
+            for (unsigned int i = 0; i < depth; i++)
+            {
+                const int distance = abs(srcp[i][x] - output);
+
+                largest = max(largest, distance);
+                map->deviation[i] = map->deviation[i] + distance;
+
+                if (distance > (int)mapthreshold)
+                {
+                    map->outliers[i]++;
+                    outlier = true;
+                }
+            }
+
+            map->disagreeing = map->disagreeing + (outlier ? 1 : 0);
+
+            dstp[x] = (unsigned char)(showmap ? largest : output);
+        }
 
-        dstp = dstp + dst->GetPitch(plane);
+        map->samples = map->samples + (x1 - x0);
     }
-}
+    else if (info[0].IsPlanar() && showmap)
+    {
+        //////////////////////////////////////////////////////////////////////
+        // Planar chroma of the map, grey
+        //////////////////////////////////////////////////////////////////////
+        memset(dstp + x0, 128, x1 - x0);
+    }
+    else if (info[0].IsPlanar() && info[0].ComponentSize() == 2)
+    {
+        //////////////////////////////////////////////////////////////////////
+        // Planar, 10 to 16 bits
+        //////////////////////////////////////////////////////////////////////
+        uint16_t* out = (uint16_t*)dstp;
 
+        for (int x = x0; x < x1; ++x)
+        {
+            uint16_t values[MAX_DEPTH];
 
-//////////////////////////////////////////////////////////////////////////////
-// Image processing for interleaved images
-//////////////////////////////////////////////////////////////////////////////
-void Median::ProcessInterleavedFrame(PVideoFrame src[MAX_DEPTH], PVideoFrame& dst)
-{
-    // Source
-    const unsigned char* srcp[MAX_DEPTH];
+            for (unsigned int i = 0; i < depth; i++)
+                values[i] = ((const uint16_t*)srcp[i])[x];
 
-    for (unsigned int i = 0; i < depth; i++)
-        srcp[i] = src[i]->GetReadPtr();
+            out[x] = ProcessPixel_16bit(values);
+        }
+    }
+    else if (info[0].IsPlanar() && info[0].ComponentSize() == 4)
+    {
+        //////////////////////////////////////////////////////////////////////
+        // Planar, 32-bit float
+        //////////////////////////////////////////////////////////////////////
+        float* out = (float*)dstp;
 
-    // Destination
-    unsigned char* dstp = dst->GetWritePtr();
+        for (int x = x0; x < x1; ++x)
+        {
+            float values[MAX_DEPTH];
+
+            for (unsigned int i = 0; i < depth; i++)
+                values[i] = ((const float*)srcp[i])[x];
+
+            out[x] = ProcessPixel_float(values);
+        }
+    }
+    else if (info[0].IsPlanar())
+    {
+        //////////////////////////////////////////////////////////////////////
+        // Planar
+        //////////////////////////////////////////////////////////////////////
+        for (int x = x0; x < x1; ++x)
+        {
+            unsigned char values[MAX_DEPTH];
 
-    // Dimensions
-    const int width = info[0].width;
-    const int height = info[0].height;
+            for (unsigned int i = 0; i < depth; i++)
+                values[i] = srcp[i][x];
 
-    // Process
-    if (info[0].IsYUY2())
+            dstp[x] = ProcessPixel(values);
+        }
+    }
+    else if (info[0].IsYUY2())
     {
         //////////////////////////////////////////////////////////////////////
         // YUYV
@@ -253,24 +1656,16 @@ void Median::ProcessInterleavedFrame(PVideoFrame src[MAX_DEPTH], PVideoFrame& ds
         unsigned char luma[MAX_DEPTH];
         unsigned char chroma[MAX_DEPTH];
 
-        for (int y = 0; y < height; ++y)
+        for (int x = x0; x < x1; x++)
         {
-            for (int x = 0; x < width; x++)
+            for (unsigned int i = 0; i < depth; i++)
             {
-                for (unsigned int i = 0; i < depth; i++)
-                {
-                    luma[i] = srcp[i][x * 2];
-                    chroma[i] = srcp[i][x * 2 + 1];
-                }
-
-                dstp[x * 2] = ProcessPixel(luma);
-                dstp[x * 2 + 1] = processchroma ? ProcessPixel(chroma) : chroma[0];
+                luma[i] = srcp[i][x * 2];
+                chroma[i] = srcp[i][x * 2 + 1];
             }
 
-            for (unsigned int i = 0; i < depth; i++)
-                srcp[i] = srcp[i] + src[i]->GetPitch();
-
-            dstp = dstp + dst->GetPitch();
+            dstp[x * 2] = ProcessPixel(luma);
+            dstp[x * 2 + 1] = processchroma ? ProcessPixel(chroma) : chroma[0];
         }
     }
     else if (info[0].IsRGB24())
@@ -282,26 +1677,18 @@ void Median::ProcessInterleavedFrame(PVideoFrame src[MAX_DEPTH], PVideoFrame& ds
         unsigned char g[MAX_DEPTH];
         unsigned char r[MAX_DEPTH];
 
-        for (int y = 0; y < height; ++y)
+        for (int x = x0; x < x1; x++)
         {
-            for (int x = 0; x < width; x++)
+            for (unsigned int i = 0; i < depth; i++)
             {
-                for (unsigned int i = 0; i < depth; i++)
-                {
-                    b[i] = srcp[i][x * 3];
-                    g[i] = srcp[i][x * 3 + 1];
-                    r[i] = srcp[i][x * 3 + 2];
-                }
-
-                dstp[x * 3] = ProcessPixel(b);
-                dstp[x * 3 + 1] = ProcessPixel(g);
-                dstp[x * 3 + 2] = ProcessPixel(r);
+                b[i] = srcp[i][x * 3];
+                g[i] = srcp[i][x * 3 + 1];
+                r[i] = srcp[i][x * 3 + 2];
             }
 
-            for (unsigned int i = 0; i < depth; i++)
-                srcp[i] = srcp[i] + src[i]->GetPitch();
-
-            dstp = dstp + dst->GetPitch();
+            dstp[x * 3] = ProcessPixel(b);
+            dstp[x * 3 + 1] = ProcessPixel(g);
+            dstp[x * 3 + 2] = ProcessPixel(r);
         }
     }
     else if (info[0].IsRGB32())
@@ -314,30 +1701,23 @@ void Median::ProcessInterleavedFrame(PVideoFrame src[MAX_DEPTH], PVideoFrame& ds
         unsigned char r[MAX_DEPTH];
         unsigned char a[MAX_DEPTH];
 
-        for (int y = 0; y < height; ++y)
+        for (int x = x0; x < x1; x++)
         {
-            for (int x = 0; x < width; x++)
+            for (unsigned int i = 0; i < depth; i++)
             {
-                for (unsigned int i = 0; i < depth; i++)
-                {
-                    b[i] = srcp[i][x * 4];
-                    g[i] = srcp[i][x * 4 + 1];
-                    r[i] = srcp[i][x * 4 + 2];
-                    a[i] = srcp[i][x * 4 + 3];
-                }
-
-                dstp[x * 4] = ProcessPixel(b);
-                dstp[x * 4 + 1] = ProcessPixel(g);
-                dstp[x * 4 + 2] = ProcessPixel(r);
-                dstp[x * 4 + 3] = processchroma ? ProcessPixel(a) : a[0];
+                b[i] = srcp[i][x * 4];
+                g[i] = srcp[i][x * 4 + 1];
+                r[i] = srcp[i][x * 4 + 2];
+                a[i] = srcp[i][x * 4 + 3];
             }
 
-            for (unsigned int i = 0; i < depth; i++)
-                srcp[i] = srcp[i] + src[i]->GetPitch();
-
-            dstp = dstp + dst->GetPitch();
+            dstp[x * 4] = ProcessPixel(b);
+            dstp[x * 4 + 1] = ProcessPixel(g);
+            dstp[x * 4 + 2] = ProcessPixel(r);
+            dstp[x * 4 + 3] = processchroma ? ProcessPixel(a) : a[0];
         }
-    }else if (info[0].pixel_type == VideoInfo::CS_BGR64)
+    }
+    else if (info[0].pixel_type == VideoInfo::CS_BGR64)
     {
         //////////////////////////////////////////////////////////////////////
         // BGRA
@@ -347,39 +1727,202 @@ void Median::ProcessInterleavedFrame(PVideoFrame src[MAX_DEPTH], PVideoFrame& ds
         std::uint16_t r_16bit[MAX_DEPTH];
         std::uint16_t a_16bit[MAX_DEPTH];
 
-        for (int y = 0; y < height; ++y)
+        for (int x = x0; x < x1; x++)
         {
-            for (int x = 0; x < width; x++)
+            for (unsigned int i = 0; i < depth; i++)
             {
-                for (unsigned int i = 0; i < depth; i++)
-                {
-                 b_16bit[i] = srcp[i][x * 8 + 0] | (srcp[i][x * 8 + 1] << 8);
-                 g_16bit[i] = srcp[i][x * 8 + 2] | (srcp[i][x * 8 + 3] << 8);
-                 r_16bit[i] = srcp[i][x * 8 + 4] | (srcp[i][x * 8 + 5] << 8);
-                 a_16bit[i] = srcp[i][x * 8 + 6] | (srcp[i][x * 8 + 7] << 8);
-             }
+                b_16bit[i] = srcp[i][x * 8 + 0] | (srcp[i][x * 8 + 1] << 8);
+                g_16bit[i] = srcp[i][x * 8 + 2] | (srcp[i][x * 8 + 3] << 8);
+                r_16bit[i] = srcp[i][x * 8 + 4] | (srcp[i][x * 8 + 5] << 8);
+                a_16bit[i] = srcp[i][x * 8 + 6] | (srcp[i][x * 8 + 7] << 8);
+            }
+
+            uint16_t median_b = ProcessPixel_16bit(b_16bit);
+            uint16_t median_g = ProcessPixel_16bit(g_16bit);
+            uint16_t median_r = ProcessPixel_16bit(r_16bit);
+            uint16_t median_a = processchroma ? ProcessPixel_16bit(a_16bit) : a_16bit[0]; // Sorts in place
+
+            dstp[x * 8] = static_cast<BYTE>(median_b);
+            dstp[x * 8 + 1] = static_cast<BYTE>(median_b >> 8);
+            dstp[x * 8 + 2] = static_cast<BYTE>(median_g);
+            dstp[x * 8 + 3] = static_cast<BYTE>(median_g >> 8);
+            dstp[x * 8 + 4] = static_cast<BYTE>(median_r);
+            dstp[x * 8 + 5] = static_cast<BYTE>(median_r >> 8);
+            dstp[x * 8 + 6] = static_cast<BYTE>(median_a);
+            dstp[x * 8 + 7] = static_cast<BYTE>(median_a >> 8);
+        }
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Processing of columns x0 to x1 of a row from a stack of weighted sources,
+// integer formats
+//////////////////////////////////////////////////////////////////////////////
+void Median::ProcessRowWeighted(const unsigned char* srcp[MAX_DEPTH], const FrameStack& stack, unsigned char* dstp, int x0, int x1) const
+{
+    // Samples per unit of x, and the ones kept from the first clip
+    const int per = info[0].IsPlanar() ? 1 : info[0].IsYUY2() ? 2 : info[0].IsRGB24() ? 3 : 4;
+    int keep = 0;
+
+    if (!processchroma && info[0].IsYUY2())
+        keep = 1 << 1;
+    else if (!processchroma && !info[0].IsPlanar() && per == 4)
+        keep = 1 << 3;
+
+    const int size = info[0].ComponentSize();
+    const vector<Comparator>& network = weightnetwork[stack.count];
+
+    weightedrow(srcp, stack.weight, stack.count, network.data(), network.size(), low, blend, dstp, x0 * per, x1 * per);
+
+    // Components left alone come from the first clip
+    for (int s = x0 * per; s < x1 * per && keep != 0; s++)
+    {
+        if (keep & (1 << (s % per)))
+            memcpy(dstp + s * size, srcp[0] + s * size, size);
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Processing of columns x0 to x1 of a row with masks, integer formats
+//////////////////////////////////////////////////////////////////////////////
+void Median::ProcessRowMasked(const unsigned char* srcp[MAX_DEPTH], const unsigned char* const* maskp, unsigned char* dstp, int x0, int x1) const
+{
+    // Samples per unit of x, and the ones kept from the first clip
+    const int per = info[0].IsPlanar() ? 1 : info[0].IsYUY2() ? 2 : info[0].IsRGB24() ? 3 : 4;
+    int keep = 0;
+
+    if (!processchroma && info[0].IsYUY2())
+        keep = 1 << 1;
+    else if (!processchroma && !info[0].IsPlanar() && per == 4)
+        keep = 1 << 3;
+
+    const int size = info[0].ComponentSize();
+
+    maskedrow(srcp, maskp, depth, masknetwork.data(), masknetwork.size(), low, high, dstp, x0 * per, x1 * per);
+
+    // Components left alone come from the first clip
+    for (int s = x0 * per; s < x1 * per && keep != 0; s++)
+    {
+        if (keep & (1 << (s % per)))
+            memcpy(dstp + s * size, srcp[0] + s * size, size);
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Estimate the global shift of every clip against the first one
+//
+// Frames are grouped in segments of SHIFT_SEGMENT. The shift of a clip is
+// estimated once per segment and sync offset, always from the first frame
+// of the segment, so it only depends on the frame number and not on the
+// order frames are rendered in. A frame without enough detail gives no
+// shift.
+//////////////////////////////////////////////////////////////////////////////
+void Median::EstimateShifts(int n, const int match[MAX_DEPTH], SourceShift& shift, IScriptEnvironment* env)
+{
+    TraceScope scope(tracer, "shift");
+
+    const int segment = max(0, min(n, vi.num_frames - 1)) / SHIFT_SEGMENT;
+    const int first = segment * SHIFT_SEGMENT;
+
+    vector<unsigned char> reference_buffer;
+    vector<unsigned char> image_buffer;
+
+    LumaImage reference;
+    LumaImage image;
+
+    PVideoFrame frame;
+
+    for (unsigned int i = 1; i < depth; i++)
+    {
+        vector<ShiftCache>& cache = shiftcache[(size_t)segment * depth + i];
+
+        {
+            std::lock_guard<std::mutex> lock(shiftlock);
+
+            auto found = std::find_if(cache.begin(), cache.end(), [&](const ShiftCache& entry) { return entry.offset == match[i]; });
+
+            if (found != cache.end())
+            {
+                shift.x[i] = found->x;
+                shift.y[i] = found->y;
+                continue;
+            }
+        }
+
+        if (!frame)
+        {
+            frame = FetchFrame(0, first, env);
+            GetLuma(info[0], frame, reference_buffer, reference);
+        }
+
+        // Offsets are counted in fields when processing fields
+        const int source = fields ? (2 * first + match[i]) >> 1 : first + match[i];
+
+        const PVideoFrame other = FetchFrame(i, source, env);
+
+        GetLuma(info[i], other, image_buffer, image);
+
+        EstimateShift(reference, image, shiftrange, sad, shift.x[i], shift.y[i]);
+
+        std::lock_guard<std::mutex> lock(shiftlock);
+
+        if (std::none_of(cache.begin(), cache.end(), [&](const ShiftCache& entry) { return entry.offset == match[i]; }))
+        {
+            ShiftCache entry = { match[i], shift.x[i], shift.y[i] };
+            cache.push_back(entry);
+        }
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Estimate the horizontal shift of every luma row of every clip against the
+// first clip, on top of its global shift
+//
+// Rows are compared in the geometry they are processed in, so in fields
+// mode only the rows of the fields being combined are looked at.
+//////////////////////////////////////////////////////////////////////////////
+void Median::EstimateJitter(PVideoFrame src[MAX_DEPTH], const int field[MAX_DEPTH], SourceShift& shift)
+{
+    TraceScope scope(tracer, "jitter");
+
+    vector<unsigned char> reference_buffer;
+    vector<unsigned char> image_buffer;
 
-             uint16_t median_b = ProcessPixel_16bit(b_16bit);
-             uint16_t median_g = ProcessPixel_16bit(g_16bit);
-             uint16_t median_r = ProcessPixel_16bit(r_16bit);
-             uint16_t median_a = ProcessPixel_16bit(a_16bit);
+    LumaImage reference;
+    LumaImage image;
 
-             dstp[x * 8] = static_cast<BYTE>(median_b);
-             dstp[x * 8 + 1] = static_cast<BYTE>(median_b >> 8);
-             dstp[x * 8 + 2] = static_cast<BYTE>(median_g);
-             dstp[x * 8 + 3] = static_cast<BYTE>(median_g >> 8);
-             dstp[x * 8 + 4] = static_cast<BYTE>(median_r);
-             dstp[x * 8 + 5] = static_cast<BYTE>(median_r >> 8);
-             dstp[x * 8 + 6] = static_cast<BYTE>(processchroma ? median_a : a_16bit[0]);
-             dstp[x * 8 + 7] = static_cast<BYTE>(processchroma ? median_a >> 8 : a_16bit[0] >> 8);
-         }
+    GetLuma(info[0], src[0], reference_buffer, reference);
+    FieldLuma(reference, field[0]);
 
-         for (unsigned int i = 0; i < depth; i++)
-            srcp[i] = srcp[i] + src[i]->GetPitch();
+    for (unsigned int i = 1; i < depth; i++)
+    {
+        GetLuma(info[i], src[i], image_buffer, image);
+        FieldLuma(image, field[i]);
+
+        const int dy = field[0] < 0 ? shift.y[i] : shift.y[i] / 2;
 
-        dstp = dstp + dst->GetPitch();
+        shift.row[i].resize(reference.height);
+
+        EstimateRowShifts(reference, image, shift.x[i], dy, jitterrange, sad, &shift.row[i][0]);
     }
 }
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Restrict a luma image to the rows of one field, field -1 keeps all rows
+//////////////////////////////////////////////////////////////////////////////
+void Median::FieldLuma(LumaImage& image, int field) const
+{
+    if (field < 0)
+        return;
+
+    image.ptr = image.ptr + FieldOffset(image.pitch, image.height, field);
+    image.pitch = image.pitch * 2;
+    image.height = image.height / 2;
 }
 
 
@@ -403,6 +1946,19 @@ inline uint16_t Median::ProcessPixel_16bit(uint16_t* values) const
     return output;
 }
 
+inline float Median::ProcessPixel_float(float* values) const
+{
+    float sum = 0.0f;
+
+    if (blend != depth)
+        std::sort(values, values + depth);
+
+    for (unsigned int i = low; i < low + blend; i++)
+        sum = sum + values[i];
+
+    return sum / blend;
+}
+
 inline unsigned char Median::ProcessPixel(unsigned char* values) const
 {
     unsigned char output;
@@ -436,14 +1992,14 @@ void Median::debugf(const char* fmt, ...)
     if (debug)
     {
         char buffer[1024] = { "median: " };
-        char *ptr = buffer + strlen(buffer);
+        const size_t prefix = strlen(buffer);
 
         va_list args;
         va_start(args, fmt);
-        snprintf(ptr, sizeof buffer, fmt, args);
+        vsnprintf(buffer + prefix, sizeof(buffer) - prefix, fmt, args);
         va_end(args);
 
-        std::clog << buffer;
+        std::clog << buffer << std::endl;
     }
 }
 
@@ -453,26 +2009,16 @@ void Median::debugf(const char* fmt, ...)
 //////////////////////////////////////////////////////////////////////////////
 void Median::textf(PVideoFrame& dst, const char* fmt, ...)
 {
-    va_list arg;
-    va_start(arg, fmt);
-    size_t sz = snprintf(NULL, 0, fmt, arg);
-    char *buf = (char *)malloc(sz + 1);
-    vsprintf(buf, fmt, arg);
-    va_end (arg);
-    
-    if (info[0].IsYUY2()  ) print_yuyv  (dst, line, buf);
-    else if (info[0].IsRGB24() ) print_rgb   (dst, line, buf, false);
-    else if (info[0].IsRGB32() ) print_rgb   (dst, line, buf, true);
-    else if (info[0].pixel_type == VideoInfo::CS_BGR64) print_rgb64 (dst, line, buf);
-    else if (info[0].IsPlanar()) {
-        if (info[0].BitsPerPixel() > 8) {
-            print_planar(dst, line, buf, true);
-        }
-        else
-        {
-            print_planar(dst, line, buf, false);
-        }
-    }
+    // As many characters as fit across the frame
+    vector<char> buffer(vi.width / FONT_WIDTH + 1);
+
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(&buffer[0], buffer.size(), fmt, args);
+    va_end(args);
+
+    PrintText(atlas, dst, line, &buffer[0]);
+
     line++;
 }
 
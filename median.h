@@ -2,13 +2,69 @@
 #define MEDIAN_H
 
 #include <vector>
+#include <atomic>
+#include <mutex>
 #include <stdint.h>
 #include <cstdint>
+#include <climits>
 
 using std::vector;
 
 const unsigned int MAX_DEPTH = 25;
 const unsigned int MAX_OPT = 9;
+const unsigned int COMPARE_CHUNK = 256; // Samples between early termination checks
+const unsigned int INDEX_CANDIDATES = 8; // Frames taken from the hash index per clip
+const double INDEX_SIMILARITY = 95.0; // Index match good enough to skip the radius scan
+const unsigned int MAX_JITTER = 32;
+const int AGREE_TILE = 128; // Bytes of a row checked for agreement at a time
+const int NO_OFFSET = INT_MIN; // Sync offset of a frame that has not been rendered yet
+const int SHIFT_SEGMENT = 64; // Frames sharing one global shift estimate
+
+//////////////////////////////////////////////////////////////////////////////
+// Read position of every source relative to the output, in luma pixels
+//////////////////////////////////////////////////////////////////////////////
+struct SourceShift
+{
+    int x[MAX_DEPTH];
+    int y[MAX_DEPTH];
+    vector<int> row[MAX_DEPTH]; // Extra horizontal shift of every luma row, empty if none
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Global shift estimated for a clip in one segment, and the sync offset it
+// belongs to
+//////////////////////////////////////////////////////////////////////////////
+struct ShiftCache
+{
+    int offset;
+    int x;
+    int y;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// How much every clip disagrees with the output, over the luma of a frame
+//////////////////////////////////////////////////////////////////////////////
+struct MapStats
+{
+    uint64_t outliers[MAX_DEPTH];   // Samples further than the threshold from the output
+    uint64_t deviation[MAX_DEPTH];  // Sum of absolute differences from the output
+    uint64_t disagreeing;           // Samples where at least one clip is an outlier
+    uint64_t samples;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Distinct source frames of an output frame, and how many clips show each
+//
+// Sources that are the same frame buffer are kept once. The first entry
+// is always the first clip.
+//////////////////////////////////////////////////////////////////////////////
+struct FrameStack
+{
+    unsigned int count;
+    unsigned int source[MAX_DEPTH];     // Clip the frame is taken from
+    unsigned int weight[MAX_DEPTH];     // Summed weight of the clips showing the frame
+    unsigned int entry[MAX_DEPTH];      // Entry of every clip
+};
 
 //////////////////////////////////////////////////////////////////////////////
 // Class definition
@@ -16,37 +72,118 @@ const unsigned int MAX_OPT = 9;
 class Median : public GenericVideoFilter
 {
 public:
-    Median(PClip _child, vector<PClip> _clips, unsigned int _low, unsigned int _high, bool _temporal, bool _processchroma, unsigned int _sync, unsigned int _samples, bool _debug, IScriptEnvironment *env);
+    Median(PClip _child, vector<PClip> _clips, vector<unsigned int> _weights, PClip _masks, unsigned int _low, unsigned int _high, bool _temporal, unsigned int _spatial, bool _processchroma, unsigned int _sync, unsigned int _samples, bool _align, bool _index, bool _fields, unsigned int _shift, unsigned int _jitter, bool _audio, unsigned int _map, bool _showmap, bool _debug, const char* _stats, const char* _statsfile, const char* _trace, bool _perf, IScriptEnvironment *env);
 	~Median();
 
 	PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
+    void __stdcall GetAudio(void* buf, int64_t start, int64_t count, IScriptEnvironment* env);
 
 private:
     vector<PClip> clips;
     unsigned int low;
     unsigned int high;
     bool temporal;
+    unsigned int spatial;
     bool processchroma;
     unsigned int sync;
     unsigned int samples;
+    bool align;
+    bool hashindex;
+    bool fields;
+    unsigned int shiftrange;
+    unsigned int jitterrange;
+    bool audiosync;
+    unsigned int mapthreshold;
+    bool showmap;
     bool debug;
+    bool frameprops;
+    const char* isa;
+    FrameStats* stats;
+    Tracer* tracer;
+
+    bool perfcounters;
+    uint64_t framebytes;
+    PerfSample perftotal;
+    uint64_t perfframes;
+    std::mutex perflock;
 
     unsigned int depth;
+    unsigned int weight[MAX_DEPTH];     // Of every clip, all 1 when not given
+    unsigned int weightsum;             // Sum of the weights, the positions low and high count in
     unsigned int blend;
     bool fastprocess;
+    bool stacking;
     vector<VideoInfo> info;
+    vector<AlignmentResult> alignment;
+
+    vector<FrameIndex> frameindex;
+    std::atomic<bool> indexed;
+    std::mutex indexlock;
+
+    vector<AudioMatch> audiomatch;
+    vector<bool> audiodone;
+    std::mutex audiolock;
+
+    bool mixaudio;
+    AudioSortFunction audiosort;
+    vector<int> frameoffset;
+    std::mutex offsetlock;
+
+    SadFunction sad;
+    AgreeFunction agree;
+    bool agreetiles;
+    vector<vector<ShiftCache> > shiftcache; // Of every segment and clip, one per sync offset seen
+    std::mutex shiftlock;
 
     unsigned char (*fastmedian)(unsigned char*);
 
-    double CompareFrames(int plane, PVideoFrame a, PVideoFrame b, unsigned int points);
-    void ProcessPlane(int plane, PVideoFrame src[MAX_DEPTH], PVideoFrame& dst);
-    void ProcessPlanarFrame(PVideoFrame src[MAX_DEPTH], PVideoFrame& dst);
-    void ProcessInterleavedFrame(PVideoFrame src[MAX_DEPTH], PVideoFrame& dst);
+    // Weighted stacks, one network for every number of distinct sources
+    WeightedRowFunction weightedrow;
+    vector<Comparator> weightnetwork[MAX_DEPTH + 1];
+
+    // Validity masks of the clips, interleaved, NULL if none
+    PClip masks;
+    ValidFunction valid;
+    MaskedRowFunction maskedrow;
+    vector<Comparator> masknetwork;
+
+    // Windows over space and time, TemporalMedian with a spatial radius
+    vector<SpatialChannel> volumechannels;
+    vector<int> volumecopied;
+    WindowNetwork volume;
+
+    PVideoFrame FetchFrame(unsigned int clip, int n, IScriptEnvironment* env);
+    PVideoFrame FetchMask(unsigned int clip, int n, IScriptEnvironment* env);
+    void BuildIndex(IScriptEnvironment* env);
+    void SyncAudio(int n, AudioMatch match[MAX_DEPTH], IScriptEnvironment* env);
+    void SyncOffsets(int n, const PVideoFrame& reference, int match[MAX_DEPTH], double best[MAX_DEPTH], IScriptEnvironment* env);
+    void FrameOffsets(int n, int offset[MAX_DEPTH], IScriptEnvironment* env);
+    int FieldOffset(int pitch, int height, int field) const;
+    double CompareFrames(int plane, PVideoFrame a, int afield, PVideoFrame b, int bfield, unsigned int points, double threshold = -1.0);
+    void EstimateShifts(int n, const int match[MAX_DEPTH], SourceShift& shift, IScriptEnvironment* env);
+    void EstimateJitter(PVideoFrame src[MAX_DEPTH], const int field[MAX_DEPTH], SourceShift& shift);
+    void FieldLuma(LumaImage& image, int field) const;
+    void StackFrames(PVideoFrame src[MAX_DEPTH], FrameStack& stack) const;
+    int MajorityFrame(const FrameStack& stack) const;
+    bool Weighted(const FrameStack& stack) const;
+    PVideoFrame ShareFrame(const PVideoFrame& frame, IScriptEnvironment* env) const;
+    void ProcessFrame(PVideoFrame src[MAX_DEPTH], const int field[MAX_DEPTH], const SourceShift& shift, const FrameStack& stack, const PVideoFrame* mask, PVideoFrame& dst, int dstfield, MapStats* map, IScriptEnvironment* env);
+    void ProcessVolume(PVideoFrame src[MAX_DEPTH], PVideoFrame& dst, IScriptEnvironment* env);
+    void CopyPlane(int plane, const PVideoFrame& src, int field, PVideoFrame& dst, int dstfield, IScriptEnvironment* env) const;
+    void ProcessPlane(int plane, PVideoFrame src[MAX_DEPTH], const int field[MAX_DEPTH], const SourceShift& shift, const FrameStack& stack, const PVideoFrame* mask, PVideoFrame& dst, int dstfield, MapStats* map);
+    void ProcessSpan(int plane, const unsigned char* srcp[MAX_DEPTH], const unsigned char* const* maskp, const FrameStack& stack, unsigned char* dstp, int x0, int x1, int unit, MapStats* map);
+    void ProcessRow(int plane, const unsigned char* srcp[MAX_DEPTH], const FrameStack& stack, unsigned char* dstp, int x0, int x1, MapStats* map);
+    void ProcessRowWeighted(const unsigned char* srcp[MAX_DEPTH], const FrameStack& stack, unsigned char* dstp, int x0, int x1) const;
+    void ProcessRowMasked(const unsigned char* srcp[MAX_DEPTH], const unsigned char* const* maskp, unsigned char* dstp, int x0, int x1) const;
     inline unsigned char ProcessPixel(unsigned char* values) const;
     inline std::uint16_t ProcessPixel_16bit(std::uint16_t* values) const;
+    inline float ProcessPixel_float(float* values) const;
+
+    void SetProperties(PVideoFrame& dst, const int match[MAX_DEPTH], const double best[MAX_DEPTH], const SourceShift& shift, const double jitter[MAX_DEPTH], const uint64_t ticks[STAGE_COUNT], const PerfSample& perf, const MapStats& map, const FrameStack& stack, int majority, IScriptEnvironment* env);
 
     void debugf(const char* fmt, ...);
 
+    GlyphAtlas atlas;
     unsigned int line;
     void textf(PVideoFrame& dst, const char* fmt, ...);
 };
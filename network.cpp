@@ -0,0 +1,168 @@
+#include "stdafx.h"
+#include "network.h"
+
+#ifdef INTEL_INTRINSICS
+#include <emmintrin.h>
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Batcher's odd-even merge sort for any number of values, with the
+// comparators that cannot reach values low to low + blend - 1 removed
+//////////////////////////////////////////////////////////////////////////////
+void SelectionNetwork(unsigned int depth, unsigned int low, unsigned int blend, std::vector<Comparator>& network)
+{
+    std::vector<Comparator> full;
+
+    for (unsigned int p = 1; p < depth; p = p * 2)
+    {
+        for (unsigned int k = p; k >= 1; k = k / 2)
+        {
+            for (unsigned int j = k % p; j + k < depth; j = j + 2 * k)
+            {
+                for (unsigned int i = 0; i < k && i + j + k < depth; i++)
+                {
+                    if ((i + j) / (2 * p) == (i + j + k) / (2 * p))
+                    {
+                        Comparator comparator = { (unsigned char)(i + j), (unsigned char)(i + j + k) };
+                        full.push_back(comparator);
+                    }
+                }
+            }
+        }
+    }
+
+    // Walk backwards, keeping what feeds a value that is still needed
+    std::vector<bool> needed(depth, false);
+
+    for (unsigned int r = low; r < low + blend; r++)
+        needed[r] = true;
+
+    network.clear();
+
+    for (size_t c = full.size(); c-- > 0; )
+    {
+        if (needed[full[c].a] || needed[full[c].b])
+        {
+            needed[full[c].a] = true;
+            needed[full[c].b] = true;
+            network.push_back(full[c]);
+        }
+    }
+
+    std::reverse(network.begin(), network.end());
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Plain C version of the row network, simple enough for the compiler to
+// vectorize on its own
+//////////////////////////////////////////////////////////////////////////////
+template<typename T>
+static void NetworkRowsC(void* const* rows, const Comparator* network, size_t comparators, int first, int last)
+{
+    for (size_t c = 0; c < comparators; c++)
+    {
+        T* a = (T*)rows[network[c].a];
+        T* b = (T*)rows[network[c].b];
+
+        for (int x = first; x < last; x++)
+        {
+            const T lower = std::min(a[x], b[x]);
+
+            b[x] = std::max(a[x], b[x]);
+            a[x] = lower;
+        }
+    }
+}
+
+void network_rows_8_c(void* const* rows, const Comparator* network, size_t comparators, int first, int last)
+{
+    NetworkRowsC<uint8_t>(rows, network, comparators, first, last);
+}
+
+void network_rows_16_c(void* const* rows, const Comparator* network, size_t comparators, int first, int last)
+{
+    NetworkRowsC<uint16_t>(rows, network, comparators, first, last);
+}
+
+void network_rows_float_c(void* const* rows, const Comparator* network, size_t comparators, int first, int last)
+{
+    NetworkRowsC<float>(rows, network, comparators, first, last);
+}
+
+
+#ifdef INTEL_INTRINSICS
+//////////////////////////////////////////////////////////////////////////////
+// SSE2 versions, SSE2 only has a signed 16-bit min and max so the values
+// are moved into the signed range around them
+//////////////////////////////////////////////////////////////////////////////
+struct Uint8Sse2
+{
+    typedef uint8_t Value;
+    typedef __m128i Vector;
+    enum { width = 16 };
+
+    static Vector Load(const Value* p) { return _mm_loadu_si128((const __m128i*)p); }
+    static void Store(Value* p, Vector v) { _mm_storeu_si128((__m128i*)p, v); }
+    static Vector Min(Vector a, Vector b) { return _mm_min_epu8(a, b); }
+    static Vector Max(Vector a, Vector b) { return _mm_max_epu8(a, b); }
+};
+
+struct Uint16Sse2
+{
+    typedef uint16_t Value;
+    typedef __m128i Vector;
+    enum { width = 8 };
+
+    static Vector Sign() { return _mm_set1_epi16((short)0x8000); }
+    static Vector Load(const Value* p) { return _mm_loadu_si128((const __m128i*)p); }
+    static void Store(Value* p, Vector v) { _mm_storeu_si128((__m128i*)p, v); }
+    static Vector Min(Vector a, Vector b) { return _mm_xor_si128(_mm_min_epi16(_mm_xor_si128(a, Sign()), _mm_xor_si128(b, Sign())), Sign()); }
+    static Vector Max(Vector a, Vector b) { return _mm_xor_si128(_mm_max_epi16(_mm_xor_si128(a, Sign()), _mm_xor_si128(b, Sign())), Sign()); }
+};
+
+struct FloatSse2
+{
+    typedef float Value;
+    typedef __m128 Vector;
+    enum { width = 4 };
+
+    static Vector Load(const Value* p) { return _mm_loadu_ps(p); }
+    static void Store(Value* p, Vector v) { _mm_storeu_ps(p, v); }
+    static Vector Min(Vector a, Vector b) { return _mm_min_ps(a, b); }
+    static Vector Max(Vector a, Vector b) { return _mm_max_ps(a, b); }
+};
+
+void network_rows_8_sse2(void* const* rows, const Comparator* network, size_t comparators, int first, int last)
+{
+    network_rows_8_c(rows, network, comparators, NetworkRows<Uint8Sse2>(rows, network, comparators, first, last), last);
+}
+
+void network_rows_16_sse2(void* const* rows, const Comparator* network, size_t comparators, int first, int last)
+{
+    network_rows_16_c(rows, network, comparators, NetworkRows<Uint16Sse2>(rows, network, comparators, first, last), last);
+}
+
+void network_rows_float_sse2(void* const* rows, const Comparator* network, size_t comparators, int first, int last)
+{
+    network_rows_float_c(rows, network, comparators, NetworkRows<FloatSse2>(rows, network, comparators, first, last), last);
+}
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Pick the fastest version the CPU supports
+//////////////////////////////////////////////////////////////////////////////
+RowNetworkFunction GetRowNetworkFunction(int size, int cpuflags)
+{
+#ifdef INTEL_INTRINSICS
+    if (cpuflags & CPUF_AVX2)
+        return size == 1 ? network_rows_8_avx2 : size == 2 ? network_rows_16_avx2 : network_rows_float_avx2;
+
+    if (cpuflags & CPUF_SSE2)
+        return size == 1 ? network_rows_8_sse2 : size == 2 ? network_rows_16_sse2 : network_rows_float_sse2;
+#endif
+
+    return size == 1 ? network_rows_8_c : size == 2 ? network_rows_16_c : network_rows_float_c;
+}
@@ -0,0 +1,73 @@
+#ifndef NETWORK_H
+#define NETWORK_H
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+//////////////////////////////////////////////////////////////////////////////
+// Compare and swap of two rows: row a keeps the smaller value of every
+// position, row b the larger one
+//////////////////////////////////////////////////////////////////////////////
+struct Comparator
+{
+    unsigned char a;
+    unsigned char b;
+};
+
+void SelectionNetwork(unsigned int depth, unsigned int low, unsigned int blend, std::vector<Comparator>& network);
+
+//////////////////////////////////////////////////////////////////////////////
+// Run a network over values first to last of every row, one position in
+// every vector lane. Rows hold uint8_t, uint16_t or float values.
+//////////////////////////////////////////////////////////////////////////////
+typedef void (*RowNetworkFunction)(void* const* rows, const Comparator* network, size_t comparators, int first, int last);
+
+void network_rows_8_c(void* const* rows, const Comparator* network, size_t comparators, int first, int last);
+void network_rows_16_c(void* const* rows, const Comparator* network, size_t comparators, int first, int last);
+void network_rows_float_c(void* const* rows, const Comparator* network, size_t comparators, int first, int last);
+
+#ifdef INTEL_INTRINSICS
+void network_rows_8_sse2(void* const* rows, const Comparator* network, size_t comparators, int first, int last);
+void network_rows_16_sse2(void* const* rows, const Comparator* network, size_t comparators, int first, int last);
+void network_rows_float_sse2(void* const* rows, const Comparator* network, size_t comparators, int first, int last);
+void network_rows_8_avx2(void* const* rows, const Comparator* network, size_t comparators, int first, int last);
+void network_rows_16_avx2(void* const* rows, const Comparator* network, size_t comparators, int first, int last);
+void network_rows_float_avx2(void* const* rows, const Comparator* network, size_t comparators, int first, int last);
+#endif
+
+// Fastest version for values of size bytes
+RowNetworkFunction GetRowNetworkFunction(int size, int cpuflags);
+
+//////////////////////////////////////////////////////////////////////////////
+// Shared body of the vector versions, Ops wraps the instructions of one
+// value type and instruction set. Returns the first value left for the
+// plain C version.
+//////////////////////////////////////////////////////////////////////////////
+template<typename Ops>
+int NetworkRows(void* const* rows, const Comparator* network, size_t comparators, int first, int last)
+{
+    typedef typename Ops::Value Value;
+    typedef typename Ops::Vector Vector;
+
+    last = first + (last - first) / Ops::width * Ops::width;
+
+    for (size_t c = 0; c < comparators; c++)
+    {
+        Value* a = (Value*)rows[network[c].a];
+        Value* b = (Value*)rows[network[c].b];
+
+        for (int x = first; x < last; x = x + Ops::width)
+        {
+            Vector va = Ops::Load(a + x);
+            Vector vb = Ops::Load(b + x);
+
+            Ops::Store(a + x, Ops::Min(va, vb));
+            Ops::Store(b + x, Ops::Max(va, vb));
+        }
+    }
+
+    return last;
+}
+
+#endif // NETWORK_H
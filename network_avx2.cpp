@@ -0,0 +1,61 @@
+#include "stdafx.h"
+#include "network.h"
+
+#ifdef INTEL_INTRINSICS
+#include <immintrin.h>
+
+
+//////////////////////////////////////////////////////////////////////////////
+// AVX2 versions of the row network, 32 bytes at a time
+//////////////////////////////////////////////////////////////////////////////
+struct Uint8Avx2
+{
+    typedef uint8_t Value;
+    typedef __m256i Vector;
+    enum { width = 32 };
+
+    static Vector Load(const Value* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    static void Store(Value* p, Vector v) { _mm256_storeu_si256((__m256i*)p, v); }
+    static Vector Min(Vector a, Vector b) { return _mm256_min_epu8(a, b); }
+    static Vector Max(Vector a, Vector b) { return _mm256_max_epu8(a, b); }
+};
+
+struct Uint16Avx2
+{
+    typedef uint16_t Value;
+    typedef __m256i Vector;
+    enum { width = 16 };
+
+    static Vector Load(const Value* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    static void Store(Value* p, Vector v) { _mm256_storeu_si256((__m256i*)p, v); }
+    static Vector Min(Vector a, Vector b) { return _mm256_min_epu16(a, b); }
+    static Vector Max(Vector a, Vector b) { return _mm256_max_epu16(a, b); }
+};
+
+struct FloatAvx2
+{
+    typedef float Value;
+    typedef __m256 Vector;
+    enum { width = 8 };
+
+    static Vector Load(const Value* p) { return _mm256_loadu_ps(p); }
+    static void Store(Value* p, Vector v) { _mm256_storeu_ps(p, v); }
+    static Vector Min(Vector a, Vector b) { return _mm256_min_ps(a, b); }
+    static Vector Max(Vector a, Vector b) { return _mm256_max_ps(a, b); }
+};
+
+void network_rows_8_avx2(void* const* rows, const Comparator* network, size_t comparators, int first, int last)
+{
+    network_rows_8_c(rows, network, comparators, NetworkRows<Uint8Avx2>(rows, network, comparators, first, last), last);
+}
+
+void network_rows_16_avx2(void* const* rows, const Comparator* network, size_t comparators, int first, int last)
+{
+    network_rows_16_c(rows, network, comparators, NetworkRows<Uint16Avx2>(rows, network, comparators, first, last), last);
+}
+
+void network_rows_float_avx2(void* const* rows, const Comparator* network, size_t comparators, int first, int last)
+{
+    network_rows_float_c(rows, network, comparators, NetworkRows<FloatAvx2>(rows, network, comparators, first, last), last);
+}
+#endif // INTEL_INTRINSICS
@@ -0,0 +1,152 @@
+#include "stdafx.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Counters of one thread, opened on first use and closed with the thread
+//
+// Every event is opened on its own, so an event the CPU or the virtual
+// machine does not support only loses that event. Without permission to
+// count (perf_event_paranoid) none of them open, and nothing is reported.
+//////////////////////////////////////////////////////////////////////////////
+struct PerfThread
+{
+    int fd[PERF_EVENTS];
+    bool opened;
+
+    PerfThread() : opened(false)
+    {
+        for (int i = 0; i < PERF_EVENTS; i++)
+            fd[i] = -1;
+    }
+
+    ~PerfThread()
+    {
+        for (int i = 0; i < PERF_EVENTS; i++)
+        {
+            if (fd[i] >= 0)
+                close(fd[i]);
+        }
+    }
+
+    void Open()
+    {
+        static const uint64_t config[PERF_EVENTS] =
+        {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_STALLED_CYCLES_BACKEND
+        };
+
+        for (int i = 0; i < PERF_EVENTS; i++)
+        {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = config[i];
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+
+            // This thread, on any CPU
+            fd[i] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+
+        opened = true;
+    }
+};
+
+static thread_local PerfThread perfthread;
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Current counter values of the calling thread
+//////////////////////////////////////////////////////////////////////////////
+void ReadPerfCounters(PerfSample& sample)
+{
+    memset(&sample, 0, sizeof(sample));
+
+#ifdef __linux__
+    if (!perfthread.opened)
+        perfthread.Open();
+
+    for (int i = 0; i < PERF_EVENTS; i++)
+    {
+        if (perfthread.fd[i] >= 0 && read(perfthread.fd[i], &sample.value[i], sizeof(uint64_t)) == sizeof(uint64_t))
+            sample.valid = sample.valid | (1 << i);
+    }
+#endif
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Empty total, every event counts as valid until a reading says otherwise
+//////////////////////////////////////////////////////////////////////////////
+void ClearPerf(PerfSample& sample)
+{
+    memset(&sample, 0, sizeof(sample));
+    sample.valid = (1 << PERF_EVENTS) - 1;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Add counts to a total, an event stays valid only if it was counted in both
+//////////////////////////////////////////////////////////////////////////////
+void AddPerf(PerfSample& total, const PerfSample& sample)
+{
+    total.valid = total.valid & sample.valid;
+
+    for (int i = 0; i < PERF_EVENTS; i++)
+        total.value[i] = total.value[i] + sample.value[i];
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Add the counts between two readings to a total
+//////////////////////////////////////////////////////////////////////////////
+void AccumulatePerf(PerfSample& total, const PerfSample& before, const PerfSample& after)
+{
+    PerfSample difference;
+
+    difference.valid = before.valid & after.valid;
+
+    for (int i = 0; i < PERF_EVENTS; i++)
+        difference.value[i] = after.value[i] - before.value[i];
+
+    AddPerf(total, difference);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// One line summary of counts over a section that moved the given bytes
+//////////////////////////////////////////////////////////////////////////////
+void FormatPerf(const PerfSample& sample, uint64_t bytes, char* buffer, int size)
+{
+    if (!(sample.valid & (1 << PERF_CYCLES)) || sample.value[PERF_CYCLES] == 0)
+    {
+        snprintf(buffer, size, "counters unavailable");
+        return;
+    }
+
+    const double cycles = (double)sample.value[PERF_CYCLES];
+
+    int length = snprintf(buffer, size, "%.2f bytes/cycle", bytes / cycles);
+
+    if (sample.valid & (1 << PERF_INSTRUCTIONS))
+        length = length + snprintf(buffer + length, max(size - length, 0), ", IPC %.2f", sample.value[PERF_INSTRUCTIONS] / cycles);
+
+    if (sample.valid & (1 << PERF_CACHE_MISSES))
+        length = length + snprintf(buffer + length, max(size - length, 0), ", %llu LLC misses", (unsigned long long)sample.value[PERF_CACHE_MISSES]);
+
+    if (sample.valid & (1 << PERF_STALLED_CYCLES))
+        snprintf(buffer + length, max(size - length, 0), ", %.1f%% stalled", 100.0 * sample.value[PERF_STALLED_CYCLES] / cycles);
+}
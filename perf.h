@@ -0,0 +1,33 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdint.h>
+
+//////////////////////////////////////////////////////////////////////////////
+// Hardware events counted around the median kernel
+//////////////////////////////////////////////////////////////////////////////
+enum PerfEvent
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,      // Last level cache
+    PERF_STALLED_CYCLES,    // Backend stalls
+    PERF_EVENTS
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Counter values of the calling thread
+//////////////////////////////////////////////////////////////////////////////
+struct PerfSample
+{
+    uint64_t value[PERF_EVENTS];
+    unsigned int valid;     // Bit (1 << event) set for the events that could be counted
+};
+
+void ClearPerf(PerfSample& sample);
+void ReadPerfCounters(PerfSample& sample);
+void AddPerf(PerfSample& total, const PerfSample& sample);
+void AccumulatePerf(PerfSample& total, const PerfSample& before, const PerfSample& after);
+void FormatPerf(const PerfSample& sample, uint64_t bytes, char* buffer, int size);
+
+#endif // PERF_H
@@ -1,197 +1,171 @@
+#include "stdafx.h"
 #include "print.h"
 #include "font.h"
 
-static int string_to_bitmap(const char* string, unsigned char* &text_buffer)
-{
-    int text_width = strlen(string) * FONT_WIDTH;
+#include <string.h>
 
-    text_buffer = (unsigned char*)malloc(text_width * FONT_HEIGHT);
+#ifdef INTEL_INTRINSICS
+#include <emmintrin.h>
+#endif
 
-    unsigned char *pixel = text_buffer;
 
-    for (int y = 0; y < FONT_HEIGHT; y++)
+//////////////////////////////////////////////////////////////////////////////
+// Plain C version, one glyph at a time
+//////////////////////////////////////////////////////////////////////////////
+void glyph_row_c(unsigned char* dst, const unsigned char* glyphs, const unsigned char* string, int bytes, int glyph_bytes)
+{
+    for (; bytes >= glyph_bytes; bytes = bytes - glyph_bytes)
     {
-        for (size_t n = 0; n < strlen(string); n++)
-        {
-            for (int x = 0; x < FONT_WIDTH; x++)
-            {
-                unsigned char b = font8x8[string[n]][y] & (1U << x);
-                *pixel++ = b ? 255 : 0;
-            }
-        }
+        memcpy(dst, glyphs + *string++ * glyph_bytes, glyph_bytes);
+        dst = dst + glyph_bytes;
     }
 
-    return text_width;
+    // Glyph cut off by the right edge
+    if (bytes > 0)
+        memcpy(dst, glyphs + *string * glyph_bytes, bytes);
 }
 
 
+#ifdef INTEL_INTRINSICS
 //////////////////////////////////////////////////////////////////////////////
-// Interleaved YUY2
+// SSE2 version, glyph rows are a multiple of 8 bytes
 //////////////////////////////////////////////////////////////////////////////
-void print_yuyv(PVideoFrame& dst, unsigned int line, const char* string)
+void glyph_row_sse2(unsigned char* dst, const unsigned char* glyphs, const unsigned char* string, int bytes, int glyph_bytes)
 {
-    unsigned char* text_buffer;
-
-    int text_width = string_to_bitmap(string, text_buffer);
-    int image_width = dst->GetPitch() / 2;
-
-    unsigned char* row = dst->GetWritePtr() + (line * FONT_HEIGHT * FONT_SCALE * dst->GetPitch());
-    unsigned char* end = dst->GetWritePtr() + (dst->GetHeight() * dst->GetPitch()) - 1;
-
-    for (int y = 0; y < FONT_HEIGHT; y++)
+    for (; bytes >= glyph_bytes; bytes = bytes - glyph_bytes)
     {
-        unsigned char* text = text_buffer + y * text_width;
+        const unsigned char* glyph = glyphs + *string++ * glyph_bytes;
 
-        for (int n = 0; n < FONT_SCALE; n++)
-        {
-            unsigned char* pixel = row;
+        int i = 0;
 
-            for (int x = 0; x < min(text_width, image_width); x++)
-            {
-                *pixel++ = text[x]; // Y
-                *pixel++ = 128;     // U/V = neutral
-            }
+        for (; i <= glyph_bytes - 16; i = i + 16)
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_loadu_si128((const __m128i*)(glyph + i)));
 
-            row = row + dst->GetPitch();
+        if (i < glyph_bytes)
+            _mm_storel_epi64((__m128i*)(dst + i), _mm_loadl_epi64((const __m128i*)(glyph + i)));
 
-            if (row > end)
-                goto done;
-        }
+        dst = dst + glyph_bytes;
     }
 
-done:
-
-    free(text_buffer);
+    glyph_row_c(dst, glyphs, string, bytes, glyph_bytes);
 }
+#endif
 
 
 //////////////////////////////////////////////////////////////////////////////
-// Interleaved RGB(A) - image is flipped vertically compared to YUY2
+// Pick the fastest version the CPU supports
 //////////////////////////////////////////////////////////////////////////////
-void print_rgb(PVideoFrame& dst, unsigned int line, const char* string, bool alpha)
+static GlyphRowFunction GetGlyphRowFunction(int cpuflags)
 {
-    unsigned char* text_buffer;
-
-    int text_width = string_to_bitmap(string, text_buffer);
-    int image_width = dst->GetPitch() / (alpha ? 4 : 3);
-
-    unsigned char* end = dst->GetWritePtr();
-    unsigned char* row = dst->GetWritePtr() + ((dst->GetHeight() - FONT_SCALE * FONT_HEIGHT * line - 1) * dst->GetPitch());
-
-    for (int y = 0; y < FONT_HEIGHT; y++)
-    {
-        unsigned char* text = text_buffer + y * text_width;
-
-        for (int n = 0; n < FONT_SCALE; n++)
-        {
-            if (row < end)
-                goto done;
-
-            unsigned char* pixel = row;
+#ifdef INTEL_INTRINSICS
+    if (cpuflags & CPUF_AVX2)
+        return glyph_row_avx2;
 
-            for (int x = 0; x < min(text_width, image_width); x++)
-            {
-                *pixel++ = text[x]; // R
-                *pixel++ = text[x]; // G
-                *pixel++ = text[x]; // B
-
-                if (alpha)
-                    *pixel++ = 255; // A
-            }
-
-            row = row - dst->GetPitch();
-
-        }
-    }
+    if (cpuflags & CPUF_SSE2)
+        return glyph_row_sse2;
+#endif
 
-done:
-
-    free(text_buffer);
+    return glyph_row_c;
 }
 
+
 //////////////////////////////////////////////////////////////////////////////
-// Interleaved RGB(A) - image is flipped vertically compared to YUY2
+// Render the font once in the layout of the format
 //////////////////////////////////////////////////////////////////////////////
-void print_rgb64(PVideoFrame& dst, unsigned int line, const char* string)
+void BuildGlyphAtlas(GlyphAtlas& atlas, const VideoInfo& vi, int cpuflags)
 {
-    unsigned char* text_buffer;
+    // Bytes of one pixel of a glyph: a sample of a plane, or a whole
+    // interleaved pixel
+    const int size = vi.IsPlanar() ? vi.ComponentSize() : vi.BytesFromPixels(1);
 
-    int text_width = string_to_bitmap(string, text_buffer);
-    int image_width = dst->GetPitch() / 8;
+    atlas.vi = vi;
+    atlas.glyph_bytes = FONT_WIDTH * size;
+    atlas.rows.assign(FONT_HEIGHT * FONT_CHARS * atlas.glyph_bytes, 0);
+    atlas.blit = GetGlyphRowFunction(cpuflags);
 
-    unsigned char* end = dst->GetWritePtr();
-    unsigned char* row = dst->GetWritePtr() + ((dst->GetHeight() - FONT_SCALE * FONT_HEIGHT * line - 1) * dst->GetPitch());
+    const uint16_t white16 = (uint16_t)(vi.ComponentSize() == 2 ? (1 << vi.BitsPerComponent()) - 1 : 0);
 
     for (int y = 0; y < FONT_HEIGHT; y++)
     {
-        unsigned char* text = text_buffer + y * text_width;
-
-        for (int n = 0; n < FONT_SCALE; n++)
+        for (int c = 0; c < FONT_CHARS; c++)
         {
-            if (row < end)
-                goto done;
-
-            unsigned char* pixel = row;
+            unsigned char* pixel = &atlas.rows[(y * FONT_CHARS + c) * atlas.glyph_bytes];
 
-            for (int x = 0; x < min(text_width, image_width); x++)
+            for (int x = 0; x < FONT_WIDTH; x++)
             {
-                *pixel++;
-                *pixel++ = text[x]; // R
-                *pixel++;
-                *pixel++ = text[x]; // G
-                *pixel++;
-                *pixel++ = text[x]; // B
-                *pixel++;
-                *pixel++ = 255; // A
+                const bool on = (font8x8[c][y] & (1U << x)) != 0;
+                const unsigned char v = on ? 255 : 0;
+                const uint16_t v16 = on ? white16 : 0;
+                const float vf = on ? 1.0f : 0.0f;
+
+                if (vi.IsYUY2())
+                {
+                    pixel[0] = v;       // Y
+                    pixel[1] = 128;     // U/V = neutral
+                }
+                else if (vi.IsRGB24())
+                {
+                    pixel[0] = pixel[1] = pixel[2] = v;
+                }
+                else if (vi.IsRGB32())
+                {
+                    pixel[0] = pixel[1] = pixel[2] = v;
+                    pixel[3] = 255;
+                }
+                else if (vi.pixel_type == VideoInfo::CS_BGR64)
+                {
+                    const uint16_t bgra[4] = { v16, v16, v16, 0xffff };
+                    memcpy(pixel, bgra, sizeof(bgra));
+                }
+                else if (size == 1)
+                    pixel[0] = v;
+                else if (size == 2)
+                    memcpy(pixel, &v16, sizeof(v16));
+                else
+                    memcpy(pixel, &vf, sizeof(vf));
+
+                pixel = pixel + size;
             }
-
-            row = row - dst->GetPitch();
-
         }
     }
-
-done:
-
-    free(text_buffer);
 }
 
 
 //////////////////////////////////////////////////////////////////////////////
-// Planar colourspaces
+// Print a line of text, FONT_HEIGHT * FONT_SCALE rows down from the top per
+// line. Luma only for planar YUV, all planes for planar RGB. Packed RGB is
+// stored bottom up.
 //////////////////////////////////////////////////////////////////////////////
-void print_planar(PVideoFrame& dst, unsigned int line, const char* string, bool hibit)
+void PrintText(const GlyphAtlas& atlas, PVideoFrame& dst, unsigned int line, const char* string)
 {
-    unsigned char* text_buffer;
+    const VideoInfo& vi = atlas.vi;
 
-    int text_width = string_to_bitmap(string, text_buffer);
-    int image_width = dst->GetPitch();
+    const int planes[3] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+    const int count = vi.IsPlanar() && vi.IsRGB() ? 3 : 1;
+    const bool flipped = !vi.IsPlanar() && vi.IsRGB();
 
-    unsigned char* row = dst->GetWritePtr(PLANAR_Y) + (line * FONT_HEIGHT * FONT_SCALE * dst->GetPitch(PLANAR_Y));
-    unsigned char* end = dst->GetWritePtr(PLANAR_Y) + (dst->GetHeight(PLANAR_Y) * dst->GetPitch(PLANAR_Y)) - 1;
+    const int length = (int)strlen(string);
+    const unsigned int first = line * FONT_HEIGHT * FONT_SCALE;
 
-    for (int y = 0; y < FONT_HEIGHT; y++)
+    for (int p = 0; p < count; p++)
     {
-        unsigned char* text = text_buffer + y * text_width;
+        const int plane = vi.IsPlanar() ? planes[p] : 0;
+        const int pitch = dst->GetPitch(plane);
+        const int height = dst->GetHeight(plane);
+        const int bytes = std::min(length * atlas.glyph_bytes, dst->GetRowSize(plane));
 
-        for (int n = 0; n < FONT_SCALE; n++)
+        unsigned char* ptr = dst->GetWritePtr(plane);
+
+        for (int y = 0; y < FONT_HEIGHT * FONT_SCALE; y++)
         {
-            unsigned char* pixel = row;
+            const unsigned int row = first + y;
 
-            for (int x = 0; x < min(text_width, image_width); x++) {
-                if (hibit) {
-                    *pixel++;
-                }
-                *pixel++ = text[x]; // Y
-            }
+            if (row >= (unsigned int)height)
+                break;
 
-            row = row + dst->GetPitch();
+            unsigned char* dstp = ptr + (flipped ? height - 1 - row : row) * pitch;
 
-            if (row > end)
-                goto done;
+            atlas.blit(dstp, &atlas.rows[(y / FONT_SCALE) * FONT_CHARS * atlas.glyph_bytes], (const unsigned char*)string, bytes, atlas.glyph_bytes);
         }
     }
-
-done:
-
-    free(text_buffer);
-}
\ No newline at end of file
+}
@@ -1,16 +1,45 @@
 #ifndef PRINT_H
 #define PRINT_H
 
-#include "stdafx.h"
+#include <vector>
+#include "avisynth.h"
 
 #define FONT_WIDTH  8
 #define FONT_HEIGHT 8
 #define FONT_SCALE  2
+#define FONT_CHARS  256
 
-void print_yuyv(PVideoFrame& dst, unsigned int line, const char* string);
-void print_rgb(PVideoFrame& dst, unsigned int line, const char* string, bool alpha);
-void print_rgb64(PVideoFrame& dst, unsigned int line, const char* string);
-void print_planar(PVideoFrame& dst, unsigned int line, const char* string, bool hibit);
+//////////////////////////////////////////////////////////////////////////////
+// Copy of the glyphs of a string into one row of an image
+//
+// glyphs is one glyph row of every character, glyph_bytes apart. The first
+// bytes of the concatenated glyph rows are written, the string must have
+// enough characters for them.
+//////////////////////////////////////////////////////////////////////////////
+typedef void (*GlyphRowFunction)(unsigned char* dst, const unsigned char* glyphs, const unsigned char* string, int bytes, int glyph_bytes);
 
-#endif // PRINT_H
+void glyph_row_c(unsigned char* dst, const unsigned char* glyphs, const unsigned char* string, int bytes, int glyph_bytes);
+
+#ifdef INTEL_INTRINSICS
+void glyph_row_sse2(unsigned char* dst, const unsigned char* glyphs, const unsigned char* string, int bytes, int glyph_bytes);
+void glyph_row_avx2(unsigned char* dst, const unsigned char* glyphs, const unsigned char* string, int bytes, int glyph_bytes);
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// Font rendered in the sample layout of one pixel format
+//
+// Rows are stored glyph row by glyph row, each holding that row of all
+// characters. Text is white on black, full range for the bit depth.
+//////////////////////////////////////////////////////////////////////////////
+struct GlyphAtlas
+{
+    VideoInfo vi;
+    int glyph_bytes;                    // Bytes of one glyph row
+    std::vector<unsigned char> rows;    // FONT_HEIGHT x FONT_CHARS x glyph_bytes
+    GlyphRowFunction blit;
+};
 
+void BuildGlyphAtlas(GlyphAtlas& atlas, const VideoInfo& vi, int cpuflags);
+void PrintText(const GlyphAtlas& atlas, PVideoFrame& dst, unsigned int line, const char* string);
+
+#endif // PRINT_H
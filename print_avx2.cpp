@@ -0,0 +1,39 @@
+#include "stdafx.h"
+#include "print.h"
+
+#ifdef INTEL_INTRINSICS
+#include <immintrin.h>
+
+
+//////////////////////////////////////////////////////////////////////////////
+// AVX2 version, 32 bytes at a time, the rest of a glyph row with SSE2
+//////////////////////////////////////////////////////////////////////////////
+void glyph_row_avx2(unsigned char* dst, const unsigned char* glyphs, const unsigned char* string, int bytes, int glyph_bytes)
+{
+    for (; bytes >= glyph_bytes; bytes = bytes - glyph_bytes)
+    {
+        const unsigned char* glyph = glyphs + *string++ * glyph_bytes;
+
+        int i = 0;
+
+        for (; i <= glyph_bytes - 32; i = i + 32)
+            _mm256_storeu_si256((__m256i*)(dst + i), _mm256_loadu_si256((const __m256i*)(glyph + i)));
+
+        if (i <= glyph_bytes - 16)
+        {
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_loadu_si128((const __m128i*)(glyph + i)));
+            i = i + 16;
+        }
+
+        if (i < glyph_bytes)
+            _mm_storel_epi64((__m128i*)(dst + i), _mm_loadl_epi64((const __m128i*)(glyph + i)));
+
+        dst = dst + glyph_bytes;
+    }
+
+    _mm256_zeroupper();
+
+    glyph_row_c(dst, glyphs, string, bytes, glyph_bytes);
+}
+
+#endif // INTEL_INTRINSICS
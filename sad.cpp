@@ -0,0 +1,62 @@
+#include "stdafx.h"
+#include "sad.h"
+
+#ifdef INTEL_INTRINSICS
+#include <emmintrin.h>
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Plain C version
+//////////////////////////////////////////////////////////////////////////////
+unsigned int sad_c(const unsigned char* a, const unsigned char* b, int length)
+{
+    unsigned int sum = 0;
+
+    for (int i = 0; i < length; i++)
+        sum = sum + abs((int)a[i] - (int)b[i]);
+
+    return sum;
+}
+
+
+#ifdef INTEL_INTRINSICS
+//////////////////////////////////////////////////////////////////////////////
+// SSE2 version, 16 samples at a time
+//////////////////////////////////////////////////////////////////////////////
+unsigned int sad_sse2(const unsigned char* a, const unsigned char* b, int length)
+{
+    __m128i sum = _mm_setzero_si128();
+
+    int i = 0;
+
+    for (; i <= length - 16; i = i + 16)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(va, vb));
+    }
+
+    unsigned int result = (unsigned int)(_mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8)));
+
+    return result + sad_c(a + i, b + i, length - i);
+}
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Pick the fastest version the CPU supports
+//////////////////////////////////////////////////////////////////////////////
+SadFunction GetSadFunction(int cpuflags)
+{
+#ifdef INTEL_INTRINSICS
+    if (cpuflags & CPUF_AVX2)
+        return sad_avx2;
+
+    if (cpuflags & CPUF_SSE2)
+        return sad_sse2;
+#endif
+
+    return sad_c;
+}
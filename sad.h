@@ -0,0 +1,18 @@
+#ifndef SAD_H
+#define SAD_H
+
+//////////////////////////////////////////////////////////////////////////////
+// Sum of absolute differences between two rows of 8-bit samples
+//////////////////////////////////////////////////////////////////////////////
+typedef unsigned int (*SadFunction)(const unsigned char* a, const unsigned char* b, int length);
+
+unsigned int sad_c(const unsigned char* a, const unsigned char* b, int length);
+
+#ifdef INTEL_INTRINSICS
+unsigned int sad_sse2(const unsigned char* a, const unsigned char* b, int length);
+unsigned int sad_avx2(const unsigned char* a, const unsigned char* b, int length);
+#endif
+
+SadFunction GetSadFunction(int cpuflags);
+
+#endif // SAD_H
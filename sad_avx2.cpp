@@ -0,0 +1,34 @@
+#include "stdafx.h"
+#include "sad.h"
+
+#ifdef INTEL_INTRINSICS
+#include <immintrin.h>
+
+
+//////////////////////////////////////////////////////////////////////////////
+// AVX2 version, 32 samples at a time
+//////////////////////////////////////////////////////////////////////////////
+unsigned int sad_avx2(const unsigned char* a, const unsigned char* b, int length)
+{
+    __m256i sum = _mm256_setzero_si256();
+
+    int i = 0;
+
+    for (; i <= length - 32; i = i + 32)
+    {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+
+        sum = _mm256_add_epi64(sum, _mm256_sad_epu8(va, vb));
+    }
+
+    __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+
+    unsigned int result = (unsigned int)(_mm_cvtsi128_si32(half) + _mm_cvtsi128_si32(_mm_srli_si128(half, 8)));
+
+    _mm256_zeroupper();
+
+    return result + sad_c(a + i, b + i, length - i);
+}
+
+#endif // INTEL_INTRINSICS
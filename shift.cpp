@@ -0,0 +1,255 @@
+#include "stdafx.h"
+#include "shift.h"
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Get the 8-bit luma of a frame
+//
+// 8-bit planar luma is used in place. For other formats the luma (or green)
+// samples, or their most significant bytes, are gathered into buffer.
+//////////////////////////////////////////////////////////////////////////////
+void GetLuma(const VideoInfo& vi, const PVideoFrame& frame, vector<unsigned char>& buffer, LumaImage& image)
+{
+    const unsigned char* ptr = frame->GetReadPtr(PLANAR_Y);
+    const int pitch = frame->GetPitch(PLANAR_Y);
+
+    image.width = vi.width;
+    image.height = frame->GetHeight(PLANAR_Y);
+
+    int step;   // Bytes between samples
+    int offset; // Byte of the sample used
+
+    if (vi.IsYUY2())
+    {
+        step = 2;
+        offset = 0;
+    }
+    else if (vi.IsRGB24())
+    {
+        step = 3;
+        offset = 1;
+    }
+    else if (vi.IsRGB32())
+    {
+        step = 4;
+        offset = 1;
+    }
+    else if (vi.pixel_type == VideoInfo::CS_BGR64)
+    {
+        step = 8;
+        offset = 3;
+    }
+    else if (vi.ComponentSize() == 1)
+    {
+        image.ptr = ptr;
+        image.pitch = pitch;
+        return;
+    }
+    else // Little endian, the high byte comes second
+    {
+        step = vi.ComponentSize();
+        offset = step - 1;
+    }
+
+    buffer.resize((size_t)image.width * image.height);
+
+    for (int y = 0; y < image.height; y++)
+    {
+        const unsigned char* row = ptr + y * pitch + offset;
+        unsigned char* out = &buffer[(size_t)y * image.width];
+
+        for (int x = 0; x < image.width; x++)
+            out[x] = row[x * step];
+    }
+
+    image.ptr = &buffer[0];
+    image.pitch = image.width;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Halve the luma in both directions by averaging 2x2 blocks
+//////////////////////////////////////////////////////////////////////////////
+void DecimateLuma(const LumaImage& source, vector<unsigned char>& buffer, LumaImage& image)
+{
+    image.width = source.width / 2;
+    image.height = source.height / 2;
+    image.pitch = image.width;
+
+    buffer.resize((size_t)image.width * image.height);
+
+    for (int y = 0; y < image.height; y++)
+    {
+        const unsigned char* top = source.ptr + (2 * y) * source.pitch;
+        const unsigned char* bottom = top + source.pitch;
+        unsigned char* out = &buffer[(size_t)y * image.width];
+
+        for (int x = 0; x < image.width; x++)
+            out[x] = (unsigned char)((top[2 * x] + top[2 * x + 1] + bottom[2 * x] + bottom[2 * x + 1] + 2) >> 2);
+    }
+
+    image.ptr = buffer.empty() ? 0 : &buffer[0];
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Difference between reference and image read at (x + dx, y + dy), over
+// the area that stays inside both images for any shift up to margin
+//////////////////////////////////////////////////////////////////////////////
+static unsigned long long BlockSad(const LumaImage& reference, const LumaImage& image, int dx, int dy, int margin, int rowstep, SadFunction sad)
+{
+    const int length = reference.width - 2 * margin;
+
+    unsigned long long sum = 0;
+
+    for (int y = margin; y < reference.height - margin; y = y + rowstep)
+    {
+        const unsigned char* a = reference.ptr + y * reference.pitch + margin;
+        const unsigned char* b = image.ptr + (y + dy) * image.pitch + margin + dx;
+
+        sum = sum + sad(a, b, length);
+    }
+
+    return sum;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Find the integer shift (dx, dy) within +-range at which image matches
+// reference best
+//
+// The search runs over all shifts on luma decimated by two, and is then
+// refined by one pixel at full resolution. Returns false if no shift stands
+// out, which happens on flat or black frames, and leaves the shift at zero.
+//////////////////////////////////////////////////////////////////////////////
+bool EstimateShift(const LumaImage& reference, const LumaImage& image, int range, SadFunction sad, int& dx, int& dy)
+{
+    dx = 0;
+    dy = 0;
+
+    const int coarse = (range + 1) / 2;
+
+    vector<unsigned char> reference_buffer;
+    vector<unsigned char> image_buffer;
+
+    LumaImage small_reference;
+    LumaImage small_image;
+
+    DecimateLuma(reference, reference_buffer, small_reference);
+    DecimateLuma(image, image_buffer, small_image);
+
+    if (small_reference.width <= 4 * coarse || small_reference.height <= 4 * coarse)
+        return false;
+
+    // Coarse search, most likely shifts first so that ties go to the smallest
+    unsigned long long best = ~0ULL;
+    unsigned long long total = 0;
+    int bx = 0;
+    int by = 0;
+
+    for (int k = 0; k <= 2 * coarse; k++)
+    {
+        int sy = (k & 1) ? -(k + 1) / 2 : k / 2;
+
+        for (int l = 0; l <= 2 * coarse; l++)
+        {
+            int sx = (l & 1) ? -(l + 1) / 2 : l / 2;
+
+            unsigned long long sum = BlockSad(small_reference, small_image, sx, sy, coarse, 1, sad);
+
+            total = total + sum;
+
+            if (sum < best)
+            {
+                best = sum;
+                bx = sx;
+                by = sy;
+            }
+        }
+    }
+
+    // The best match should be clearly better than the average one
+    const unsigned long long candidates = (unsigned long long)(2 * coarse + 1) * (2 * coarse + 1);
+
+    if (best * 10 * candidates >= total * 9)
+        return false;
+
+    // Refine at full resolution, every other row is enough here
+    const int margin = 2 * coarse + 1;
+
+    best = ~0ULL;
+
+    for (int k = 0; k < 9; k++)
+    {
+        int sx = 2 * bx + (k % 3 == 1 ? -1 : k % 3 == 2 ? 1 : 0);
+        int sy = 2 * by + (k / 3 == 1 ? -1 : k / 3 == 2 ? 1 : 0);
+
+        if (abs(sx) > range || abs(sy) > range)
+            continue;
+
+        unsigned long long sum = BlockSad(reference, image, sx, sy, margin, 2, sad);
+
+        if (sum < best)
+        {
+            best = sum;
+            dx = sx;
+            dy = sy;
+        }
+    }
+
+    return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Find the horizontal shift within +-range of every row of image against
+// the same row of reference, on top of a global shift (dx, dy)
+//
+// Each row is matched on its own, which follows the line to line timing
+// errors of tapes played back without a time base corrector. Rows without
+// enough detail to tell the shifts apart keep a shift of zero.
+//////////////////////////////////////////////////////////////////////////////
+void EstimateRowShifts(const LumaImage& reference, const LumaImage& image, int dx, int dy, int range, SadFunction sad, int* shifts)
+{
+    const int margin = range + abs(dx);
+    const int length = min(reference.width, image.width) - 2 * margin;
+
+    for (int y = 0; y < reference.height; y++)
+    {
+        shifts[y] = 0;
+
+        if (length <= 0)
+            continue;
+
+        // Same fallback as the processing for rows shifted out of the image
+        int row = y + dy;
+
+        if (row < 0 || row >= image.height)
+            row = y;
+
+        const unsigned char* a = reference.ptr + y * reference.pitch + margin;
+        const unsigned char* b = image.ptr + row * image.pitch + margin + dx;
+
+        // Most likely shifts first so that ties go to the smallest
+        unsigned long long best = ~0ULL;
+        unsigned long long worst = 0;
+
+        for (int k = 0; k <= 2 * range; k++)
+        {
+            int sx = (k & 1) ? -(k + 1) / 2 : k / 2;
+
+            unsigned long long sum = sad(a, b + sx, length);
+
+            if (sum < best)
+            {
+                best = sum;
+                shifts[y] = sx;
+            }
+
+            worst = max(worst, sum);
+        }
+
+        if (best * 10 >= worst * 9)
+            shifts[y] = 0;
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef SHIFT_H
+#define SHIFT_H
+
+#include <vector>
+#include "avisynth.h"
+#include "sad.h"
+
+//////////////////////////////////////////////////////////////////////////////
+// 8-bit luma samples of a frame, either pointing into the frame itself or
+// into a buffer they were extracted to
+//////////////////////////////////////////////////////////////////////////////
+struct LumaImage
+{
+    const unsigned char* ptr;
+    int pitch;
+    int width;
+    int height;
+};
+
+void GetLuma(const VideoInfo& vi, const PVideoFrame& frame, std::vector<unsigned char>& buffer, LumaImage& image);
+void DecimateLuma(const LumaImage& source, std::vector<unsigned char>& buffer, LumaImage& image);
+
+bool EstimateShift(const LumaImage& reference, const LumaImage& image, int range, SadFunction sad, int& dx, int& dy);
+void EstimateRowShifts(const LumaImage& reference, const LumaImage& image, int dx, int dy, int range, SadFunction sad, int* shifts);
+
+#endif // SHIFT_H
@@ -0,0 +1,529 @@
+#include "stdafx.h"
+
+#include <string.h>
+#include <atomic>
+#include <thread>
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Comparators of a network that still swap something when every column of
+// the window is sorted already. Checked with the 0-1 principle: a
+// comparator that swaps no 0-1 input with sorted columns swaps no input
+// with sorted columns at all. Window values are stored column by column,
+// smallest first. Inputs go through the network 64 at a time, one in every
+// bit: the first columns take all their combinations across the bits, the
+// others one combination per pass.
+//////////////////////////////////////////////////////////////////////////////
+static void PruneSortedColumns(unsigned int diameter, unsigned int columns, vector<Comparator>& network)
+{
+    vector<bool> swaps(network.size(), false);
+    vector<uint64_t> values(columns * diameter, 0);
+
+    // Columns that fit the bits
+    unsigned int inner = 0;
+    unsigned int lanes = 1;
+
+    while (inner < columns && lanes * (diameter + 1) <= 64)
+    {
+        lanes = lanes * (diameter + 1);
+        inner++;
+    }
+
+    for (unsigned int lane = 0; lane < lanes; lane++)
+    {
+        unsigned int rest = lane;
+
+        for (unsigned int c = 0; c < inner; c++)
+        {
+            const unsigned int ones = rest % (diameter + 1);
+            rest = rest / (diameter + 1);
+
+            for (unsigned int k = diameter - ones; k < diameter; k++)
+                values[c * diameter + k] |= (uint64_t)1 << lane;
+        }
+    }
+
+    // Ones at the top of every other column, every combination
+    vector<unsigned int> ones(columns, 0);
+    vector<uint64_t> sorted;
+
+    for (;;)
+    {
+        for (unsigned int c = inner; c < columns; c++)
+        {
+            for (unsigned int k = 0; k < diameter; k++)
+                values[c * diameter + k] = k + ones[c] >= diameter ? ~(uint64_t)0 : 0;
+        }
+
+        // Work on a copy, the first columns are the same every pass
+        sorted = values;
+
+        for (size_t c = 0; c < network.size(); c++)
+        {
+            const uint64_t a = sorted[network[c].a];
+            const uint64_t b = sorted[network[c].b];
+
+            if (a & ~b)
+                swaps[c] = true;
+
+            sorted[network[c].a] = a & b;
+            sorted[network[c].b] = a | b;
+        }
+
+        unsigned int c = inner;
+
+        while (c < columns && ++ones[c] > diameter)
+            ones[c++] = 0;
+
+        if (c == columns)
+            break;
+    }
+
+    vector<Comparator> pruned;
+
+    for (size_t c = 0; c < network.size(); c++)
+    {
+        if (swaps[c])
+            pruned.push_back(network[c]);
+    }
+
+    network.swap(pruned);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Window networks for a radius and a number of frames
+//
+// Columns are sorted once and shared by every window they are part of, the
+// window network only keeps what sorted columns still need. Pruning runs
+// the network for every 0-1 input of sorted columns, past
+// PRUNE_COMBINATIONS of them the columns are left unsorted and the network
+// whole.
+//////////////////////////////////////////////////////////////////////////////
+void BuildWindowNetwork(WindowNetwork& window, unsigned int radius, unsigned int frames, int size, int cpuflags)
+{
+    const unsigned int diameter = 2 * radius + 1;
+    const unsigned int columns = diameter * frames;
+    const unsigned int count = diameter * columns;
+
+    window.radius = radius;
+    window.frames = frames;
+    window.size = size;
+
+    SelectionNetwork(count, count / 2, 1, window.network);
+    window.columnsort.clear();
+
+    uint64_t combinations = 1;
+
+    for (unsigned int c = 0; c < columns && combinations <= PRUNE_COMBINATIONS; c++)
+        combinations = combinations * (diameter + 1);
+
+    if (combinations <= PRUNE_COMBINATIONS)
+    {
+        SelectionNetwork(diameter, 0, diameter, window.columnsort);
+        PruneSortedColumns(diameter, columns, window.network);
+    }
+
+    window.rows = GetRowNetworkFunction(size, cpuflags);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Values filtered one channel at a time, and planes copied as they are
+//////////////////////////////////////////////////////////////////////////////
+void SpatialChannels(const VideoInfo& vi, bool processchroma, vector<SpatialChannel>& channels, vector<int>& copied)
+{
+    if (vi.IsPlanar())
+    {
+        const int planes[3] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+
+        for (int p = 0; p < (vi.IsY() ? 1 : 3); p++)
+        {
+            if (p > 0 && !processchroma)
+            {
+                copied.push_back(planes[p]);
+                continue;
+            }
+
+            const int ssx = p > 0 && vi.IsYUV() ? vi.GetPlaneWidthSubsampling(planes[p]) : 0;
+            const int ssy = p > 0 && vi.IsYUV() ? vi.GetPlaneHeightSubsampling(planes[p]) : 0;
+
+            const SpatialChannel channel = { planes[p], 0, 1, vi.width >> ssx, vi.height >> ssy };
+            channels.push_back(channel);
+        }
+
+        if (vi.IsYUVA() || vi.IsPlanarRGBA())
+            copied.push_back(PLANAR_A);
+    }
+    else if (vi.IsYUY2())
+    {
+        const SpatialChannel luma = { 0, 0, 2, vi.width, vi.height };
+        const SpatialChannel u = { 0, 1, 4, vi.width / 2, vi.height };
+        const SpatialChannel v = { 0, 3, 4, vi.width / 2, vi.height };
+
+        channels.push_back(luma);
+
+        if (processchroma)
+        {
+            channels.push_back(u);
+            channels.push_back(v);
+        }
+    }
+    else
+    {
+        // BGR, BGRA, alpha is chroma here the way Median treats it
+        const int step = vi.IsRGB24() ? 3 : 4;
+
+        for (int c = 0; c < step; c++)
+        {
+            const SpatialChannel channel = { 0, c, step, vi.width, vi.height };
+
+            if (c < 3 || processchroma)
+                channels.push_back(channel);
+        }
+    }
+
+    // Samples left out of an interleaved frame are copied with the rest
+    if (!vi.IsPlanar() && !processchroma && !vi.IsRGB24())
+        copied.push_back(0);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Constructor
+//////////////////////////////////////////////////////////////////////////////
+SpatialMedian::SpatialMedian(PClip _child, unsigned int _radius, bool _processchroma, unsigned int _threads, IScriptEnvironment* env) :
+GenericVideoFilter(_child), radius(_radius), processchroma(_processchroma), threads(_threads), generation(0), running(0), stopping(false), jobsrc(NULL), jobdst(NULL), jobnext(0)
+{
+    if (!vi.IsPlanar() && !vi.IsYUY2() && !vi.IsRGB24() && !vi.IsRGB32() && vi.pixel_type != VideoInfo::CS_BGR64)
+        env->ThrowError(ERROR_PREFIX "Unsupported color format.");
+
+    if (radius > NETWORK_RADIUS && vi.ComponentSize() == 4)
+        env->ThrowError(ERROR_PREFIX "Radius above %d needs 8 to 16-bit samples.", NETWORK_RADIUS);
+
+    if (threads == 0)
+        threads = max(std::thread::hardware_concurrency(), 1U);
+
+    SpatialChannels(vi, processchroma, channels, copied);
+
+    if (radius <= NETWORK_RADIUS)
+        BuildWindowNetwork(window, radius, 1, vi.ComponentSize(), env->GetCPUFlags());
+    else
+    {
+        for (size_t c = 0; c < channels.size(); c++)
+        {
+            for (int x = 0; x < channels[c].width; x = x + HISTOGRAM_STRIPE)
+            {
+                const Stripe stripe = { &channels[c], x, min(x + HISTOGRAM_STRIPE, channels[c].width) };
+                stripes.push_back(stripe);
+            }
+        }
+
+        // The thread asking for the frame is one of them
+        for (unsigned int t = 1; t < min(threads, (unsigned int)stripes.size()); t++)
+            workers.push_back(std::thread(&SpatialMedian::Work, this));
+    }
+
+    isa = "C";
+
+#ifdef INTEL_INTRINSICS
+    if (env->GetCPUFlags() & CPUF_AVX2)
+        isa = "AVX2";
+    else if (env->GetCPUFlags() & CPUF_SSE2)
+        isa = "SSE2";
+#endif
+
+    // Frame properties need interface version 8
+    frameprops = true;
+
+    try { env->CheckVersion(8); } catch (const AvisynthError&) { frameprops = false; }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Values x to x + count - 1 of a row of a channel, pixels left and right of
+// the row repeat the one at the edge
+//////////////////////////////////////////////////////////////////////////////
+template<typename T>
+static void GatherValues(void* dst, const unsigned char* row, const SpatialChannel& channel, int x, int count)
+{
+    const T* values = (const T*)row + channel.offset;
+    T* out = (T*)dst;
+
+    if (channel.step == 1 && x >= 0 && x + count <= channel.width)
+    {
+        memcpy(out, values + x, count * sizeof(T));
+        return;
+    }
+
+    // Edges clamped, the pixels in between read straight
+    const int first = min(max(-x, 0), count);
+    const int last = max(min(channel.width - x, count), first);
+
+    for (int i = 0; i < first; i++)
+        out[i] = values[0];
+
+    for (int i = first; i < last; i++)
+        out[i] = values[(x + i) * channel.step];
+
+    for (int i = last; i < count; i++)
+        out[i] = values[(channel.width - 1) * channel.step];
+}
+
+template<typename T>
+static void ScatterValues(unsigned char* row, const void* src, const SpatialChannel& channel, int x, int count)
+{
+    T* values = (T*)row + channel.offset;
+    const T* in = (const T*)src;
+
+    if (channel.step == 1)
+    {
+        memcpy(values + x, in, count * sizeof(T));
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+        values[(x + i) * channel.step] = in[i];
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Median of the windows around every pixel of a channel, over the frames
+// of src, a tile of a row at a time
+//
+// The columns of the tile and radius pixels either side of it are sorted
+// first, in every frame. Every window is then made of diameter neighbouring
+// sorted columns of each frame, read at an offset, so a column is sorted
+// once for all windows it is in.
+//////////////////////////////////////////////////////////////////////////////
+void WindowMedians(const WindowNetwork& window, const SpatialChannel& channel, const PVideoFrame* src, PVideoFrame& dst, vector<unsigned char>& scratch)
+{
+    const int size = window.size;
+    const int radius = window.radius;
+    const int frames = window.frames;
+    const int diameter = 2 * radius + 1;
+    const int columns = diameter * frames;
+    const int count = diameter * columns;
+    const int span = SPATIAL_TILE + 2 * radius;
+
+    scratch.resize((columns * span + count * SPATIAL_TILE) * size);
+
+    unsigned char* dstp = dst->GetWritePtr(channel.plane);
+    const int dst_pitch = dst->GetPitch(channel.plane);
+
+    // Row k of the window in frame f, then value k of column dx
+    void* column[MAX_WINDOW];
+    void* values[MAX_WINDOW];
+
+    for (int c = 0; c < columns; c++)
+        column[c] = scratch.data() + c * span * size;
+
+    for (int i = 0; i < count; i++)
+        values[i] = scratch.data() + (columns * span + i * SPATIAL_TILE) * size;
+
+    for (int y = 0; y < channel.height; y++)
+    {
+        // Rows above and below the frame repeat the edge row
+        const unsigned char* rowp[MAX_WINDOW];
+
+        for (int f = 0; f < frames; f++)
+        {
+            for (int k = 0; k < diameter; k++)
+                rowp[f * diameter + k] = src[f]->GetReadPtr(channel.plane) + min(max(y + k - radius, 0), channel.height - 1) * src[f]->GetPitch(channel.plane);
+        }
+
+        unsigned char* dstrow = dstp + y * dst_pitch;
+
+        for (int x = 0; x < channel.width; x = x + SPATIAL_TILE)
+        {
+            const int width = min(SPATIAL_TILE, channel.width - x);
+
+            for (int c = 0; c < columns; c++)
+            {
+                if (size == 1)
+                    GatherValues<uint8_t>(column[c], rowp[c], channel, x - radius, width + 2 * radius);
+                else if (size == 2)
+                    GatherValues<uint16_t>(column[c], rowp[c], channel, x - radius, width + 2 * radius);
+                else
+                    GatherValues<float>(column[c], rowp[c], channel, x - radius, width + 2 * radius);
+            }
+
+            for (int f = 0; f < frames; f++)
+                window.rows(column + f * diameter, window.columnsort.data(), window.columnsort.size(), 0, width + 2 * radius);
+
+            // Column dx of the window of pixel x + i is column i + dx
+            for (int f = 0; f < frames; f++)
+            {
+                for (int dx = 0; dx < diameter; dx++)
+                {
+                    for (int k = 0; k < diameter; k++)
+                        memcpy(values[(f * diameter + dx) * diameter + k], (unsigned char*)column[f * diameter + k] + dx * size, width * size);
+                }
+            }
+
+            window.rows(values, window.network.data(), window.network.size(), 0, width);
+
+            if (size == 1)
+                ScatterValues<uint8_t>(dstrow, values[count / 2], channel, x, width);
+            else if (size == 2)
+                ScatterValues<uint16_t>(dstrow, values[count / 2], channel, x, width);
+            else
+                ScatterValues<float>(dstrow, values[count / 2], channel, x, width);
+        }
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Destructor, stops the workers
+//////////////////////////////////////////////////////////////////////////////
+SpatialMedian::~SpatialMedian()
+{
+    {
+        std::lock_guard<std::mutex> lock(joblock);
+        stopping = true;
+    }
+
+    wake.notify_all();
+
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Histogram medians of every channel, in stripes of columns that stay in
+// cache and are handed out to the threads one at a time
+//
+// When the host already runs several frames at once, the workers are busy
+// with one of them and the others are done by the thread that asked for
+// them, so the filter never runs more threads than it was given on top of
+// the host's.
+//////////////////////////////////////////////////////////////////////////////
+void SpatialMedian::ProcessStripes(const PVideoFrame& src, PVideoFrame& dst)
+{
+    std::unique_lock<std::mutex> pool(poollock, std::try_to_lock);
+
+    if (!pool.owns_lock() || workers.empty())
+    {
+        std::atomic<size_t> next(0);
+        HistogramScratch scratch;
+
+        TakeStripes(src, dst, next, scratch);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(joblock);
+
+        jobsrc = &src;
+        jobdst = &dst;
+        jobnext = 0;
+        running = (unsigned int)workers.size();
+        generation++;
+    }
+
+    wake.notify_all();
+
+    TakeStripes(src, dst, jobnext, poolscratch);
+
+    std::unique_lock<std::mutex> lock(joblock);
+    finished.wait(lock, [&]() { return running == 0; });
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Stripes of a frame until none are left
+//////////////////////////////////////////////////////////////////////////////
+void SpatialMedian::TakeStripes(const PVideoFrame& src, PVideoFrame& dst, std::atomic<size_t>& next, HistogramScratch& scratch) const
+{
+    for (size_t s = next++; s < stripes.size(); s = next++)
+    {
+        const SpatialChannel& channel = *stripes[s].channel;
+
+        const unsigned char* srcp = src->GetReadPtr(channel.plane);
+        unsigned char* dstp = dst->GetWritePtr(channel.plane);
+
+        if (vi.ComponentSize() == 1)
+            HistogramMedian8(channel, srcp, src->GetPitch(channel.plane), dstp, dst->GetPitch(channel.plane), radius, stripes[s].x0, stripes[s].x1, scratch);
+        else
+            HistogramMedian16(channel, srcp, src->GetPitch(channel.plane), dstp, dst->GetPitch(channel.plane), radius, stripes[s].x0, stripes[s].x1, scratch);
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Worker, takes stripes of every job until the filter is destroyed
+//////////////////////////////////////////////////////////////////////////////
+void SpatialMedian::Work()
+{
+    HistogramScratch scratch;
+    uint64_t done = 0;
+
+    for (;;)
+    {
+        const PVideoFrame* src;
+        PVideoFrame* dst;
+
+        {
+            std::unique_lock<std::mutex> lock(joblock);
+            wake.wait(lock, [&]() { return stopping || generation != done; });
+
+            if (stopping)
+                return;
+
+            done = generation;
+            src = jobsrc;
+            dst = jobdst;
+        }
+
+        TakeStripes(*src, *dst, jobnext, scratch);
+
+        {
+            std::lock_guard<std::mutex> lock(joblock);
+            running--;
+        }
+
+        finished.notify_one();
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Get frame
+//////////////////////////////////////////////////////////////////////////////
+PVideoFrame __stdcall SpatialMedian::GetFrame(int n, IScriptEnvironment* env)
+{
+    PVideoFrame src = child->GetFrame(n, env);
+    PVideoFrame dst = frameprops ? env->NewVideoFrameP(vi, &src) : env->NewVideoFrame(vi);
+
+    for (size_t p = 0; p < copied.size(); p++)
+        env->BitBlt(dst->GetWritePtr(copied[p]), dst->GetPitch(copied[p]), src->GetReadPtr(copied[p]), src->GetPitch(copied[p]), src->GetRowSize(copied[p]), src->GetHeight(copied[p]));
+
+    const unsigned int diameter = 2 * radius + 1;
+
+    if (radius > NETWORK_RADIUS)
+        ProcessStripes(src, dst);
+    else
+    {
+        // Sorted columns and windows of one tile, per call so that threads
+        // do not share them
+        vector<unsigned char> scratch;
+
+        for (size_t c = 0; c < channels.size(); c++)
+            WindowMedians(window, channels[c], &src, dst, scratch);
+    }
+
+    if (frameprops)
+    {
+        AVSMap* props = env->getFramePropsRW(dst);
+
+        char kernel[24];
+        snprintf(kernel, sizeof(kernel), "%s%ux%u", radius > NETWORK_RADIUS ? "histogram" : "network", diameter, diameter);
+
+        env->propSetData(props, "MedianKernel", kernel, -1, PROPAPPENDMODE_REPLACE);
+        env->propSetData(props, "MedianISA", isa, -1, PROPAPPENDMODE_REPLACE);
+    }
+
+    return dst;
+}
@@ -0,0 +1,109 @@
+#ifndef SPATIAL_H
+#define SPATIAL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <stdint.h>
+#include "histogram.h"
+
+using std::vector;
+
+const unsigned int MAX_RADIUS = 15;
+const unsigned int NETWORK_RADIUS = 2;     // Largest radius sorted with networks, histograms above
+const int SPATIAL_TILE = 256; // Pixels of a row run through the networks at once
+const unsigned int MAX_WINDOW = 255; // Values a network can index
+const unsigned int PRUNE_COMBINATIONS = 1 << 20; // 0-1 inputs tried at most when pruning
+
+//////////////////////////////////////////////////////////////////////////////
+// Values filtered on their own: a plane, or one sample of every pixel of an
+// interleaved format
+//////////////////////////////////////////////////////////////////////////////
+struct SpatialChannel
+{
+    int plane;
+    int offset;     // Value of the first pixel
+    int step;       // Values from one pixel to the next
+    int width;      // Pixels
+    int height;
+};
+
+void SpatialChannels(const VideoInfo& vi, bool processchroma, vector<SpatialChannel>& channels, vector<int>& copied);
+
+//////////////////////////////////////////////////////////////////////////////
+// Networks for the middle value of the windows of radius around every
+// pixel, over frames frames at once. The columns of the window are sorted
+// first where the window network can be pruned for that.
+//////////////////////////////////////////////////////////////////////////////
+struct WindowNetwork
+{
+    unsigned int radius;
+    unsigned int frames;
+    int size;                           // Bytes of a value
+    vector<Comparator> columnsort;      // Sorts a column of the window, empty if columns are not sorted
+    vector<Comparator> network;         // Middle value of a window
+    RowNetworkFunction rows;
+};
+
+void BuildWindowNetwork(WindowNetwork& window, unsigned int radius, unsigned int frames, int size, int cpuflags);
+void WindowMedians(const WindowNetwork& window, const SpatialChannel& channel, const PVideoFrame* src, PVideoFrame& dst, vector<unsigned char>& scratch);
+
+//////////////////////////////////////////////////////////////////////////////
+// Class definition
+//////////////////////////////////////////////////////////////////////////////
+class SpatialMedian : public GenericVideoFilter
+{
+public:
+    SpatialMedian(PClip _child, unsigned int _radius, bool _processchroma, unsigned int _threads, IScriptEnvironment* env);
+    ~SpatialMedian();
+
+    PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
+
+private:
+    unsigned int radius;
+    bool processchroma;
+    unsigned int threads;
+    bool frameprops;
+    const char* isa;
+
+    vector<SpatialChannel> channels;    // Filtered
+    vector<int> copied;                 // Planes taken over as they are
+
+    WindowNetwork window;               // Radius up to NETWORK_RADIUS
+
+    // Columns of a channel, the histogram medians are handed out in these
+    struct Stripe
+    {
+        const SpatialChannel* channel;
+        int x0;
+        int x1;
+    };
+
+    vector<Stripe> stripes;
+
+    // Workers that take stripes along with the thread asking for a frame.
+    // They are started once and serve one frame at a time, frames asked for
+    // meanwhile are done by their own thread alone.
+    vector<std::thread> workers;
+    std::mutex poollock;                // Held by the frame the workers serve
+    HistogramScratch poolscratch;       // Of the thread holding poollock
+
+    std::mutex joblock;                 // Guards the job
+    std::condition_variable wake;
+    std::condition_variable finished;
+    uint64_t generation;                // Jobs handed out so far
+    unsigned int running;               // Workers still on the job
+    bool stopping;
+    const PVideoFrame* jobsrc;
+    PVideoFrame* jobdst;
+    std::atomic<size_t> jobnext;        // First stripe nobody has taken
+
+    void ProcessStripes(const PVideoFrame& src, PVideoFrame& dst);
+    void TakeStripes(const PVideoFrame& src, PVideoFrame& dst, std::atomic<size_t>& next, HistogramScratch& scratch) const;
+    void Work();
+};
+
+
+#endif // SPATIAL_H
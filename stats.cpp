@@ -0,0 +1,266 @@
+#include "stdafx.h"
+#include <chrono>
+#include <vector>
+#include <string.h>
+#include <stdio.h>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define HAVE_RDTSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+static const char* stagenames[STAGE_COUNT] = { "sync", "shift", "process", "debug" };
+
+static std::mutex registrylock;
+static std::vector<FrameStats*> registry;
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Cheap timestamp, the CPU time stamp counter where there is one and
+// nanoseconds otherwise
+//////////////////////////////////////////////////////////////////////////////
+uint64_t ReadTimestamp()
+{
+#ifdef HAVE_RDTSC
+    return __rdtsc();
+#else
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Timestamp ticks per second
+//
+// The time stamp counter is measured against the steady clock for a few
+// milliseconds the first time this is called.
+//////////////////////////////////////////////////////////////////////////////
+double TimestampFrequency()
+{
+#ifdef HAVE_RDTSC
+    static std::once_flag once;
+    static double frequency;
+
+    std::call_once(once, []()
+    {
+        typedef std::chrono::steady_clock Clock;
+
+        const Clock::time_point start = Clock::now();
+        const uint64_t ticks = ReadTimestamp();
+
+        Clock::time_point now;
+
+        do
+        {
+            now = Clock::now();
+        } while (now - start < std::chrono::milliseconds(5));
+
+        frequency = (ReadTimestamp() - ticks) / std::chrono::duration<double>(now - start).count();
+    });
+
+    return frequency;
+#else
+    return 1e9;
+#endif
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Histogram bucket of a duration, and the duration in the middle of a bucket
+//
+// Values below HISTOGRAM_STEPS have a bucket of their own, larger values are
+// split into HISTOGRAM_STEPS buckets per power of two.
+//////////////////////////////////////////////////////////////////////////////
+static unsigned int BucketIndex(uint64_t ticks)
+{
+    if (ticks < HISTOGRAM_STEPS)
+        return (unsigned int)ticks;
+
+    unsigned int exponent = 0;
+
+    while ((ticks >> exponent) >= 2 * HISTOGRAM_STEPS)
+        exponent++;
+
+    return (exponent + 1) * HISTOGRAM_STEPS + (unsigned int)((ticks >> exponent) - HISTOGRAM_STEPS);
+}
+
+static double BucketValue(unsigned int index)
+{
+    if (index < HISTOGRAM_STEPS)
+        return index;
+
+    const unsigned int exponent = index / HISTOGRAM_STEPS - 1;
+    const uint64_t step = index % HISTOGRAM_STEPS + HISTOGRAM_STEPS;
+
+    return (double)(step << exponent) + ((1ULL << exponent) - 1) / 2.0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Add one duration to a counter
+//////////////////////////////////////////////////////////////////////////////
+static void AddSample(StageCounter& counter, uint64_t ticks)
+{
+    counter.count++;
+    counter.ticks = counter.ticks + ticks;
+    counter.bucket[BucketIndex(ticks)]++;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Duration that the given fraction of samples stays within, in ticks
+//////////////////////////////////////////////////////////////////////////////
+static double Percentile(const StageCounter& counter, double fraction)
+{
+    const uint64_t target = (uint64_t)(fraction * counter.count + 0.5);
+    uint64_t seen = 0;
+
+    for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen = seen + counter.bucket[i];
+
+        if (seen > 0 && seen >= target)
+            return BucketValue(i);
+    }
+
+    return 0.0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Record the stage durations of one frame
+//////////////////////////////////////////////////////////////////////////////
+void RecordFrame(FrameStats& stats, const uint64_t ticks[STAGE_COUNT], uint64_t pixels)
+{
+    std::lock_guard<std::mutex> lock(stats.lock);
+
+    uint64_t total = 0;
+
+    for (unsigned int i = 0; i < STAGE_COUNT; i++)
+    {
+        AddSample(stats.stage[i], ticks[i]);
+        total = total + ticks[i];
+    }
+
+    AddSample(stats.frame, total);
+    stats.pixels = stats.pixels + pixels;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// One value of one stage: frames, total, mean, p50, p99 or mpix. Times are
+// in milliseconds, "frame" is the whole of GetFrame
+//////////////////////////////////////////////////////////////////////////////
+bool QueryStats(FrameStats& stats, const char* stage, const char* value, double& result)
+{
+    std::lock_guard<std::mutex> lock(stats.lock);
+
+    const StageCounter* counter = NULL;
+
+    if (!strcmp(stage, "frame"))
+        counter = &stats.frame;
+
+    for (unsigned int i = 0; i < STAGE_COUNT; i++)
+    {
+        if (!strcmp(stage, stagenames[i]))
+            counter = &stats.stage[i];
+    }
+
+    if (counter == NULL)
+        return false;
+
+    const double milliseconds = 1000.0 / TimestampFrequency();
+
+    if (!strcmp(value, "frames"))
+        result = (double)counter->count;
+    else if (!strcmp(value, "total"))
+        result = counter->ticks * milliseconds;
+    else if (!strcmp(value, "mean"))
+        result = counter->count > 0 ? counter->ticks * milliseconds / counter->count : 0.0;
+    else if (!strcmp(value, "p50"))
+        result = Percentile(*counter, 0.50) * milliseconds;
+    else if (!strcmp(value, "p99"))
+        result = Percentile(*counter, 0.99) * milliseconds;
+    else if (!strcmp(value, "mpix"))
+        result = counter->ticks > 0 ? stats.pixels / (counter->ticks * milliseconds * 1000.0) : 0.0;
+    else
+        return false;
+
+    return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Human readable report of all counters
+//////////////////////////////////////////////////////////////////////////////
+std::string FormatStats(FrameStats& stats)
+{
+    char line[256];
+    std::string report;
+
+    double frames = 0.0;
+    double mpix = 0.0;
+
+    QueryStats(stats, "frame", "frames", frames);
+    QueryStats(stats, "frame", "mpix", mpix);
+
+    snprintf(line, sizeof(line), "median stats %s: %.0f frames, %.2f Mpix/s\n", stats.name.c_str(), frames, mpix);
+    report = report + line;
+
+    snprintf(line, sizeof(line), "%-8s %12s %10s %10s %10s\n", "stage", "total ms", "mean ms", "p50 ms", "p99 ms");
+    report = report + line;
+
+    for (unsigned int i = 0; i <= STAGE_COUNT; i++)
+    {
+        const char* stage = i < STAGE_COUNT ? stagenames[i] : "frame";
+
+        double total = 0.0, mean = 0.0, p50 = 0.0, p99 = 0.0;
+
+        QueryStats(stats, stage, "total", total);
+        QueryStats(stats, stage, "mean", mean);
+        QueryStats(stats, stage, "p50", p50);
+        QueryStats(stats, stage, "p99", p99);
+
+        snprintf(line, sizeof(line), "%-8s %12.2f %10.3f %10.3f %10.3f\n", stage, total, mean, p50, p99);
+        report = report + line;
+    }
+
+    return report;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Instances that collect statistics, looked up by name from scripts. The
+// registry stays locked for as long as the caller holds the lock, so the
+// instance cannot go away while it is read.
+//////////////////////////////////////////////////////////////////////////////
+void RegisterStats(FrameStats* stats)
+{
+    std::lock_guard<std::mutex> lock(registrylock);
+
+    registry.push_back(stats);
+}
+
+void UnregisterStats(FrameStats* stats)
+{
+    std::lock_guard<std::mutex> lock(registrylock);
+
+    registry.erase(std::remove(registry.begin(), registry.end(), stats), registry.end());
+}
+
+FrameStats* LookupStats(const char* name, std::unique_lock<std::mutex>& lock)
+{
+    lock = std::unique_lock<std::mutex>(registrylock);
+
+    // The most recent instance wins when names are reused
+    for (size_t i = registry.size(); i > 0; i--)
+    {
+        if (registry[i - 1]->name == name)
+            return registry[i - 1];
+    }
+
+    return NULL;
+}
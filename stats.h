@@ -0,0 +1,58 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <string>
+#include <mutex>
+#include <stdint.h>
+
+// Latency histogram: 8 buckets per power of two, about 12% resolution
+#define HISTOGRAM_STEPS 8
+#define HISTOGRAM_BUCKETS (64 * HISTOGRAM_STEPS)
+
+//////////////////////////////////////////////////////////////////////////////
+// Stages of GetFrame that are timed
+//////////////////////////////////////////////////////////////////////////////
+enum Stage
+{
+    STAGE_SYNC,     // Fetching the sources and finding the sync offsets
+    STAGE_SHIFT,    // Global shift and row jitter estimation
+    STAGE_PROCESS,  // The median itself
+    STAGE_DEBUG,    // Debug overlay
+    STAGE_COUNT
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Time spent in one stage over all frames, in timestamp ticks
+//////////////////////////////////////////////////////////////////////////////
+struct StageCounter
+{
+    uint64_t count = 0;
+    uint64_t ticks = 0;
+    uint64_t bucket[HISTOGRAM_BUCKETS] = {};
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Counters of one filter instance
+//////////////////////////////////////////////////////////////////////////////
+struct FrameStats
+{
+    std::string name;               // Used to look the counters up from scripts
+    std::string file;               // Report is appended here, empty -> stderr
+    StageCounter stage[STAGE_COUNT];
+    StageCounter frame;             // All stages together
+    uint64_t pixels = 0;
+    std::mutex lock;
+};
+
+uint64_t ReadTimestamp();
+double TimestampFrequency();
+
+void RecordFrame(FrameStats& stats, const uint64_t ticks[STAGE_COUNT], uint64_t pixels);
+std::string FormatStats(FrameStats& stats);
+bool QueryStats(FrameStats& stats, const char* stage, const char* value, double& result);
+
+void RegisterStats(FrameStats* stats);
+void UnregisterStats(FrameStats* stats);
+FrameStats* LookupStats(const char* name, std::unique_lock<std::mutex>& lock);
+
+#endif // STATS_H
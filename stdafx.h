@@ -18,7 +18,19 @@
 // TODO: reference additional headers your program requires here
 #include "avisynth.h"
 #include "opt_med.h"
+#include "align.h"
+#include "agree.h"
+#include "network.h"
+#include "weighted.h"
+#include "audio.h"
+#include "shift.h"
+#include "stats.h"
+#include "trace.h"
+#include "perf.h"
+#include "print.h"
+#include "spatial.h"
 #include "median.h"
+#include "histogram.h"
 
 #include <algorithm>
 
@@ -0,0 +1,165 @@
+#include "stdafx.h"
+#include <stdio.h>
+#include <unordered_map>
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Buffer of the calling thread, created on its first event
+//
+// Every thread remembers its buffer of every instance it recorded for, so
+// the tracer lock is only taken once per thread and instance, also when
+// several traced instances run on the same thread. Instances are told apart
+// by id, which is never reused, so entries of destroyed instances are never
+// looked at again.
+//////////////////////////////////////////////////////////////////////////////
+static TraceBuffer* ThreadBuffer(Tracer* tracer)
+{
+    thread_local std::unordered_map<unsigned int, TraceBuffer*> cached;
+
+    const auto found = cached.find(tracer->id);
+
+    if (found != cached.end())
+        return found->second;
+
+    const std::thread::id thread = std::this_thread::get_id();
+
+    std::lock_guard<std::mutex> lock(tracer->lock);
+
+    TraceBuffer* buffer = NULL;
+
+    for (size_t i = 0; i < tracer->buffers.size() && buffer == NULL; i++)
+    {
+        if (tracer->buffers[i]->thread == thread)
+            buffer = tracer->buffers[i];
+    }
+
+    if (buffer == NULL)
+    {
+        buffer = new TraceBuffer();
+        buffer->thread = thread;
+        buffer->head = 0;
+        buffer->events.resize(TRACE_CAPACITY);
+
+        tracer->buffers.push_back(buffer);
+    }
+
+    cached[tracer->id] = buffer;
+
+    return buffer;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Tracer that writes to the given file when it is destroyed
+//////////////////////////////////////////////////////////////////////////////
+Tracer* CreateTracer(const char* file)
+{
+    static std::atomic<unsigned int> instances(0);
+
+    Tracer* tracer = new Tracer();
+
+    tracer->id = ++instances;
+    tracer->file = file;
+    tracer->start = ReadTimestamp();
+
+    return tracer;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Add an event to the ring of the calling thread
+//////////////////////////////////////////////////////////////////////////////
+void RecordEvent(Tracer* tracer, const TraceEvent& event)
+{
+    TraceBuffer* buffer = ThreadBuffer(tracer);
+
+    const uint64_t head = buffer->head.load(std::memory_order_relaxed);
+
+    buffer->events[head % TRACE_CAPACITY] = event;
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Write all events as Chrome trace event JSON, one complete event ("X") per
+// span with times in microseconds. Each buffer becomes one thread.
+//////////////////////////////////////////////////////////////////////////////
+void WriteTrace(Tracer* tracer)
+{
+    FILE* file = fopen(tracer->file.c_str(), "w");
+
+    if (file == NULL)
+        return;
+
+    const double microseconds = 1000000.0 / TimestampFrequency();
+
+    std::lock_guard<std::mutex> lock(tracer->lock);
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"Median\"}}", tracer->id);
+
+    for (size_t t = 0; t < tracer->buffers.size(); t++)
+    {
+        const TraceBuffer* buffer = tracer->buffers[t];
+        const uint64_t head = buffer->head.load(std::memory_order_acquire);
+        const uint64_t first = head > TRACE_CAPACITY ? head - TRACE_CAPACITY : 0;
+
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}", tracer->id, (unsigned int)t, (unsigned int)t);
+
+        for (uint64_t i = first; i < head; i++)
+        {
+            const TraceEvent& event = buffer->events[i % TRACE_CAPACITY];
+
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{",
+                event.name, tracer->id, (unsigned int)t, (int64_t)(event.begin - tracer->start) * microseconds, (event.end - event.begin) * microseconds);
+
+            for (int k = 0; k < 2 && event.key[k] != NULL; k++)
+                fprintf(file, "%s\"%s\":%d", k > 0 ? "," : "", event.key[k], event.value[k]);
+
+            fprintf(file, "}}");
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Free a tracer and all of its buffers
+//////////////////////////////////////////////////////////////////////////////
+void DestroyTracer(Tracer* tracer)
+{
+    for (size_t i = 0; i < tracer->buffers.size(); i++)
+        delete tracer->buffers[i];
+
+    delete tracer;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Scope timing
+//////////////////////////////////////////////////////////////////////////////
+TraceScope::TraceScope(Tracer* _tracer, const char* name, const char* key0, int value0, const char* key1, int value1) :
+tracer(_tracer)
+{
+    if (tracer == NULL)
+        return;
+
+    event.name = name;
+    event.key[0] = key0;
+    event.value[0] = value0;
+    event.key[1] = key1;
+    event.value[1] = value1;
+    event.begin = ReadTimestamp();
+}
+
+TraceScope::~TraceScope()
+{
+    if (tracer == NULL)
+        return;
+
+    event.end = ReadTimestamp();
+
+    RecordEvent(tracer, event);
+}
@@ -0,0 +1,70 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <stdint.h>
+
+#define TRACE_CAPACITY 65536    // Events kept per thread, older ones are overwritten
+#define TRACE_ROWS 64           // Rows of a plane processed as one span
+
+//////////////////////////////////////////////////////////////////////////////
+// One timed span, names and keys point to string literals
+//////////////////////////////////////////////////////////////////////////////
+struct TraceEvent
+{
+    const char* name;
+    uint64_t begin;
+    uint64_t end;
+    const char* key[2];     // Arguments shown with the event, NULL if unused
+    int value[2];
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Ring of events written by a single thread
+//
+// Only the owning thread writes, so recording needs no locks. The events are
+// read once the filter is destroyed and no thread records any more.
+//////////////////////////////////////////////////////////////////////////////
+struct TraceBuffer
+{
+    std::thread::id thread;
+    std::atomic<uint64_t> head;
+    std::vector<TraceEvent> events;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Trace of one filter instance
+//////////////////////////////////////////////////////////////////////////////
+struct Tracer
+{
+    unsigned int id;                    // Tells instances apart in the thread caches
+    std::string file;                   // Chrome trace JSON is written here
+    uint64_t start;                     // Timestamp all events are relative to
+    std::vector<TraceBuffer*> buffers;  // One per thread that recorded anything
+    std::mutex lock;                    // Guards buffers
+};
+
+Tracer* CreateTracer(const char* file);
+void WriteTrace(Tracer* tracer);
+void DestroyTracer(Tracer* tracer);
+void RecordEvent(Tracer* tracer, const TraceEvent& event);
+
+//////////////////////////////////////////////////////////////////////////////
+// Records the lifetime of a scope as an event, does nothing without a tracer
+//////////////////////////////////////////////////////////////////////////////
+class TraceScope
+{
+public:
+    TraceScope(Tracer* _tracer, const char* name, const char* key0 = NULL, int value0 = 0, const char* key1 = NULL, int value1 = 0);
+    ~TraceScope();
+
+private:
+    Tracer* tracer;
+    TraceEvent event;
+};
+
+#endif // TRACE_H
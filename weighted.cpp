@@ -0,0 +1,253 @@
+#include "stdafx.h"
+#include "weighted.h"
+
+#ifdef INTEL_INTRINSICS
+#include <emmintrin.h>
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Plain C version, one sample at a time through the same network
+//////////////////////////////////////////////////////////////////////////////
+template<typename T>
+static void WeightedRowsC(const unsigned char* const* rows, const unsigned int* weight, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int blend, unsigned char* dst, int first, int last)
+{
+    const unsigned int end = low + blend;
+
+    T* out = (T*)dst;
+
+    for (int x = first; x < last; x++)
+    {
+        uint32_t keys[WEIGHTED_ROWS];
+
+        for (unsigned int k = 0; k < count; k++)
+            keys[k] = ((uint32_t)((const T*)rows[k])[x] << 16) | weight[k];
+
+        for (size_t c = 0; c < comparators; c++)
+        {
+            const uint32_t a = keys[network[c].a];
+            const uint32_t b = keys[network[c].b];
+
+            keys[network[c].a] = std::min(a, b);
+            keys[network[c].b] = std::max(a, b);
+        }
+
+        uint32_t sum = 0;
+        unsigned int position = 0;
+
+        for (unsigned int k = 0; k < count && position < end; k++)
+        {
+            const unsigned int from = std::max(position, low);
+
+            position = position + (keys[k] & 0xffff);
+
+            const unsigned int to = std::min(position, end);
+
+            if (to > from)
+                sum = sum + (keys[k] >> 16) * (to - from);
+        }
+
+        out[x] = (T)(sum / blend);
+    }
+}
+
+template<typename T>
+static void MaskedRowsC(const unsigned char* const* rows, const unsigned char* const* masks, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int high, unsigned char* dst, int first, int last)
+{
+    const unsigned int lowscale = low * MaskScale(count);
+    const unsigned int highscale = high * MaskScale(count);
+
+    T* out = (T*)dst;
+
+    for (int x = first; x < last; x++)
+    {
+        unsigned int remaining = 0;
+
+        for (unsigned int k = 0; k < count; k++)
+            remaining = remaining + (((const T*)masks[k])[x] != 0);
+
+        // Where every value is masked out, all of them are taken
+        const bool none = remaining == 0;
+
+        if (none)
+            remaining = count;
+
+        uint32_t keys[WEIGHTED_ROWS];
+
+        for (unsigned int k = 0; k < count; k++)
+        {
+            if (none || ((const T*)masks[k])[x] != 0)
+                keys[k] = ((uint32_t)((const T*)rows[k])[x] << 16) | 1;
+            else
+                keys[k] = 0xffff0000;
+        }
+
+        for (size_t c = 0; c < comparators; c++)
+        {
+            const uint32_t a = keys[network[c].a];
+            const uint32_t b = keys[network[c].b];
+
+            keys[network[c].a] = std::min(a, b);
+            keys[network[c].b] = std::max(a, b);
+        }
+
+        const unsigned int lower = (remaining * lowscale) >> 16;
+        const unsigned int upper = remaining - ((remaining * highscale) >> 16);
+
+        uint32_t sum = 0;
+        unsigned int position = 0;
+
+        for (unsigned int k = 0; k < count && position < upper; k++)
+        {
+            if (position >= lower)
+                sum = sum + (keys[k] >> 16) * (keys[k] & 0xffff);
+
+            position = position + (keys[k] & 0xffff);
+        }
+
+        out[x] = (T)(sum / (upper - lower));
+    }
+}
+
+void weighted_row_8_c(const unsigned char* const* rows, const unsigned int* weight, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int blend, unsigned char* dst, int first, int last)
+{
+    WeightedRowsC<uint8_t>(rows, weight, count, network, comparators, low, blend, dst, first, last);
+}
+
+void weighted_row_16_c(const unsigned char* const* rows, const unsigned int* weight, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int blend, unsigned char* dst, int first, int last)
+{
+    WeightedRowsC<uint16_t>(rows, weight, count, network, comparators, low, blend, dst, first, last);
+}
+
+void masked_row_8_c(const unsigned char* const* rows, const unsigned char* const* masks, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int high, unsigned char* dst, int first, int last)
+{
+    MaskedRowsC<uint8_t>(rows, masks, count, network, comparators, low, high, dst, first, last);
+}
+
+void masked_row_16_c(const unsigned char* const* rows, const unsigned char* const* masks, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int high, unsigned char* dst, int first, int last)
+{
+    MaskedRowsC<uint16_t>(rows, masks, count, network, comparators, low, high, dst, first, last);
+}
+
+
+#ifdef INTEL_INTRINSICS
+//////////////////////////////////////////////////////////////////////////////
+// SSE2 versions, 4 samples at a time. Without unsigned 32-bit compares the
+// keys are compared with the top bit flipped, and the products are made of
+// two 64-bit multiplies.
+//////////////////////////////////////////////////////////////////////////////
+struct WeightedSse2
+{
+    typedef __m128i Vector;
+    enum { width = 4 };
+
+    static Vector Set(uint32_t v) { return _mm_set1_epi32((int)v); }
+    static Vector Or(Vector a, Vector b) { return _mm_or_si128(a, b); }
+    static Vector And(Vector a, Vector b) { return _mm_and_si128(a, b); }
+    static Vector Add(Vector a, Vector b) { return _mm_add_epi32(a, b); }
+    static Vector Sub(Vector a, Vector b) { return _mm_sub_epi32(a, b); }
+    static Vector AndNot(Vector a, Vector b) { return _mm_andnot_si128(a, b); }
+    static Vector Equal(Vector a, Vector b) { return _mm_cmpeq_epi32(a, b); }
+    static Vector Key(Vector v) { return _mm_slli_epi32(v, 16); }
+    static Vector Sample(Vector key) { return _mm_srli_epi32(key, 16); }
+    static void Store(uint32_t* p, Vector v) { _mm_storeu_si128((__m128i*)p, v); }
+
+    static Vector Select(Vector mask, Vector a, Vector b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+
+    static Vector Min(Vector a, Vector b) { return Select(_mm_cmpgt_epi32(a, b), b, a); }
+    static Vector Max(Vector a, Vector b) { return Select(_mm_cmpgt_epi32(a, b), a, b); }
+
+    static Vector KeyGreater(Vector a, Vector b)
+    {
+        const Vector flip = _mm_set1_epi32((int)0x80000000);
+        return _mm_cmpgt_epi32(_mm_xor_si128(a, flip), _mm_xor_si128(b, flip));
+    }
+
+    static Vector KeyMin(Vector a, Vector b) { return Select(KeyGreater(a, b), b, a); }
+    static Vector KeyMax(Vector a, Vector b) { return Select(KeyGreater(a, b), a, b); }
+
+    static Vector Mul(Vector a, Vector b)
+    {
+        const Vector even = _mm_mul_epu32(a, b);
+        const Vector odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+        return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+    }
+};
+
+struct Weighted8Sse2 : WeightedSse2
+{
+    typedef uint8_t Value;
+
+    static Vector Load(const Value* p)
+    {
+        // Four samples at any alignment
+        int packed;
+        memcpy(&packed, p, sizeof(packed));
+
+        const Vector zero = _mm_setzero_si128();
+        return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+    }
+};
+
+struct Weighted16Sse2 : WeightedSse2
+{
+    typedef uint16_t Value;
+
+    static Vector Load(const Value* p) { return _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)p), _mm_setzero_si128()); }
+};
+
+void weighted_row_8_sse2(const unsigned char* const* rows, const unsigned int* weight, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int blend, unsigned char* dst, int first, int last)
+{
+    first = WeightedRows<Weighted8Sse2>(rows, weight, count, network, comparators, low, blend, dst, first, last);
+    weighted_row_8_c(rows, weight, count, network, comparators, low, blend, dst, first, last);
+}
+
+void weighted_row_16_sse2(const unsigned char* const* rows, const unsigned int* weight, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int blend, unsigned char* dst, int first, int last)
+{
+    first = WeightedRows<Weighted16Sse2>(rows, weight, count, network, comparators, low, blend, dst, first, last);
+    weighted_row_16_c(rows, weight, count, network, comparators, low, blend, dst, first, last);
+}
+
+void masked_row_8_sse2(const unsigned char* const* rows, const unsigned char* const* masks, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int high, unsigned char* dst, int first, int last)
+{
+    first = MaskedRows<Weighted8Sse2>(rows, masks, count, network, comparators, low, high, dst, first, last);
+    masked_row_8_c(rows, masks, count, network, comparators, low, high, dst, first, last);
+}
+
+void masked_row_16_sse2(const unsigned char* const* rows, const unsigned char* const* masks, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int high, unsigned char* dst, int first, int last)
+{
+    first = MaskedRows<Weighted16Sse2>(rows, masks, count, network, comparators, low, high, dst, first, last);
+    masked_row_16_c(rows, masks, count, network, comparators, low, high, dst, first, last);
+}
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Pick the fastest version the CPU supports
+//////////////////////////////////////////////////////////////////////////////
+WeightedRowFunction GetWeightedRowFunction(int size, int cpuflags)
+{
+#ifdef INTEL_INTRINSICS
+    if (cpuflags & CPUF_AVX2)
+        return size == 1 ? weighted_row_8_avx2 : weighted_row_16_avx2;
+
+    if (cpuflags & CPUF_SSE2)
+        return size == 1 ? weighted_row_8_sse2 : weighted_row_16_sse2;
+#endif
+
+    return size == 1 ? weighted_row_8_c : weighted_row_16_c;
+}
+
+MaskedRowFunction GetMaskedRowFunction(int size, int cpuflags)
+{
+#ifdef INTEL_INTRINSICS
+    if (cpuflags & CPUF_AVX2)
+        return size == 1 ? masked_row_8_avx2 : masked_row_16_avx2;
+
+    if (cpuflags & CPUF_SSE2)
+        return size == 1 ? masked_row_8_sse2 : masked_row_16_sse2;
+#endif
+
+    return size == 1 ? masked_row_8_c : masked_row_16_c;
+}
@@ -0,0 +1,217 @@
+#ifndef WEIGHTED_H
+#define WEIGHTED_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+const unsigned int MAX_WEIGHT = 255;        // Of one clip
+const unsigned int WEIGHTED_ROWS = 25;      // Rows of a kernel at most, one per clip
+
+//////////////////////////////////////////////////////////////////////////////
+// Blend of sorted positions low to low + blend - 1 of the samples first to
+// last of count rows, every row counted as many times as its weight. Rows
+// hold uint8_t or uint16_t samples.
+//
+// Weights are packed below the values into 32-bit keys, so that one sort
+// orders both, and the keys go through network, which needs to sort the
+// first low + blend positions. The positions every key covers are then
+// summed up in order.
+//////////////////////////////////////////////////////////////////////////////
+typedef void (*WeightedRowFunction)(const unsigned char* const* rows, const unsigned int* weight, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int blend, unsigned char* dst, int first, int last);
+
+void weighted_row_8_c(const unsigned char* const* rows, const unsigned int* weight, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int blend, unsigned char* dst, int first, int last);
+void weighted_row_16_c(const unsigned char* const* rows, const unsigned int* weight, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int blend, unsigned char* dst, int first, int last);
+
+#ifdef INTEL_INTRINSICS
+void weighted_row_8_sse2(const unsigned char* const* rows, const unsigned int* weight, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int blend, unsigned char* dst, int first, int last);
+void weighted_row_16_sse2(const unsigned char* const* rows, const unsigned int* weight, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int blend, unsigned char* dst, int first, int last);
+void weighted_row_8_avx2(const unsigned char* const* rows, const unsigned int* weight, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int blend, unsigned char* dst, int first, int last);
+void weighted_row_16_avx2(const unsigned char* const* rows, const unsigned int* weight, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int blend, unsigned char* dst, int first, int last);
+#endif
+
+// Fastest version for samples of size bytes
+WeightedRowFunction GetWeightedRowFunction(int size, int cpuflags);
+
+//////////////////////////////////////////////////////////////////////////////
+// Blend of the samples first to last of count rows where the masks are not
+// 0, the values masked out left out. low and high are taken out of the m
+// values left in proportion, low * m / count and high * m / count, which for
+// the median of count values is the median of the m. Where every value is
+// masked out, all are taken.
+//
+// Masked out values go through network as the largest key, so network needs
+// to sort the first count - high positions.
+//////////////////////////////////////////////////////////////////////////////
+typedef void (*MaskedRowFunction)(const unsigned char* const* rows, const unsigned char* const* masks, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int high, unsigned char* dst, int first, int last);
+
+void masked_row_8_c(const unsigned char* const* rows, const unsigned char* const* masks, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int high, unsigned char* dst, int first, int last);
+void masked_row_16_c(const unsigned char* const* rows, const unsigned char* const* masks, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int high, unsigned char* dst, int first, int last);
+
+#ifdef INTEL_INTRINSICS
+void masked_row_8_sse2(const unsigned char* const* rows, const unsigned char* const* masks, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int high, unsigned char* dst, int first, int last);
+void masked_row_16_sse2(const unsigned char* const* rows, const unsigned char* const* masks, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int high, unsigned char* dst, int first, int last);
+void masked_row_8_avx2(const unsigned char* const* rows, const unsigned char* const* masks, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int high, unsigned char* dst, int first, int last);
+void masked_row_16_avx2(const unsigned char* const* rows, const unsigned char* const* masks, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int high, unsigned char* dst, int first, int last);
+#endif
+
+MaskedRowFunction GetMaskedRowFunction(int size, int cpuflags);
+
+// Proportion of m taken out for low or high of count, x * m / count, as
+// (m * x * MaskScale(count)) >> 16. Exact for m up to count and x below.
+inline unsigned int MaskScale(unsigned int count)
+{
+    return 65536 / count + 1;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Shared body of the vector versions, a key of every sample in a 32-bit
+// lane. Ops wraps the instructions of one sample type and instruction set.
+// Returns the first sample left for the plain C version.
+//////////////////////////////////////////////////////////////////////////////
+template<typename Ops>
+int WeightedRows(const unsigned char* const* rows, const unsigned int* weight, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int blend, unsigned char* dst, int first, int last)
+{
+    typedef typename Ops::Value Value;
+    typedef typename Ops::Vector Vector;
+
+    last = first + (last - first) / Ops::width * Ops::width;
+
+    const Vector zero = Ops::Set(0);
+    const Vector mask = Ops::Set(0xffff);
+    const Vector lower = Ops::Set(low);
+    const Vector upper = Ops::Set(low + blend);
+
+    Value* out = (Value*)dst;
+
+    for (int x = first; x < last; x = x + Ops::width)
+    {
+        Vector keys[WEIGHTED_ROWS];
+
+        for (unsigned int k = 0; k < count; k++)
+            keys[k] = Ops::Or(Ops::Key(Ops::Load((const Value*)rows[k] + x)), Ops::Set(weight[k]));
+
+        for (size_t c = 0; c < comparators; c++)
+        {
+            const Vector a = keys[network[c].a];
+            const Vector b = keys[network[c].b];
+
+            keys[network[c].a] = Ops::KeyMin(a, b);
+            keys[network[c].b] = Ops::KeyMax(a, b);
+        }
+
+        // Positions of every key that fall between low and low + blend
+        Vector position = zero;
+        Vector sum = zero;
+
+        for (unsigned int k = 0; k < count; k++)
+        {
+            const Vector from = Ops::Max(position, lower);
+
+            position = Ops::Add(position, Ops::And(keys[k], mask));
+
+            const Vector covered = Ops::Max(Ops::Sub(Ops::Min(position, upper), from), zero);
+
+            sum = Ops::Add(sum, Ops::Mul(Ops::Sample(keys[k]), covered));
+        }
+
+        uint32_t sums[Ops::width];
+        Ops::Store(sums, sum);
+
+        for (int i = 0; i < Ops::width; i++)
+            out[x + i] = (Value)(blend == 1 ? sums[i] : sums[i] / blend);
+    }
+
+    return last;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Shared body of the masked vector versions, the same keys with a weight of
+// 1 for the values left in and every value masked out made the largest key
+// with a weight of 0. Returns the first sample left for the plain C version.
+//////////////////////////////////////////////////////////////////////////////
+template<typename Ops>
+int MaskedRows(const unsigned char* const* rows, const unsigned char* const* masks, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int high, unsigned char* dst, int first, int last)
+{
+    typedef typename Ops::Value Value;
+    typedef typename Ops::Vector Vector;
+
+    last = first + (last - first) / Ops::width * Ops::width;
+
+    const Vector zero = Ops::Set(0);
+    const Vector one = Ops::Set(1);
+    const Vector mask = Ops::Set(0xffff);
+    const Vector sentinel = Ops::Set(0xffff0000);
+    const Vector all = Ops::Set(count);
+    const Vector lowscale = Ops::Set(low * MaskScale(count));
+    const Vector highscale = Ops::Set(high * MaskScale(count));
+
+    Value* out = (Value*)dst;
+
+    for (int x = first; x < last; x = x + Ops::width)
+    {
+        Vector valid[WEIGHTED_ROWS];
+        Vector remaining = zero;
+
+        for (unsigned int k = 0; k < count; k++)
+        {
+            valid[k] = Ops::AndNot(Ops::Equal(Ops::Load((const Value*)masks[k] + x), zero), one);
+            remaining = Ops::Add(remaining, valid[k]);
+        }
+
+        // Where every value is masked out, all of them are taken
+        const Vector none = Ops::Equal(remaining, zero);
+
+        remaining = Ops::Add(remaining, Ops::And(none, all));
+
+        Vector keys[WEIGHTED_ROWS];
+
+        for (unsigned int k = 0; k < count; k++)
+        {
+            const Vector weight = Ops::Or(valid[k], Ops::And(none, one));
+            const Vector key = Ops::Or(Ops::Key(Ops::Load((const Value*)rows[k] + x)), weight);
+
+            keys[k] = Ops::Or(key, Ops::And(Ops::Equal(weight, zero), sentinel));
+        }
+
+        for (size_t c = 0; c < comparators; c++)
+        {
+            const Vector a = keys[network[c].a];
+            const Vector b = keys[network[c].b];
+
+            keys[network[c].a] = Ops::KeyMin(a, b);
+            keys[network[c].b] = Ops::KeyMax(a, b);
+        }
+
+        // Positions low and high of the values left in, the top halves of
+        // the products
+        const Vector lower = Ops::Sample(Ops::Mul(remaining, lowscale));
+        const Vector upper = Ops::Sub(remaining, Ops::Sample(Ops::Mul(remaining, highscale)));
+
+        Vector position = zero;
+        Vector sum = zero;
+
+        for (unsigned int k = 0; k < count; k++)
+        {
+            const Vector from = Ops::Max(position, lower);
+
+            position = Ops::Add(position, Ops::And(keys[k], mask));
+
+            const Vector covered = Ops::Max(Ops::Sub(Ops::Min(position, upper), from), zero);
+
+            sum = Ops::Add(sum, Ops::Mul(Ops::Sample(keys[k]), covered));
+        }
+
+        uint32_t sums[Ops::width];
+        uint32_t blends[Ops::width];
+
+        Ops::Store(sums, sum);
+        Ops::Store(blends, Ops::Sub(upper, lower));
+
+        for (int i = 0; i < Ops::width; i++)
+            out[x + i] = (Value)(sums[i] / blends[i]);
+    }
+
+    return last;
+}
+
+#endif // WEIGHTED_H
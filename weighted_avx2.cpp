@@ -0,0 +1,83 @@
+#include "stdafx.h"
+#include "weighted.h"
+
+#ifdef INTEL_INTRINSICS
+#include <immintrin.h>
+
+
+//////////////////////////////////////////////////////////////////////////////
+// AVX2 versions, 8 samples at a time
+//////////////////////////////////////////////////////////////////////////////
+struct WeightedAvx2
+{
+    typedef __m256i Vector;
+    enum { width = 8 };
+
+    static Vector Set(uint32_t v) { return _mm256_set1_epi32((int)v); }
+    static Vector Or(Vector a, Vector b) { return _mm256_or_si256(a, b); }
+    static Vector And(Vector a, Vector b) { return _mm256_and_si256(a, b); }
+    static Vector Add(Vector a, Vector b) { return _mm256_add_epi32(a, b); }
+    static Vector Sub(Vector a, Vector b) { return _mm256_sub_epi32(a, b); }
+    static Vector AndNot(Vector a, Vector b) { return _mm256_andnot_si256(a, b); }
+    static Vector Equal(Vector a, Vector b) { return _mm256_cmpeq_epi32(a, b); }
+    static Vector Min(Vector a, Vector b) { return _mm256_min_epi32(a, b); }
+    static Vector Max(Vector a, Vector b) { return _mm256_max_epi32(a, b); }
+    static Vector Mul(Vector a, Vector b) { return _mm256_mullo_epi32(a, b); }
+    static Vector Key(Vector v) { return _mm256_slli_epi32(v, 16); }
+    static Vector KeyMin(Vector a, Vector b) { return _mm256_min_epu32(a, b); }
+    static Vector KeyMax(Vector a, Vector b) { return _mm256_max_epu32(a, b); }
+    static Vector Sample(Vector key) { return _mm256_srli_epi32(key, 16); }
+    static void Store(uint32_t* p, Vector v) { _mm256_storeu_si256((__m256i*)p, v); }
+};
+
+struct Weighted8Avx2 : WeightedAvx2
+{
+    typedef uint8_t Value;
+
+    static Vector Load(const Value* p) { return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p)); }
+};
+
+struct Weighted16Avx2 : WeightedAvx2
+{
+    typedef uint16_t Value;
+
+    static Vector Load(const Value* p) { return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)p)); }
+};
+
+void weighted_row_8_avx2(const unsigned char* const* rows, const unsigned int* weight, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int blend, unsigned char* dst, int first, int last)
+{
+    first = WeightedRows<Weighted8Avx2>(rows, weight, count, network, comparators, low, blend, dst, first, last);
+
+    _mm256_zeroupper();
+
+    weighted_row_8_c(rows, weight, count, network, comparators, low, blend, dst, first, last);
+}
+
+void weighted_row_16_avx2(const unsigned char* const* rows, const unsigned int* weight, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int blend, unsigned char* dst, int first, int last)
+{
+    first = WeightedRows<Weighted16Avx2>(rows, weight, count, network, comparators, low, blend, dst, first, last);
+
+    _mm256_zeroupper();
+
+    weighted_row_16_c(rows, weight, count, network, comparators, low, blend, dst, first, last);
+}
+
+void masked_row_8_avx2(const unsigned char* const* rows, const unsigned char* const* masks, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int high, unsigned char* dst, int first, int last)
+{
+    first = MaskedRows<Weighted8Avx2>(rows, masks, count, network, comparators, low, high, dst, first, last);
+
+    _mm256_zeroupper();
+
+    masked_row_8_c(rows, masks, count, network, comparators, low, high, dst, first, last);
+}
+
+void masked_row_16_avx2(const unsigned char* const* rows, const unsigned char* const* masks, unsigned int count, const Comparator* network, size_t comparators, unsigned int low, unsigned int high, unsigned char* dst, int first, int last)
+{
+    first = MaskedRows<Weighted16Avx2>(rows, masks, count, network, comparators, low, high, dst, first, last);
+
+    _mm256_zeroupper();
+
+    masked_row_16_c(rows, masks, count, network, comparators, low, high, dst, first, last);
+}
+
+#endif // INTEL_INTRINSICS